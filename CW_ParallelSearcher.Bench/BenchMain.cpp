@@ -0,0 +1,138 @@
+#include "ZipfCorpus.h"
+#include "Microbench.h"
+#include "LoadGenerator.h"
+#include "StorageChecks.h"
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <map>
+#include <chrono>
+
+// CW_ParallelSearcher.Bench <command> [options]
+//   corpus <directory> [--documents N] [--words N] [--vocabulary N] [--exponent S] [--seed N]
+//       writes a Zipf corpus, e.g. for CW_ParallelSearcher --import <directory>
+//   trace [--requests N] [--vocabulary N] [--exponent S] [--seed N]
+//       prints a request trace of searches over the words of that corpus
+//   micro [--filter NAME] [--threads N] [--seed N]
+//       runs the microbenchmarks, one JSON object per line
+//   load <trace file> [--host IP] [--port P] [--connections N] [--repeat N] [--seconds S] [--rate R]
+//       replays a trace against a running server and prints one JSON report; open loop
+//       at R requests per second, or at the trace's timestamps, else closed loop
+//   check [--filter NAME] [--seed N] [--directory D]
+//       runs the storage format checks, one JSON object per line; fails if any fails
+// The same seed and sizes give the same corpus and trace on every platform.
+namespace
+{
+    const char* const USAGE =
+        "Usage: CW_ParallelSearcher.Bench corpus <directory> [--documents N] [--words N] [--vocabulary N] [--exponent S] [--seed N]\n"
+        "       CW_ParallelSearcher.Bench trace [--requests N] [--vocabulary N] [--exponent S] [--seed N]\n"
+        "       CW_ParallelSearcher.Bench micro [--filter NAME] [--threads N] [--seed N]\n"
+        "       CW_ParallelSearcher.Bench load <trace file> [--host IP] [--port P] [--connections N] [--repeat N] [--seconds S] [--rate R]\n"
+        "       CW_ParallelSearcher.Bench check [--filter NAME] [--seed N] [--directory D]\n";
+
+    // "--name value" pairs after the positional arguments; false on anything else
+    bool parseOptions(int argc, char* argv[], int first, std::map<std::string, std::string>& options)
+    {
+        for (int i = first; i < argc; i += 2) {
+            std::string name = argv[i];
+            if (name.rfind("--", 0) != 0 || i + 1 >= argc)
+                return false;
+            options[name.substr(2)] = argv[i + 1];
+        }
+        return true;
+    }
+
+    ZipfCorpus::Options corpusOptions(const std::map<std::string, std::string>& options)
+    {
+        ZipfCorpus::Options corpus;
+        if (options.count("seed"))
+            corpus.seed = std::stoull(options.at("seed"));
+        if (options.count("vocabulary"))
+            corpus.vocabulary = std::stoul(options.at("vocabulary"));
+        if (options.count("exponent"))
+            corpus.exponent = std::stod(options.at("exponent"));
+        if (options.count("words"))
+            corpus.documentWords = std::stoul(options.at("words"));
+        return corpus;
+    }
+
+    std::string option(const std::map<std::string, std::string>& options, const std::string& name, const std::string& fallback)
+    {
+        auto it = options.find(name);
+        return it == options.end() ? fallback : it->second;
+    }
+}
+
+int main(int argc, char* argv[])
+{
+    std::string command = argc > 1 ? argv[1] : "";
+    bool positional = command == "corpus" || command == "load";
+    std::map<std::string, std::string> options;
+    if ((command != "corpus" && command != "trace" && command != "micro" && command != "load" && command != "check") ||
+        (positional && argc < 3) || !parseOptions(argc, argv, positional ? 3 : 2, options)) {
+        std::cerr << USAGE;
+        return EXIT_FAILURE;
+    }
+
+    try
+    {
+        if (command == "corpus") {
+            ZipfCorpus corpus(corpusOptions(options));
+            size_t documents = std::stoul(option(options, "documents", "1000"));
+            auto start = std::chrono::steady_clock::now();
+            uint64_t bytes = corpus.writeDirectory(argv[2], documents);
+            double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+            std::cout << "{\"documents\":" << documents << ",\"bytes\":" << bytes
+                << ",\"seconds\":" << seconds << "}" << std::endl;
+        }
+        else if (command == "trace") {
+            ZipfCorpus corpus(corpusOptions(options));
+            size_t requests = std::stoul(option(options, "requests", "10000"));
+            LoadGenerator::writeTrace(std::cout, LoadGenerator::synthesize(corpus, requests));
+        }
+        else if (command == "micro") {
+            Microbench::Options micro;
+            micro.seed = std::stoull(option(options, "seed", "1"));
+            micro.filter = option(options, "filter", "");
+            micro.threads = std::stoul(option(options, "threads", "0"));
+            if (Microbench::run(micro, std::cout) == 0) {
+                std::cerr << "No benchmark matches '" << micro.filter << "'" << std::endl;
+                return EXIT_FAILURE;
+            }
+        }
+        else if (command == "check") {
+            StorageChecks::Options check;
+            check.seed = std::stoull(option(options, "seed", "1"));
+            check.filter = option(options, "filter", "");
+            check.directory = option(options, "directory", "");
+            size_t failed = 0;
+            if (StorageChecks::run(check, std::cout, &failed) == 0) {
+                std::cerr << "No check matches '" << check.filter << "'" << std::endl;
+                return EXIT_FAILURE;
+            }
+            if (failed != 0)
+                return EXIT_FAILURE;
+        }
+        else {
+            std::ifstream in(argv[2]);
+            if (!in) {
+                std::cerr << "Cannot open trace " << argv[2] << std::endl;
+                return EXIT_FAILURE;
+            }
+            LoadGenerator::Options load;
+            load.host = option(options, "host", load.host);
+            load.port = std::stoi(option(options, "port", std::to_string(load.port)));
+            load.connections = std::stoul(option(options, "connections", std::to_string(load.connections)));
+            load.repeat = std::stoul(option(options, "repeat", "1"));
+            load.seconds = std::stod(option(options, "seconds", "0"));
+            load.rate = std::stod(option(options, "rate", "0"));
+            LoadGenerator::replay(LoadGenerator::readTrace(in), load).write(std::cout);
+        }
+    }
+    catch (const std::exception& ex)
+    {
+        std::cerr << "Exception: " << ex.what() << std::endl;
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,241 @@
+#include "LoadGenerator.h"
+#include <WinSock2.h>
+#include <ws2tcpip.h>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <algorithm>
+#include <stdexcept>
+#include <iomanip>
+#include <cmath>
+#include <cstdlib>
+#pragma comment(lib, "ws2_32.lib")
+
+namespace
+{
+    using Clock = std::chrono::steady_clock;
+
+    bool sendAll(SOCKET sock, const std::string& data)
+    {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            int n = send(sock, data.data() + sent, static_cast<int>(data.size() - sent), 0);
+            if (n <= 0)
+                return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    // Sends one request on a new connection and reads the response: up to the end of the
+    // headers, then Content-Length more bytes, or to the end of the stream without one.
+    // Returns whether the whole response arrived with a 2xx status.
+    bool execute(const sockaddr_in& address, const std::string& message)
+    {
+        SOCKET sock = socket(AF_INET, SOCK_STREAM, 0);
+        if (sock == INVALID_SOCKET)
+            return false;
+        if (connect(sock, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) == SOCKET_ERROR ||
+            !sendAll(sock, message)) {
+            closesocket(sock);
+            return false;
+        }
+        char buffer[LOAD_RECEIVE_BUFFER];
+        std::string response;
+        size_t headerEnd = std::string::npos;
+        size_t expected = std::string::npos; // whole response, once the headers are in
+        int n;
+        while (response.size() < expected && (n = recv(sock, buffer, sizeof(buffer), 0)) > 0) {
+            response.append(buffer, n);
+            if (headerEnd != std::string::npos || (headerEnd = response.find("\r\n\r\n")) == std::string::npos)
+                continue;
+            size_t length = response.find("Content-Length:");
+            if (length != std::string::npos && length < headerEnd)
+                expected = headerEnd + 4 + std::strtoull(response.c_str() + length + 15, nullptr, 10);
+        }
+        closesocket(sock);
+        // "HTTP/1.1 200 OK"
+        size_t space = response.find(' ');
+        bool complete = expected == std::string::npos ? headerEnd != std::string::npos : response.size() >= expected;
+        return complete && space != std::string::npos && space + 1 < response.size() && response[space + 1] == '2';
+    }
+
+    std::string serialize(const LoadGenerator::Request& request, const std::string& host)
+    {
+        std::string message = request.method + " " + request.target + " HTTP/1.1\r\n";
+        message += "Host: " + host + "\r\n";
+        message += "Connection: close\r\n";
+        if (!request.body.empty()) {
+            message += "Content-Type: application/json\r\n";
+            message += "Content-Length: " + std::to_string(request.body.size()) + "\r\n";
+        }
+        message += "\r\n" + request.body;
+        return message;
+    }
+}
+
+double LoadGenerator::Report::percentile(double p) const
+{
+    if (latencyMillis.empty())
+        return 0;
+    // nearest rank
+    size_t rank = static_cast<size_t>(std::ceil(p / 100.0 * latencyMillis.size()));
+    return latencyMillis[std::min(std::max<size_t>(rank, 1), latencyMillis.size()) - 1];
+}
+
+void LoadGenerator::Report::write(std::ostream& out) const
+{
+    double mean = 0;
+    for (double latency : latencyMillis)
+        mean += latency;
+    if (!latencyMillis.empty())
+        mean /= latencyMillis.size();
+    out << std::fixed << std::setprecision(3)
+        << "{\"requests\":" << requests
+        << ",\"errors\":" << errors
+        << ",\"seconds\":" << seconds
+        << ",\"requests_per_second\":" << (seconds > 0 ? requests / seconds : 0)
+        << ",\"loop\":\"" << (openLoop ? "open" : "closed") << "\""
+        << ",\"latency_ms\":{\"mean\":" << mean
+        << ",\"p50\":" << percentile(50)
+        << ",\"p99\":" << percentile(99)
+        << ",\"p999\":" << percentile(99.9)
+        << ",\"max\":" << (latencyMillis.empty() ? 0 : latencyMillis.back())
+        << "}}" << std::endl;
+}
+
+std::vector<LoadGenerator::Request> LoadGenerator::readTrace(std::istream& in)
+{
+    std::vector<Request> requests;
+    std::string line;
+    for (size_t number = 1; std::getline(in, line); ++number) {
+        if (!line.empty() && line.back() == '\r')
+            line.pop_back();
+        if (line.empty() || line[0] == '#')
+            continue;
+        Request request;
+        if (line[0] == '@') {
+            char* end = nullptr;
+            request.atMillis = std::strtod(line.c_str() + 1, &end);
+            if (end == line.c_str() + 1 || *end != ' ' || !(request.atMillis >= 0))
+                throw std::runtime_error("Trace line " + std::to_string(number) + " has no valid '@milliseconds' timestamp");
+            line.erase(0, end + 1 - line.c_str());
+        }
+        if (!requests.empty() && (requests[0].atMillis >= 0) != (request.atMillis >= 0))
+            throw std::runtime_error("Trace line " + std::to_string(number) + (request.atMillis >= 0 ?
+                " has a timestamp but the first request has none" : " has no timestamp but the first request has one"));
+        if (!requests.empty() && request.atMillis < requests.back().atMillis)
+            throw std::runtime_error("Trace line " + std::to_string(number) + " is due before the line before it");
+        size_t space = line.find(' ');
+        size_t tab = line.find('\t');
+        if (space == std::string::npos || space == 0 || space + 1 >= std::min(tab, line.size()))
+            throw std::runtime_error("Trace line " + std::to_string(number) + " is not '[@milliseconds ]METHOD target[\\tbody]'");
+        request.method = line.substr(0, space);
+        request.target = line.substr(space + 1, tab == std::string::npos ? std::string::npos : tab - space - 1);
+        if (tab != std::string::npos)
+            request.body = line.substr(tab + 1);
+        requests.push_back(std::move(request));
+    }
+    return requests;
+}
+
+void LoadGenerator::writeTrace(std::ostream& out, const std::vector<Request>& requests)
+{
+    for (const auto& request : requests) {
+        if (request.atMillis >= 0)
+            out << '@' << request.atMillis << ' ';
+        out << request.method << ' ' << request.target;
+        if (!request.body.empty())
+            out << '\t' << request.body;
+        out << '\n';
+    }
+}
+
+std::vector<LoadGenerator::Request> LoadGenerator::synthesize(ZipfCorpus& corpus, size_t count)
+{
+    std::vector<Request> requests;
+    requests.reserve(count);
+    for (size_t i = 0; i < count; ++i) {
+        uint64_t kind = corpus.nextRandom() % 20;
+        std::string target;
+        if (kind < 10) // one word
+            target = "/search?phrase=" + corpus.sampleWord();
+        else if (kind < 15) // a phrase
+            target = "/search?phrase=" + corpus.sampleWord() + "+" + corpus.sampleWord();
+        else if (kind < 18) // both words, anywhere in a file
+            target = "/search?q=" + corpus.sampleWord() + "+" + corpus.sampleWord();
+        else
+            target = "/suggest?prefix=" + corpus.sampleWord().substr(0, 3);
+        requests.push_back({ "GET", target, "" });
+    }
+    return requests;
+}
+
+LoadGenerator::Report LoadGenerator::replay(const std::vector<Request>& requests, const Options& options)
+{
+    Report report;
+    if (requests.empty())
+        return report;
+
+    WSADATA wsaData;
+    WSAStartup(MAKEWORD(2, 2), &wsaData);
+    sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_port = htons(static_cast<unsigned short>(options.port));
+    if (inet_pton(AF_INET, options.host.c_str(), &address.sin_addr) != 1) {
+        WSACleanup();
+        throw std::runtime_error("Not an IPv4 address: " + options.host);
+    }
+
+    std::vector<std::string> messages;
+    messages.reserve(requests.size());
+    for (const auto& request : requests)
+        messages.push_back(serialize(request, options.host + ":" + std::to_string(options.port)));
+
+    const uint64_t total = options.seconds > 0 ? UINT64_MAX : requests.size() * std::max<size_t>(options.repeat, 1);
+    // open loop: request i is due at due(i) ms from the start; a pass over a timestamped
+    // trace lasts until its last request and one mean interval more
+    report.openLoop = options.rate > 0 || requests[0].atMillis >= 0;
+    const double lastMillis = requests.back().atMillis;
+    const double passMillis = lastMillis + (requests.size() > 1 ? lastMillis / (requests.size() - 1) : 0);
+    auto due = [&](uint64_t i) {
+        if (options.rate > 0)
+            return i * 1000.0 / options.rate;
+        return (i / requests.size()) * passMillis + requests[i % requests.size()].atMillis;
+    };
+    const auto start = Clock::now();
+    const auto deadline = start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double>(options.seconds));
+    std::atomic<uint64_t> next{ 0 };
+    std::atomic<uint64_t> errors{ 0 };
+    std::mutex resultMutex;
+
+    auto connection = [&] {
+        std::vector<double> latencies;
+        for (uint64_t i; (i = next.fetch_add(1)) < total;) {
+            // when a request is late because every connection was busy, the wait is its latency too
+            auto sent = report.openLoop ? start + std::chrono::duration_cast<Clock::duration>(std::chrono::duration<double, std::milli>(due(i))) : Clock::now();
+            if (options.seconds > 0 && sent >= deadline)
+                break;
+            std::this_thread::sleep_until(sent);
+            if (!execute(address, messages[i % messages.size()]))
+                errors.fetch_add(1);
+            latencies.push_back(std::chrono::duration<double, std::milli>(Clock::now() - sent).count());
+        }
+        std::lock_guard<std::mutex> lock(resultMutex);
+        report.latencyMillis.insert(report.latencyMillis.end(), latencies.begin(), latencies.end());
+    };
+    std::vector<std::thread> connections;
+    for (size_t i = 0; i < std::max<size_t>(options.connections, 1); ++i)
+        connections.emplace_back(connection);
+    for (auto& thread : connections)
+        thread.join();
+
+    report.seconds = std::chrono::duration<double>(Clock::now() - start).count();
+    std::sort(report.latencyMillis.begin(), report.latencyMillis.end());
+    report.requests = report.latencyMillis.size();
+    report.errors = errors.load();
+    WSACleanup();
+    return report;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <istream>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+#include "ZipfCorpus.h"
+#define LOAD_DEFAULT_CONNECTIONS 8
+#define LOAD_RECEIVE_BUFFER (64 * 1024)
+
+// Replays a request trace against a running server from several connections at once and
+// reports throughput and latency percentiles. A trace is text, one request per line:
+//   [@milliseconds ]METHOD target[<TAB>body]
+// e.g. "GET /search?phrase=kare+mi" or "@12.5 POST /addfile\t{"filename":"a.txt","content":"..."}".
+// Blank lines and lines starting with '#' are skipped. The listener serves one request
+// per connection, so each request connects, sends, reads Content-Length bytes of response
+// and closes.
+//
+// A trace with timestamps, or a replay with a rate, runs open loop: each request is due
+// at its time from the start whether or not earlier ones have returned, and its latency
+// runs from when it was due to the last byte, so the time it waited for a free connection
+// counts too. Without either, the replay is closed loop: a connection sends its next
+// request only once the last one returned, so a slow response holds back the requests
+// behind it instead of delaying them, and the percentiles understate tail latency under
+// load (coordinated omission). Closed loop measures throughput; use open loop for latency.
+namespace LoadGenerator
+{
+    struct Request {
+        std::string method;
+        std::string target;
+        std::string body;
+        double atMillis = -1; // when it is due, from the start of the trace; -1: no timestamp
+    };
+
+    struct Options {
+        std::string host = "127.0.0.1";
+        int port = 8000;
+        size_t connections = LOAD_DEFAULT_CONNECTIONS; // requests in flight
+        size_t repeat = 1;    // passes over the trace
+        double seconds = 0;   // when > 0, loop over the trace for this long instead
+        double rate = 0;      // when > 0, requests due per second, in place of the trace's timestamps
+    };
+
+    struct Report {
+        uint64_t requests = 0;
+        uint64_t errors = 0;  // failed to connect or send, or a status other than 2xx
+        double seconds = 0;
+        bool openLoop = false;
+        std::vector<double> latencyMillis; // of every request, sorted
+
+        double percentile(double p) const;
+        // one JSON object on one line
+        void write(std::ostream& out) const;
+    };
+
+    // Throws std::runtime_error naming the line of a request it cannot parse, or whose
+    // timestamp is missing or earlier than the one before while the first had one.
+    std::vector<Request> readTrace(std::istream& in);
+    void writeTrace(std::ostream& out, const std::vector<Request>& requests);
+
+    // A trace of searches for words and phrases drawn from corpus, so queries hit words as
+    // often as a corpus generated with the same options contains them, and suggestions.
+    std::vector<Request> synthesize(ZipfCorpus& corpus, size_t count);
+
+    Report replay(const std::vector<Request>& requests, const Options& options);
+}
@@ -0,0 +1,250 @@
+#include "Microbench.h"
+#include "ZipfCorpus.h"
+#include "Tokenizer.h"
+#include "ConcurrentHashMap.h"
+#include "QueryEngine.h"
+#include "ThreadPool.h"
+#include <vector>
+#include <memory>
+#include <future>
+#include <chrono>
+#include <algorithm>
+#include <iomanip>
+
+namespace
+{
+    using WordLocation = ConcurrentHashMap::WordLocation;
+
+    // results are folded in here so the optimizer cannot drop the work
+    volatile uint64_t sink = 0;
+
+    struct Result {
+        std::string name;
+        uint64_t opsPerRun = 0;
+        uint64_t bytesPerRun = 0; // 0: no throughput reported
+        size_t runs = 0;
+        double medianSeconds = 0;
+        double minSeconds = 0;
+    };
+
+    template<typename Body>
+    Result measure(const std::string& name, uint64_t opsPerRun, uint64_t bytesPerRun, size_t maxRuns, Body body)
+    {
+        using Clock = std::chrono::steady_clock;
+        body();
+        std::vector<double> seconds;
+        double total = 0;
+        while (seconds.size() < BENCH_MIN_RUNS || (total < BENCH_MIN_SECONDS && seconds.size() < maxRuns)) {
+            auto start = Clock::now();
+            body();
+            seconds.push_back(std::chrono::duration<double>(Clock::now() - start).count());
+            total += seconds.back();
+        }
+        std::sort(seconds.begin(), seconds.end());
+        return { name, opsPerRun, bytesPerRun, seconds.size(), seconds[seconds.size() / 2], seconds.front() };
+    }
+
+    void print(std::ostream& out, const Result& result)
+    {
+        out << std::fixed << std::setprecision(3)
+            << "{\"benchmark\":\"" << result.name << "\""
+            << ",\"runs\":" << result.runs
+            << ",\"ops_per_run\":" << result.opsPerRun
+            << ",\"ns_per_op\":" << result.medianSeconds * 1e9 / std::max<uint64_t>(result.opsPerRun, 1)
+            << ",\"median_ms\":" << result.medianSeconds * 1e3
+            << ",\"min_ms\":" << result.minSeconds * 1e3;
+        if (result.bytesPerRun)
+            out << ",\"mb_per_s\":" << result.bytesPerRun / result.medianSeconds / 1e6;
+        out << "}" << std::endl;
+    }
+
+    struct Fixture {
+        std::string text;
+        std::vector<std::string> words;       // cleaned, in text order
+        std::vector<WordLocation> locations;  // of each word, with fileID 0
+    };
+
+    Fixture makeFixture(uint64_t seed)
+    {
+        ZipfCorpus::Options options;
+        options.seed = seed;
+        ZipfCorpus corpus(options);
+        Fixture fixture;
+        while (fixture.text.size() < BENCH_TEXT_BYTES)
+            fixture.text += corpus.document() + "\n";
+        Tokenizer tokenizer;
+        uint32_t position = 0;
+        for (const auto& token : tokenizer.tokenize(fixture.text)) {
+            if (!token.word.empty()) {
+                fixture.words.emplace_back(token.word);
+                fixture.locations.emplace_back(0, token.byteOffset, position);
+            }
+            ++position;
+        }
+        return fixture;
+    }
+
+    // Posting lists as the searcher hands them to the query engine: sorted by file, then
+    // position. Built directly rather than through a ConcurrentHashMap, which would copy.
+    std::vector<Postings> makePostings(uint64_t seed, size_t files, size_t wordsPerFile)
+    {
+        ZipfCorpus::Options options;
+        options.seed = seed;
+        ZipfCorpus corpus(options);
+        std::vector<Postings> postings(corpus.vocabulary());
+        for (uint32_t file = 0; file < files; ++file) {
+            for (uint32_t position = 0; position < wordsPerFile; ++position)
+                postings[corpus.sampleRank()].emplace_back(file, 0, position);
+        }
+        for (auto& list : postings)
+            list.countFiles();
+        return postings;
+    }
+
+    // The first rank at or after 'from' that occurs in at least minFiles files.
+    size_t rankWithFiles(const std::vector<Postings>& postings, size_t from, size_t minFiles)
+    {
+        for (size_t rank = from; rank < postings.size(); ++rank) {
+            if (postings[rank].files >= minFiles)
+                return rank;
+        }
+        return 0;
+    }
+}
+
+size_t Microbench::run(const Options& options, std::ostream& out)
+{
+    size_t threads = options.threads ? options.threads : std::max(1u, std::thread::hardware_concurrency());
+    auto selected = [&](const std::string& name) {
+        return options.filter.empty() || name.find(options.filter) != std::string::npos;
+    };
+    size_t ran = 0;
+    auto report = [&](const Result& result) {
+        print(out, result);
+        ++ran;
+    };
+
+    Fixture fixture = makeFixture(options.seed);
+    const uint64_t textBytes = fixture.text.size();
+    const uint64_t wordCount = fixture.words.size();
+
+    if (selected("tokenize")) {
+        Tokenizer tokenizer;
+        report(measure("tokenize", wordCount, textBytes, BENCH_MAX_RUNS, [&] {
+            sink = sink + tokenizer.tokenize(fixture.text).size();
+        }));
+    }
+
+    // Every run inserts the whole text once more as a new file. The first run adds the
+    // vocabulary and the later ones append to existing keys, which is what indexing does
+    // once a corpus is loaded; the median is that steady state. Runs are capped at 10
+    // because the map keeps what they add.
+    if (selected("hashmap_insert")) {
+        ConcurrentHashMap map(32, 10000, "bench_insert");
+        uint32_t file = 0;
+        report(measure("hashmap_insert", wordCount, 0, 10, [&] {
+            for (size_t i = 0; i < fixture.words.size(); ++i) {
+                WordLocation location = fixture.locations[i];
+                location.fileID = file;
+                map.insert(fixture.words[i], location);
+            }
+            ++file;
+        }));
+    }
+
+    if (selected("hashmap_insert_mt")) {
+        ConcurrentHashMap map(32, 10000, "bench_insert_mt");
+        ThreadPool pool(threads);
+        uint32_t file = 0;
+        report(measure("hashmap_insert_mt", wordCount, 0, 10, [&] {
+            pool.parallelFor(threads, threads, [&](size_t part) {
+                size_t begin = wordCount * part / threads, end = wordCount * (part + 1) / threads;
+                for (size_t i = begin; i < end; ++i) {
+                    WordLocation location = fixture.locations[i];
+                    location.fileID = file + static_cast<uint32_t>(part);
+                    map.insert(fixture.words[i], location);
+                }
+            });
+            file += static_cast<uint32_t>(threads);
+        }));
+    }
+
+    // find() copies the list it returns, so its cost grows with how often a word occurs;
+    // sampling the lookups from the same Zipf law weighs that as queries would.
+    // snapshot(), what queries use, copies once per change and then shares.
+    if (selected("hashmap_find") || selected("hashmap_snapshot")) {
+        ConcurrentHashMap map(32, 10000, "bench_find");
+        for (size_t i = 0; i < fixture.words.size(); ++i)
+            map.insert(fixture.words[i], fixture.locations[i]);
+        ZipfCorpus::Options corpusOptions;
+        corpusOptions.seed = options.seed + 1;
+        ZipfCorpus corpus(corpusOptions);
+        std::vector<std::string> lookups;
+        for (size_t i = 0; i < 20000; ++i)
+            lookups.push_back(corpus.sampleWord());
+        if (selected("hashmap_find")) {
+            report(measure("hashmap_find", lookups.size(), 0, BENCH_MAX_RUNS, [&] {
+                size_t found = 0;
+                for (const auto& word : lookups)
+                    found += map.find(word).size();
+                sink = sink + found;
+            }));
+        }
+        if (selected("hashmap_snapshot")) {
+            report(measure("hashmap_snapshot", lookups.size(), 0, BENCH_MAX_RUNS, [&] {
+                size_t found = 0;
+                for (const auto& word : lookups) {
+                    auto values = map.snapshot(word);
+                    found += values ? values->size() : 0;
+                }
+                sink = sink + found;
+            }));
+        }
+    }
+
+    if (selected("intersect_common_common") || selected("intersect_common_rare") || selected("intersect_three")) {
+        std::vector<Postings> postings = makePostings(options.seed, 20000, 300);
+        auto list = [&](size_t rank) { return std::make_shared<const Postings>(postings[rank]); };
+        struct Case {
+            std::string name;
+            std::vector<PostingsPtr> lists;
+        };
+        std::vector<Case> cases = {
+            { "intersect_common_common", { list(0), list(1) } },
+            { "intersect_common_rare", { list(0), list(rankWithFiles(postings, 2000, 10)) } },
+            { "intersect_three", { list(2), list(10), list(rankWithFiles(postings, 100, 1000)) } },
+        };
+        for (const auto& c : cases) {
+            if (!selected(c.name))
+                continue;
+            // no throughput: seeks skip most of a longer list, so its size says little
+            report(measure(c.name, 1, 0, BENCH_MAX_RUNS, [&] {
+                std::vector<size_t> cursors(c.lists.size(), 0);
+                uint32_t matches = 0;
+                for (uint32_t file = 0;; ++file) {
+                    file = QueryEngine::alignFiles(c.lists, cursors, file);
+                    if (file == DocIterator::NO_MORE_DOCS)
+                        break;
+                    ++matches;
+                }
+                sink = sink + matches;
+            }));
+        }
+    }
+
+    if (selected("threadpool_enqueue")) {
+        ThreadPool pool(threads);
+        const size_t tasks = 20000;
+        std::vector<std::future<void>> futures;
+        futures.reserve(tasks);
+        report(measure("threadpool_enqueue", tasks, 0, BENCH_MAX_RUNS, [&] {
+            futures.clear();
+            for (size_t i = 0; i < tasks; ++i)
+                futures.push_back(pool.enqueue([] {}));
+            for (auto& future : futures)
+                future.get();
+        }));
+    }
+
+    return ran;
+}
@@ -0,0 +1,31 @@
+#pragma once
+#include <string>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+#define BENCH_MIN_RUNS 5        // timed runs of every benchmark, at least
+#define BENCH_MAX_RUNS 50       // and at most
+#define BENCH_MIN_SECONDS 0.5   // keep running until this much time was measured
+#define BENCH_TEXT_BYTES (2 * 1024 * 1024) // Zipf text tokenized and indexed per run
+
+// Microbenchmarks of the hot paths of indexing and search, on text from ZipfCorpus:
+//   tokenize            Tokenizer::tokenize over BENCH_TEXT_BYTES
+//   hashmap_insert      ConcurrentHashMap::insert of every word of the text, one thread
+//   hashmap_insert_mt   the same split over pool workers, as concurrent uploads index
+//   hashmap_find        ConcurrentHashMap::find of Zipf-sampled words
+//   hashmap_snapshot    ConcurrentHashMap::snapshot of the same words, as queries look up
+//   intersect_*         QueryEngine::alignFiles walking the files common to 2 or 3 lists
+//   threadpool_enqueue  ThreadPool::enqueue of empty tasks, until all have run
+// Each benchmark runs once to warm up, then BENCH_MIN_RUNS to BENCH_MAX_RUNS times; the
+// median run is reported as one JSON object per line.
+namespace Microbench
+{
+    struct Options {
+        uint64_t seed = 1;
+        std::string filter; // only benchmarks whose name contains it
+        size_t threads = 0; // for the _mt and threadpool benchmarks; 0: hardware threads
+    };
+
+    // Returns how many benchmarks ran.
+    size_t run(const Options& options, std::ostream& out);
+}
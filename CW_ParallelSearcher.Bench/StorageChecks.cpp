@@ -0,0 +1,318 @@
+#include "StorageChecks.h"
+#include "ZipfCorpus.h"
+#include "Lz4Block.h"
+#include "BlockStore.h"
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <filesystem>
+#include <functional>
+#include <algorithm>
+
+namespace
+{
+    // a check returns why it failed, "" when it passed
+    using Check = std::function<std::string()>;
+
+    std::string zipfText(uint64_t seed, size_t bytes)
+    {
+        ZipfCorpus::Options options;
+        options.seed = seed;
+        ZipfCorpus corpus(options);
+        std::string text;
+        while (text.size() < bytes)
+            text += corpus.document() + "\n";
+        text.resize(bytes);
+        return text;
+    }
+
+    std::string randomBytes(ZipfCorpus& random, size_t bytes)
+    {
+        std::string data(bytes, '\0');
+        for (char& c : data)
+            c = static_cast<char>(random.nextRandom());
+        return data;
+    }
+
+    std::string readFile(const std::string& path)
+    {
+        std::ifstream in(path, std::ios::binary);
+        std::stringstream bytes;
+        bytes << in.rdbuf();
+        return bytes.str();
+    }
+
+    bool writeFile(const std::string& path, std::string_view bytes)
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        out.write(bytes.data(), bytes.size());
+        return static_cast<bool>(out);
+    }
+
+    std::string roundTrip(const std::string& text)
+    {
+        std::string compressed;
+        Lz4Block::compress(text.data(), text.size(), compressed);
+        std::string decoded(text.size(), '\0');
+        if (!Lz4Block::decompress(compressed.data(), compressed.size(), &decoded[0], decoded.size()) || decoded != text)
+            return "a block of " + std::to_string(text.size()) + " bytes does not decode to its text";
+        return "";
+    }
+
+    // Bytes one append may add: the last block again with data, as is at worst, their
+    // index entries and a trailer.
+    uint64_t appendBound(uint64_t oldSize, uint64_t dataSize)
+    {
+        uint64_t last = oldSize % BLOCK_STORE_BLOCK_SIZE;
+        if (last == 0 && oldSize != 0)
+            last = BLOCK_STORE_BLOCK_SIZE;
+        uint64_t blocks = (last + dataSize + BLOCK_STORE_BLOCK_SIZE - 1) / BLOCK_STORE_BLOCK_SIZE;
+        return last + dataSize + 16 * blocks + 64;
+    }
+
+    // A version of a store: its text size and the file size it was written with.
+    struct Version {
+        uint64_t textSize;
+        uint64_t fileSize;
+    };
+
+    // Appends data to the store at path, which holds text, and checks the file after it:
+    // either the old bytes are untouched and at most appendBound() follow, or the file was
+    // compacted and is exactly what write() gives for the whole text. *compacted tells which.
+    std::string appendChecked(const std::string& path, std::string& text, std::string_view data, bool* compacted)
+    {
+        std::string before = readFile(path);
+        uint64_t textSize = 0;
+        if (!BlockStore::append(path, data, &textSize))
+            return "append failed at text size " + std::to_string(text.size());
+        text.append(data.data(), data.size());
+        if (textSize != text.size())
+            return "append reported text size " + std::to_string(textSize) + " for " + std::to_string(text.size());
+        std::string after = readFile(path);
+        *compacted = after.compare(0, before.size(), before) != 0 || after.size() < before.size();
+        if (*compacted) {
+            if (after != BlockStore::encode(text))
+                return "a compacted file differs from the text written whole";
+        }
+        else if (after.size() - before.size() > appendBound(text.size() - data.size(), data.size())) {
+            return "an append of " + std::to_string(data.size()) + " bytes wrote " + std::to_string(after.size() - before.size());
+        }
+        BlockStore store(path);
+        if (!store.valid() || store.readAll() != text)
+            return "the text does not read back after an append, at size " + std::to_string(text.size());
+        return "";
+    }
+}
+
+size_t StorageChecks::run(const Options& options, std::ostream& out, size_t* failed)
+{
+    namespace fs = std::filesystem;
+    fs::path directory = options.directory.empty() ? fs::temp_directory_path() / "cwps_storage_checks" : fs::path(options.directory);
+    fs::create_directories(directory);
+    const std::string path = (directory / ("check" BLOCK_STORE_EXTENSION)).string();
+    ZipfCorpus random(ZipfCorpus::Options{ options.seed, 1000 });
+
+    std::vector<std::pair<std::string, Check>> checks;
+
+    checks.emplace_back("lz4_round_trip", [&]() -> std::string {
+        std::vector<std::string> inputs = { "", "a", "abcd", std::string(100000, 'x'), zipfText(options.seed, 1 << 20) };
+        for (size_t size : { 1, 5, 13, 255, 4096, BLOCK_STORE_BLOCK_SIZE, 65536 })
+            inputs.push_back(randomBytes(random, size));
+        // runs longer than 15 and 255 bytes exercise the extended lengths
+        std::string runs;
+        for (size_t length = 1; runs.size() < 70000; length = length * 3 + 1)
+            runs += randomBytes(random, length % 300) + std::string(length, static_cast<char>('a' + length % 26));
+        inputs.push_back(runs);
+        for (const std::string& input : inputs) {
+            std::string failure = roundTrip(input);
+            if (!failure.empty())
+                return failure;
+        }
+        return "";
+    });
+
+    checks.emplace_back("lz4_corruption", [&]() -> std::string {
+        std::string text = zipfText(options.seed + 1, BLOCK_STORE_BLOCK_SIZE);
+        std::string compressed;
+        Lz4Block::compress(text.data(), text.size(), compressed);
+        std::string decoded(text.size() + 1, '\0');
+        if (Lz4Block::decompress(compressed.data(), compressed.size(), &decoded[0], text.size() + 1) ||
+            Lz4Block::decompress(compressed.data(), compressed.size(), &decoded[0], text.size() - 1))
+            return "a block decodes to a size other than its text's";
+        for (size_t cut = 0; cut < compressed.size(); ++cut) {
+            // a copy of exactly the cut length, so reading past it is out of bounds
+            std::vector<char> truncated(compressed.begin(), compressed.begin() + cut);
+            if (Lz4Block::decompress(truncated.data(), truncated.size(), &decoded[0], text.size()))
+                return "a block cut to " + std::to_string(cut) + " bytes decodes";
+        }
+        // damaged bytes may still decode, but only ever within the buffers
+        for (int i = 0; i < 2000; ++i) {
+            std::vector<char> damaged(compressed.begin(), compressed.end());
+            damaged[random.nextRandom() % damaged.size()] ^= static_cast<char>(1 + random.nextRandom() % 255);
+            Lz4Block::decompress(damaged.data(), damaged.size(), &decoded[0], text.size());
+        }
+        std::string noise = randomBytes(random, 4096);
+        for (int i = 0; i < 2000; ++i)
+            Lz4Block::decompress(noise.data() + i, noise.size() - i, &decoded[0], text.size());
+        return "";
+    });
+
+    checks.emplace_back("block_store_round_trip", [&]() -> std::string {
+        for (size_t size : { size_t(0), size_t(1), size_t(BLOCK_STORE_BLOCK_SIZE), size_t(BLOCK_STORE_BLOCK_SIZE + 1), size_t(3 << 20) }) {
+            std::string text = zipfText(options.seed + size, size);
+            if (size == BLOCK_STORE_BLOCK_SIZE + 1)
+                text = randomBytes(random, size); // blocks stored as they are
+            if (!BlockStore::write(path, text))
+                return "write failed";
+            BlockStore store(path);
+            if (!store.valid() || store.size() != text.size() || store.readAll() != text)
+                return "a store of " + std::to_string(size) + " bytes does not read back";
+            for (int i = 0; i < 200 && size; ++i) {
+                uint64_t begin = random.nextRandom() % size;
+                uint64_t end = begin + 1 + random.nextRandom() % (2 * BLOCK_STORE_BLOCK_SIZE);
+                uint64_t base = 0;
+                std::string range = store.readBlocks(begin, end, &base);
+                if (base > begin || base % BLOCK_STORE_BLOCK_SIZE != 0 || base + range.size() < std::min<uint64_t>(end, size) ||
+                    text.compare(static_cast<size_t>(base), range.size(), range) != 0)
+                    return "readBlocks(" + std::to_string(begin) + ", " + std::to_string(end) + ") is wrong";
+            }
+            uint64_t base = 0;
+            if (!store.readBlocks(size, size + 10, &base).empty())
+                return "a range past the end is not empty";
+        }
+        return "";
+    });
+
+    checks.emplace_back("block_store_append", [&]() -> std::string {
+        std::string text = zipfText(options.seed + 2, 4 << 20);
+        if (!BlockStore::write(path, text))
+            return "write failed";
+        ZipfCorpus::Options words;
+        words.seed = options.seed + 3;
+        ZipfCorpus corpus(words);
+        // a long text keeps dead space below the live part, so none of these compacts
+        for (int i = 0; i < BLOCK_STORE_MAX_SEGMENTS - 1; ++i) {
+            std::string data = i % 3 == 2 ? corpus.document() + corpus.document() + corpus.document() : corpus.sampleWord() + " ";
+            if (i == 10)
+                data = zipfText(options.seed + 4, 5 * BLOCK_STORE_BLOCK_SIZE + 7);
+            bool compacted = false;
+            std::string failure = appendChecked(path, text, data, &compacted);
+            if (!failure.empty())
+                return failure;
+            if (compacted)
+                return "append " + std::to_string(i + 1) + " compacted the file";
+        }
+        return "";
+    });
+
+    checks.emplace_back("block_store_torn", [&]() -> std::string {
+        std::string text = zipfText(options.seed + 5, 3 * BLOCK_STORE_BLOCK_SIZE + 100);
+        if (!BlockStore::write(path, text))
+            return "write failed";
+        std::vector<Version> versions = { { text.size(), fs::file_size(path) } };
+        for (int i = 0; i < 12; ++i) {
+            bool compacted = false;
+            std::string failure = appendChecked(path, text, zipfText(options.seed + 6 + i, 1 + random.nextRandom() % 9000), &compacted);
+            if (!failure.empty())
+                return failure;
+            if (compacted)
+                versions.clear();
+            versions.push_back({ text.size(), fs::file_size(path) });
+        }
+        // every cut reads as the last version written whole before it, or as nothing at
+        // all before the first; bytes after the cut are lost, as a crash would lose them
+        std::string bytes = readFile(path);
+        const std::string cutPath = path + ".cut";
+        for (uint64_t cut = versions.front().fileSize; cut <= bytes.size(); ++cut) {
+            // every byte of each trailer and the blocks just before it, a sample of the rest
+            bool nearVersion = std::any_of(versions.begin(), versions.end(),
+                [cut](const Version& v) { return cut <= v.fileSize && v.fileSize - cut < 128; });
+            if (!nearVersion && cut % 11 != 0)
+                continue;
+            if (!writeFile(cutPath, std::string_view(bytes.data(), static_cast<size_t>(cut))))
+                return "cannot write " + cutPath;
+            BlockStore store(cutPath);
+            auto version = std::find_if(versions.rbegin(), versions.rend(), [cut](const Version& v) { return v.fileSize <= cut; });
+            if (!store.valid() || store.size() != version->textSize || store.readAll() != text.substr(0, static_cast<size_t>(version->textSize)))
+                return "a store cut at " + std::to_string(cut) + " does not read as its version before";
+        }
+        // garbage after the last trailer, as a torn append leaves, is skipped and appended after
+        {
+            std::ofstream torn(path, std::ios::binary | std::ios::app);
+            std::string garbage = randomBytes(random, 50) + "CWPSLZB3";
+            torn.write(garbage.data(), garbage.size());
+        }
+        if (BlockStore(path).readAll() != text)
+            return "a torn append hides the text before it";
+        bool compacted = false;
+        std::string failure = appendChecked(path, text, "after the tear", &compacted);
+        // a damaged last trailer leaves the version before it
+        if (failure.empty()) {
+            std::string damaged = readFile(path);
+            damaged[damaged.size() - 1] ^= 1;
+            writeFile(cutPath, damaged);
+            BlockStore store(cutPath);
+            if (store.valid() && store.size() == text.size())
+                failure = "a store with a damaged trailer still reads its last version";
+        }
+        fs::remove(cutPath);
+        return failure;
+    });
+
+    checks.emplace_back("block_store_compaction", [&]() -> std::string {
+        // small appends to a long text: the chain grows until BLOCK_STORE_MAX_SEGMENTS
+        std::string text = zipfText(options.seed + 7, 4 << 20);
+        if (!BlockStore::write(path, text))
+            return "write failed";
+        for (int i = 1; i <= BLOCK_STORE_MAX_SEGMENTS; ++i) {
+            bool compacted = false;
+            std::string failure = appendChecked(path, text, " word", &compacted);
+            if (!failure.empty())
+                return failure;
+            if (compacted != (i == BLOCK_STORE_MAX_SEGMENTS))
+                return "append " + std::to_string(i) + (compacted ? " compacted the chain" : " left the chain as it was");
+        }
+        // appends to a short text: the replaced last blocks soon outweigh the rest
+        text = zipfText(options.seed + 8, 100);
+        if (!BlockStore::write(path, text))
+            return "write failed";
+        int compactions = 0;
+        for (int i = 0; i < 40; ++i) {
+            bool compacted = false;
+            std::string failure = appendChecked(path, text, zipfText(options.seed + 9 + i, 1000), &compacted);
+            if (!failure.empty())
+                return failure;
+            compactions += compacted;
+        }
+        if (compactions == 0)
+            return "dead space never caused a compaction";
+        if (fs::file_size(path) > 2 * BlockStore::encode(text).size() + BLOCK_STORE_BLOCK_SIZE)
+            return "dead space outgrew the live part";
+        return "";
+    });
+
+    size_t ran = 0;
+    *failed = 0;
+    for (const auto& check : checks) {
+        if (!options.filter.empty() && check.first.find(options.filter) == std::string::npos)
+            continue;
+        std::string failure;
+        try {
+            failure = check.second();
+        }
+        catch (const std::exception& ex) {
+            failure = std::string("exception: ") + ex.what();
+        }
+        ++ran;
+        *failed += !failure.empty();
+        out << "{\"check\":\"" << check.first << "\",\"passed\":" << (failure.empty() ? "true" : "false");
+        if (!failure.empty())
+            out << ",\"failure\":\"" << failure << "\"";
+        out << "}" << std::endl;
+    }
+    std::error_code ec;
+    fs::remove(path, ec);
+    if (options.directory.empty())
+        fs::remove(directory, ec);
+    return ran;
+}
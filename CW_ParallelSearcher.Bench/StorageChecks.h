@@ -0,0 +1,25 @@
+#pragma once
+#include <string>
+#include <ostream>
+#include <cstdint>
+#include <cstddef>
+
+// Checks of the compressed storage format, on Zipf text and random bytes:
+//   lz4_round_trip         Lz4Block::compress then decompress gives the input back
+//   lz4_corruption         truncated or damaged blocks are refused or decode in bounds
+//   block_store_round_trip BlockStore::write, then readAll and readBlocks of random ranges
+//   block_store_append     appends read back, and write only the new blocks and their index
+//   block_store_torn       a store cut at any byte reads as one of its earlier versions
+//   block_store_compaction a long chain or mostly dead file is rewritten smaller
+// Each check prints one JSON object per line with whether it passed and, if not, why.
+namespace StorageChecks
+{
+    struct Options {
+        uint64_t seed = 1;
+        std::string filter;    // only checks whose name contains it
+        std::string directory; // for the stores written; "": the system temporary directory
+    };
+
+    // Returns how many checks ran; *failed is set to how many of them failed.
+    size_t run(const Options& options, std::ostream& out, size_t* failed);
+}
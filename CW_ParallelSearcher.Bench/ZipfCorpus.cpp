@@ -0,0 +1,94 @@
+#include "ZipfCorpus.h"
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <cmath>
+#include <cctype>
+
+namespace
+{
+    const char* const SYLLABLES[16] = {
+        "ka", "re", "mi", "no", "tu", "sa", "li", "po", "de", "vu", "ha", "ze", "gi", "bo", "fe", "ry"
+    };
+
+    std::string spell(size_t number)
+    {
+        std::string word;
+        for (; number; number >>= 4)
+            word += SYLLABLES[number & 15];
+        return word;
+    }
+}
+
+ZipfCorpus::ZipfCorpus(const Options& options)
+    : options(options), state(options.seed)
+{
+    size_t vocabulary = std::max<size_t>(options.vocabulary, 1);
+    cumulative.resize(vocabulary);
+    words.reserve(vocabulary);
+    double total = 0;
+    for (size_t rank = 0; rank < vocabulary; ++rank) {
+        total += 1.0 / std::pow(static_cast<double>(rank + 1), options.exponent);
+        cumulative[rank] = total;
+        words.push_back(spell(rank + 1));
+    }
+    for (double& probability : cumulative)
+        probability /= total;
+}
+
+uint64_t ZipfCorpus::nextRandom()
+{
+    uint64_t z = (state += 0x9E3779B97F4A7C15ULL);
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+double ZipfCorpus::uniform()
+{
+    return static_cast<double>(nextRandom() >> 11) * (1.0 / 9007199254740992.0);
+}
+
+size_t ZipfCorpus::sampleRank()
+{
+    auto it = std::upper_bound(cumulative.begin(), cumulative.end(), uniform());
+    return std::min<size_t>(it - cumulative.begin(), cumulative.size() - 1);
+}
+
+std::string ZipfCorpus::document()
+{
+    std::string text;
+    text.reserve(options.documentWords * 7);
+    size_t sentences = 0;
+    for (size_t written = 0; written < options.documentWords;) {
+        size_t length = std::min<size_t>(5 + nextRandom() % 16, options.documentWords - written);
+        for (size_t i = 0; i < length; ++i) {
+            std::string word = sampleWord();
+            if (i == 0)
+                word[0] = static_cast<char>(std::toupper(static_cast<unsigned char>(word[0])));
+            text += word;
+            if (i + 1 == length)
+                text += '.';
+            else if (nextRandom() % 12 == 0)
+                text += ',';
+            text += i + 1 < length ? ' ' : (++sentences % 6 == 0 ? '\n' : ' ');
+        }
+        written += length;
+    }
+    return text;
+}
+
+uint64_t ZipfCorpus::writeDirectory(const std::string& directory, size_t documents)
+{
+    uint64_t bytes = 0;
+    for (size_t i = 0; i < documents; ++i) {
+        std::filesystem::path folder = std::filesystem::path(directory) / ("part-" + std::to_string(i / 1000));
+        if (i % 1000 == 0)
+            std::filesystem::create_directories(folder);
+        std::string text = document();
+        std::ofstream out(folder / ("doc-" + std::to_string(i) + ".txt"), std::ios::binary);
+        out.write(text.data(), text.size());
+        bytes += text.size();
+    }
+    return bytes;
+}
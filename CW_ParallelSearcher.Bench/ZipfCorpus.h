@@ -0,0 +1,48 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#define ZIPF_DEFAULT_VOCABULARY 50000
+#define ZIPF_DEFAULT_EXPONENT 1.07 // close to word frequencies in English text
+#define ZIPF_DEFAULT_DOCUMENT_WORDS 2000
+
+// Deterministic pseudo-text whose word frequencies follow a Zipf law: the word of rank r
+// (0 the most frequent) appears in proportion to 1 / (r + 1)^exponent. The generator,
+// the sampling and the words are all defined here rather than taken from <random>, so
+// one seed gives the same corpus on every platform and standard library, and a
+// benchmark run can be compared with any earlier one.
+class ZipfCorpus
+{
+public:
+    struct Options {
+        uint64_t seed = 1;
+        size_t vocabulary = ZIPF_DEFAULT_VOCABULARY;
+        double exponent = ZIPF_DEFAULT_EXPONENT;
+        size_t documentWords = ZIPF_DEFAULT_DOCUMENT_WORDS;
+    };
+
+    explicit ZipfCorpus(const Options& options);
+
+    // The word of a rank: syllables spelling rank + 1, so frequent words are short.
+    const std::string& word(size_t rank) const { return words[rank]; }
+    size_t vocabulary() const { return words.size(); }
+
+    size_t sampleRank();
+    const std::string& sampleWord() { return words[sampleRank()]; }
+    // The next document: sentences of 5 to 20 words, capitalized and punctuated, in
+    // paragraphs, so tokenizing it exercises cleaning as well as splitting.
+    std::string document();
+    // Writes that many documents into directory as part-<k>/doc-<n>.txt, 1000 to a part,
+    // and returns how many bytes were written.
+    uint64_t writeDirectory(const std::string& directory, size_t documents);
+
+    uint64_t nextRandom(); // SplitMix64
+    double uniform();      // [0, 1) with 53 random bits
+
+private:
+    Options options;
+    uint64_t state;
+    std::vector<double> cumulative; // cumulative[r]: probability of a rank <= r
+    std::vector<std::string> words;
+};
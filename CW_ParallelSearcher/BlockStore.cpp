@@ -0,0 +1,257 @@
+#include "BlockStore.h"
+#include "Lz4Block.h"
+#include "StorageIO.h"
+#include <vector>
+#include <fstream>
+#include <filesystem>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    constexpr char BLOCK_STORE_MAGIC[8] = { 'C', 'W', 'P', 'S', 'L', 'Z', 'B', '3' };
+    constexpr size_t TRAILER_SIZE = 8 + 8 + 4 + 4 + 4 + 4 + sizeof(BLOCK_STORE_MAGIC);
+    constexpr size_t INDEX_ENTRY_SIZE = 8 + 8;
+
+    template <typename T> T load(const char* p) { T value; std::memcpy(&value, p, sizeof(T)); return value; }
+    template <typename T> void store(std::string& out, T value) { out.append(reinterpret_cast<const char*>(&value), sizeof(T)); }
+
+    // Appends text's blocks to out, which goes to the file at offset base, and the file
+    // offsets where each begins and ends to index.
+    void encodeBlocks(std::string_view text, std::string& out, uint64_t base, std::vector<uint64_t>& index)
+    {
+        std::string compressed;
+        for (size_t offset = 0; offset < text.size(); offset += BLOCK_STORE_BLOCK_SIZE) {
+            size_t length = std::min<size_t>(BLOCK_STORE_BLOCK_SIZE, text.size() - offset);
+            compressed.clear();
+            Lz4Block::compress(text.data() + offset, length, compressed);
+            index.push_back(base + out.size());
+            // a block as long as its text is stored as is
+            if (compressed.size() < length)
+                out += compressed;
+            else
+                out.append(text.data() + offset, length);
+            index.push_back(base + out.size());
+        }
+    }
+
+    // Ends a segment whose index covers the blocks from firstBlock on.
+    void appendTrailer(std::string& out, const std::vector<uint64_t>& index, uint64_t textSize,
+        uint64_t previousEnd, uint32_t firstBlock, uint32_t segments)
+    {
+        for (uint64_t offset : index)
+            store<uint64_t>(out, offset);
+        store<uint64_t>(out, textSize);
+        store<uint64_t>(out, previousEnd);
+        store<uint32_t>(out, BLOCK_STORE_BLOCK_SIZE);
+        store<uint32_t>(out, firstBlock + static_cast<uint32_t>(index.size() / 2));
+        store<uint32_t>(out, firstBlock);
+        store<uint32_t>(out, segments);
+        out.append(BLOCK_STORE_MAGIC, sizeof(BLOCK_STORE_MAGIC));
+    }
+}
+
+BlockStore::BlockStore(const std::string& path)
+    : file(path)
+{
+    // the last trailer that reads, so an append cut short leaves the store as it was
+    std::string_view bytes(file.data(), file.size());
+    std::string_view magic(BLOCK_STORE_MAGIC, sizeof(BLOCK_STORE_MAGIC));
+    for (size_t at = bytes.size() - std::min(bytes.size(), magic.size()); bytes.size() >= TRAILER_SIZE; --at) {
+        at = bytes.rfind(magic, at);
+        if (at == std::string_view::npos || open(at + magic.size()) || at == 0)
+            break;
+    }
+}
+
+bool BlockStore::open(size_t end)
+{
+    const char* data = file.data();
+    liveBytes = 0;
+    // blocks below needed are still to be read from the older segments
+    uint32_t needed = 0;
+    uint32_t remaining = 0;
+    for (uint64_t at = end; at != 0;) {
+        if (at < TRAILER_SIZE || std::memcmp(data + at - sizeof(BLOCK_STORE_MAGIC), BLOCK_STORE_MAGIC, sizeof(BLOCK_STORE_MAGIC)) != 0)
+            return false;
+        const char* trailer = data + at - TRAILER_SIZE;
+        uint64_t previousEnd = load<uint64_t>(trailer + 8);
+        uint32_t count = load<uint32_t>(trailer + 20);
+        uint32_t first = load<uint32_t>(trailer + 24);
+        if (at == end) {
+            textSize = load<uint64_t>(trailer);
+            blockSize = load<uint32_t>(trailer + 16);
+            blockCount = needed = count;
+            remaining = load<uint32_t>(trailer + 28);
+            if (blockSize == 0 || blockCount != (textSize + blockSize - 1) / blockSize)
+                return false;
+            blockOffsets.assign(2 * size_t(blockCount), 0);
+        }
+        else if (load<uint32_t>(trailer + 16) != blockSize || load<uint32_t>(trailer + 28) != remaining) {
+            return false;
+        }
+        if (remaining == 0 || first > needed || count < needed || previousEnd > at - TRAILER_SIZE
+            || (at - TRAILER_SIZE - previousEnd) / INDEX_ENTRY_SIZE < count - first)
+            return false;
+        uint64_t indexBegin = at - TRAILER_SIZE - INDEX_ENTRY_SIZE * uint64_t(count - first);
+        for (uint32_t block = first; block < needed; ++block) {
+            const char* entry = data + indexBegin + INDEX_ENTRY_SIZE * size_t(block - first);
+            uint64_t begin = load<uint64_t>(entry), blockEnd = load<uint64_t>(entry + 8);
+            // a segment's blocks lie between the previous segment and its own index
+            if (begin < previousEnd || begin > blockEnd || blockEnd > indexBegin)
+                return false;
+            blockOffsets[2 * size_t(block)] = begin;
+            blockOffsets[2 * size_t(block) + 1] = blockEnd;
+            liveBytes += blockEnd - begin;
+        }
+        liveBytes += at - indexBegin;
+        needed = first;
+        --remaining;
+        at = previousEnd;
+    }
+    if (needed != 0 || remaining != 0)
+        return false;
+    segments = load<uint32_t>(data + end - TRAILER_SIZE + 28);
+    chainEnd = end;
+    _valid = true;
+    return true;
+}
+
+size_t BlockStore::blockTextSize(uint32_t block) const
+{
+    return static_cast<size_t>(std::min<uint64_t>(blockSize, textSize - uint64_t(block) * blockSize));
+}
+
+bool BlockStore::decodeBlock(uint32_t block, char* dst) const
+{
+    uint64_t begin = blockBegin(block);
+    size_t stored = static_cast<size_t>(blockEnd(block) - begin);
+    size_t length = blockTextSize(block);
+    if (stored == length) {
+        std::memcpy(dst, file.data() + begin, length);
+        return true;
+    }
+    return Lz4Block::decompress(file.data() + begin, stored, dst, length);
+}
+
+std::string BlockStore::readBlocks(uint64_t begin, uint64_t end, uint64_t* base) const
+{
+    *base = 0;
+    end = std::min(end, textSize);
+    if (!_valid || begin >= end)
+        return std::string();
+    uint32_t first = static_cast<uint32_t>(begin / blockSize);
+    uint32_t last = static_cast<uint32_t>((end - 1) / blockSize);
+    *base = uint64_t(first) * blockSize;
+
+    std::string text(static_cast<size_t>(std::min(textSize, uint64_t(last + 1) * blockSize) - *base), '\0');
+    for (uint32_t block = first; block <= last; ++block) {
+        if (!decodeBlock(block, &text[static_cast<size_t>(uint64_t(block - first) * blockSize)]))
+            return std::string();
+    }
+    return text;
+}
+
+std::string BlockStore::readAll() const
+{
+    uint64_t base;
+    return readBlocks(0, textSize, &base);
+}
+
+bool BlockStore::writeFile(const std::string& path, const std::string& bytes)
+{
+    std::string temporary = path + STORAGE_TEMP_EXTENSION;
+    {
+        std::ofstream out(temporary, std::ios::binary | std::ios::trunc);
+        if (!out)
+            return false;
+        out.write(bytes.data(), bytes.size());
+        out.close();
+        if (!out) {
+            std::filesystem::remove(temporary);
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::rename(temporary, path, ec);
+    if (ec)
+        std::filesystem::remove(temporary, ec);
+    return !ec;
+}
+
+std::string BlockStore::encode(std::string_view content)
+{
+    std::string bytes;
+    bytes.reserve(content.size() / 2 + TRAILER_SIZE);
+    std::vector<uint64_t> index;
+    encodeBlocks(content, bytes, 0, index);
+    appendTrailer(bytes, index, content.size(), 0, 0, 1);
+    return bytes;
+}
+
+bool BlockStore::write(const std::string& path, std::string_view content)
+{
+    return writeFile(path, encode(content));
+}
+
+bool BlockStore::append(const std::string& path, std::string_view data, uint64_t* textSize)
+{
+    return appendBlocks(path, data, textSize, true);
+}
+
+bool BlockStore::appendBlocks(const std::string& path, std::string_view data, uint64_t* textSize, bool compact)
+{
+    std::string bytes;
+    uint64_t newTextSize;
+    {
+        // unmapped before the file is written
+        BlockStore old(path);
+        if (!old.valid() || old.blockSize != BLOCK_STORE_BLOCK_SIZE)
+            return false;
+
+        // the blocks before the last are full and stay as they are
+        uint32_t kept = old.blockCount ? old.blockCount - 1 : 0;
+        std::string tail(old.blockCount ? old.blockTextSize(kept) : 0, '\0');
+        if (!tail.empty() && !old.decodeBlock(kept, &tail[0]))
+            return false;
+        tail.append(data.data(), data.size());
+        newTextSize = old.textSize + data.size();
+
+        // more dead than live, or a long chain: the kept blocks move to the front of a new
+        // file, which is one segment; otherwise a segment indexing only the new blocks follows
+        compact = compact && (old.file.size() - old.liveBytes > old.liveBytes || old.segments >= BLOCK_STORE_MAX_SEGMENTS);
+        uint64_t base = compact ? 0 : old.file.size();
+        std::vector<uint64_t> index;
+        if (compact) {
+            for (uint32_t block = 0; block < kept; ++block) {
+                uint64_t begin = old.blockBegin(block), end = old.blockEnd(block);
+                index.push_back(bytes.size());
+                bytes.append(old.file.data() + begin, static_cast<size_t>(end - begin));
+                index.push_back(bytes.size());
+            }
+        }
+        encodeBlocks(tail, bytes, base, index);
+        if (compact)
+            appendTrailer(bytes, index, newTextSize, 0, 0, 1);
+        else
+            appendTrailer(bytes, index, newTextSize, old.chainEnd, kept, old.segments + 1);
+    }
+
+    if (compact) {
+        // the rename fails on Windows while a reader maps the file: append instead
+        if (!writeFile(path, bytes))
+            return appendBlocks(path, data, textSize, false);
+    }
+    else {
+        std::ofstream out(path, std::ios::binary | std::ios::app);
+        if (!out)
+            return false;
+        out.write(bytes.data(), bytes.size());
+        out.close();
+        if (!out)
+            return false;
+    }
+    if (textSize)
+        *textSize = newTextSize;
+    return true;
+}
@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include "MappedFile.h"
+#define BLOCK_STORE_BLOCK_SIZE (16 * 1024) // bytes of text per independently decoded block
+#define BLOCK_STORE_EXTENSION ".lzb"       // appended to the names of files stored this way
+#define BLOCK_STORE_READ_BYTES (1024 * 1024) // decoded at once by readers that go through a whole store
+#define BLOCK_STORE_MAX_SEGMENTS 64 // appends before the file is rewritten as one segment
+
+// A document stored as LZ4 blocks of BLOCK_STORE_BLOCK_SIZE text bytes each, so a byte
+// range is read by decoding only the blocks that cover it. The file is a chain of
+// segments, the first written with the file and one more per append:
+//   block f .. block n-1                   LZ4, or the text as is when it would not shrink
+//   uint64 begin and end of each block     the index of blocks f to n-1
+//   uint64 text size, uint64 end of the previous segment (0 for none), uint32 block size,
+//   uint32 n, uint32 f, uint32 segments in the chain, 8 bytes BLOCK_STORE_MAGIC
+// The trailer is read from the end of the file and the chain walked back from it; a
+// segment's index entries override the older segments' from block f on. An append
+// rewrites only the last block, so it writes that block, the new ones, their index and a
+// trailer after the old trailer, and never changes a byte before it: a mapping of the
+// file stays valid and sees the store as it was, so appends need no rename, which
+// Windows refuses while a reader maps the file. The replaced last blocks are dead space;
+// the file is rewritten as one segment once that outweighs the live part or the chain is
+// longer than BLOCK_STORE_MAX_SEGMENTS.
+class BlockStore
+{
+public:
+    // Maps path; valid() is false when it is not a block store or is damaged. A torn
+    // append is skipped: the store reads as it was before that append.
+    explicit BlockStore(const std::string& path);
+
+    bool valid() const { return _valid; }
+    uint64_t size() const { return textSize; } // of the text, not the file
+
+    // Text in [begin, end), widened to whole blocks; *base is the text offset of the first
+    // byte returned. Empty when the range is outside the text or a block does not decode.
+    std::string readBlocks(uint64_t begin, uint64_t end, uint64_t* base) const;
+    std::string readAll() const;
+
+    // The bytes of a block store holding content.
+    static std::string encode(std::string_view content);
+    // Writes content to path as a block store, replacing what is there. Written to a
+    // temporary file first and renamed over path, so readers see the old file or the new.
+    static bool write(const std::string& path, std::string_view content);
+    // Appends data to the store at path, with *textSize set to the size of the text then.
+    // Only the last block is decoded and encoded again; the others stay where they are.
+    static bool append(const std::string& path, std::string_view data, uint64_t* textSize = nullptr);
+
+private:
+    // Reads the trailer ending at file offset end and the chain of segments behind it.
+    bool open(size_t end);
+    uint64_t blockBegin(uint32_t block) const { return blockOffsets[2 * size_t(block)]; }
+    uint64_t blockEnd(uint32_t block) const { return blockOffsets[2 * size_t(block) + 1]; }
+    bool decodeBlock(uint32_t block, char* dst) const;
+    size_t blockTextSize(uint32_t block) const;
+    // compact: rewrite the file without its dead space, when there is enough of it
+    static bool appendBlocks(const std::string& path, std::string_view data, uint64_t* textSize, bool compact);
+    static bool writeFile(const std::string& path, const std::string& bytes);
+
+    MappedFile file;
+    bool _valid = false;
+    uint64_t textSize = 0;
+    uint32_t blockSize = 0;
+    uint32_t blockCount = 0;
+    uint32_t segments = 0;
+    uint64_t chainEnd = 0;  // of the last segment, where the next one goes
+    uint64_t liveBytes = 0; // blocks, indexes and trailers: the file less its dead space
+    std::vector<uint64_t> blockOffsets; // begin and end of each block in the file
+};
@@ -11,6 +11,9 @@
 #include <iostream>
 #include <chrono>
 #include <cassert>
+#include <algorithm>
+#include <memory>
+#include "Metrics.h"
 
 
 class ConcurrentHashMap
@@ -34,9 +37,32 @@ public:
 	using keyType = std::string;
 	using mappedType = std::vector<WordLocation>;
 
+    // Values sorted by (fileID, wordPosition), with how many files they are in. files is
+    // counted once when a list is made, so queries never walk one for its document frequency.
+    struct PostingList : mappedType {
+        size_t files = 0;
+        PostingList() = default;
+        explicit PostingList(const mappedType& values) : mappedType(values) { countFiles(); }
+        void countFiles() {
+            files = 0;
+            for (size_t i = 0; i < size(); ++i) {
+                if (i == 0 || (*this)[i].fileID != (*this)[i - 1].fileID)
+                    ++files;
+            }
+        }
+    };
+    using SnapshotPtr = std::shared_ptr<const PostingList>;
+
+    // Values are kept sorted, so readers never sort. The snapshot is an immutable copy
+    // made by the first reader after a change and shared by every reader until the next.
+    struct Entry {
+        mappedType values;
+        SnapshotPtr snapshot; // accessed with std::atomic_load/store: readers share a lock
+    };
+
     struct Shard {
         mutable std::shared_mutex mtx;
-        std::unordered_map<std::string, std::vector<WordLocation>> map;
+        std::unordered_map<std::string, Entry> map;
     };
 
     ConcurrentHashMap(const ConcurrentHashMap&) = delete;
@@ -44,46 +70,232 @@ public:
 
     ~ConcurrentHashMap() = default;
 
-    ConcurrentHashMap(size_t numShards = 32, size_t startMapSize = 10000) {
+    ConcurrentHashMap(size_t numShards = 32, size_t startMapSize = 10000, const std::string& metricsName = "words") {
         _num_shards = numShards;
         _shards.reserve(_num_shards);
         for (size_t i = 0; i < _num_shards; ++i) {
             _shards.push_back(std::make_unique<Shard>());
             _shards.back()->map.reserve(startMapSize);
         }
+        // one pair per map, shared by its shards: the registry is sized for a few
+        // hundred series, and maps of the same name share theirs
+        auto& metrics = Metrics::instance();
+        std::string labels = "index=\"" + metricsName + "\"";
+        _contendedCounter = metrics.counter("index_shard_lock_contended_total",
+            "Shard lock acquisitions that had to wait", labels);
+        _waitCounter = metrics.counter("index_shard_lock_wait_seconds_total",
+            "Time spent waiting for shard locks", labels, 1e6);
 	}
 
     void insert(const keyType& key, const WordLocation& value) {
         size_t shardIndex = hashFunction(key);
         Shard& shard = *_shards[shardIndex];
         {
-            std::unique_lock<std::shared_mutex> lock(shard.mtx);
-            shard.map[key].push_back(value);
+            std::unique_lock<std::shared_mutex> lock(shard.mtx, std::try_to_lock);
+            if (!lock.owns_lock())
+                waitFor(lock, shard);
+            insertLocked(shard, key, value);
         }
         _size.fetch_add(1, std::memory_order_relaxed);
     }
+    size_t shardCount() const { return _num_shards; }
+    size_t shardOf(const keyType& key) const { return hashFunction(key); }
+    // Calls fill(add) with the shard's lock taken once, where add(key, value) inserts like
+    // insert(); every key added must be one shardOf maps to shardIndex. Values of one file
+    // added in position order are appended, never moved.
+    template<typename Fill>
+    void insertInto(size_t shardIndex, Fill fill) {
+        Shard& shard = *_shards[shardIndex];
+        size_t added = 0;
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mtx, std::try_to_lock);
+            if (!lock.owns_lock())
+                waitFor(lock, shard);
+            fill([&](const keyType& key, const WordLocation& value) {
+                insertLocked(shard, key, value);
+                ++added;
+            });
+        }
+        _size.fetch_add(added, std::memory_order_relaxed);
+    }
     mappedType find(const keyType& key) const {
         size_t shardIndex = hashFunction(key);
         const Shard& shard = *_shards[shardIndex];
         {
-            std::shared_lock<std::shared_mutex> lock(shard.mtx);
+            std::shared_lock<std::shared_mutex> lock(shard.mtx, std::try_to_lock);
+            if (!lock.owns_lock())
+                waitFor(lock, shard);
             auto it = shard.map.find(key);
             if (it != shard.map.end()) {
-                return it->second;
+                return it->second.values;
             }
         }
         return mappedType();
     }
+    // The values of key, sorted, as a snapshot shared with other readers: a lookup after
+    // no change since the last one copies nothing. Null when key has no values.
+    SnapshotPtr snapshot(const keyType& key) const {
+        size_t shardIndex = hashFunction(key);
+        const Shard& shard = *_shards[shardIndex];
+        std::shared_lock<std::shared_mutex> lock(shard.mtx, std::try_to_lock);
+        if (!lock.owns_lock())
+            waitFor(lock, shard);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end())
+            return SnapshotPtr();
+        Entry& entry = const_cast<Entry&>(it->second);
+        SnapshotPtr snapshot = std::atomic_load(&entry.snapshot);
+        if (!snapshot) {
+            // two readers may both copy; either copy is the same
+            snapshot = std::make_shared<const PostingList>(entry.values);
+            std::atomic_store(&entry.snapshot, snapshot);
+        }
+        return snapshot;
+    }
+    // Whether key has a value in fileID before wordPosition. Values are sorted by file and
+    // position, so only the first value at or after (fileID, 0) needs a look.
+    bool containsBefore(const keyType& key, uint32_t fileID, uint32_t wordPosition) const {
+        size_t shardIndex = hashFunction(key);
+        const Shard& shard = *_shards[shardIndex];
+        std::shared_lock<std::shared_mutex> lock(shard.mtx, std::try_to_lock);
+        if (!lock.owns_lock())
+            waitFor(lock, shard);
+        auto it = shard.map.find(key);
+        if (it == shard.map.end())
+            return false;
+        const auto& values = it->second.values;
+        auto first = std::lower_bound(values.begin(), values.end(), WordLocation(fileID, 0, 0));
+        return first != values.end() && first->fileID == fileID && first->wordPosition < wordPosition;
+    }
+    // Drops the value of key at (fileID, wordPosition); false when there is none.
+    bool remove(const keyType& key, uint32_t fileID, uint32_t wordPosition) {
+        Shard& shard = *_shards[hashFunction(key)];
+        {
+            std::unique_lock<std::shared_mutex> lock(shard.mtx, std::try_to_lock);
+            if (!lock.owns_lock())
+                waitFor(lock, shard);
+            auto it = shard.map.find(key);
+            if (it == shard.map.end())
+                return false;
+            auto& values = it->second.values;
+            auto at = std::lower_bound(values.begin(), values.end(), WordLocation(fileID, 0, wordPosition));
+            if (at == values.end() || at->fileID != fileID || at->wordPosition != wordPosition)
+                return false;
+            values.erase(at);
+            if (it->second.snapshot)
+                it->second.snapshot.reset();
+            if (values.empty())
+                shard.map.erase(it);
+        }
+        _size.fetch_sub(1, std::memory_order_relaxed);
+        return true;
+    }
     size_t size() const {
         return _size.load(std::memory_order_relaxed);
 	}
+    // Drops every value dead(value) selects and erases keys left without values; called
+    // with each key and what was dropped from it. A shard is scanned under its shared lock,
+    // so lookups go on, and write-locked only for each key that changes, so inserts wait
+    // for one key's rewrite at most. Returns how many were dropped.
+    template<typename Dead, typename OnDropped>
+    size_t removeIf(Dead dead, OnDropped onDropped) {
+        size_t removed = 0;
+        mappedType dropped;
+        std::vector<keyType> affected;
+        for (auto& shard : _shards) {
+            affected.clear();
+            {
+                std::shared_lock<std::shared_mutex> lock(shard->mtx);
+                for (const auto& [key, entry] : shard->map) {
+                    if (std::any_of(entry.values.begin(), entry.values.end(), dead))
+                        affected.push_back(key);
+                }
+            }
+            for (const auto& key : affected) {
+                std::unique_lock<std::shared_mutex> lock(shard->mtx);
+                auto it = shard->map.find(key);
+                if (it == shard->map.end())
+                    continue;
+                auto& values = it->second.values;
+                dropped.clear();
+                size_t kept = 0;
+                for (size_t i = 0; i < values.size(); ++i) {
+                    if (dead(values[i]))
+                        dropped.push_back(values[i]);
+                    else
+                        values[kept++] = values[i];
+                }
+                if (dropped.empty())
+                    continue;
+                values.resize(kept);
+                std::atomic_store(&it->second.snapshot, SnapshotPtr());
+                removed += dropped.size();
+                onDropped(it->first, dropped);
+                if (values.empty())
+                    shard->map.erase(it);
+            }
+        }
+        _size.fetch_sub(removed, std::memory_order_relaxed);
+        return removed;
+    }
+    // The n keys with the most values, largest first. Locks one shard at a time.
+    std::vector<std::pair<keyType, size_t>> largestKeys(size_t n) const {
+        using Entry = std::pair<keyType, size_t>;
+        auto larger = [](const Entry& a, const Entry& b) { return a.second > b.second; };
+        std::vector<Entry> heap; // min-heap on size
+        for (const auto& shard : _shards) {
+            std::shared_lock<std::shared_mutex> lock(shard->mtx);
+            for (const auto& [key, entry] : shard->map) {
+                const auto& values = entry.values;
+                if (heap.size() < n) {
+                    heap.emplace_back(key, values.size());
+                    std::push_heap(heap.begin(), heap.end(), larger);
+                }
+                else if (n > 0 && values.size() > heap.front().second) {
+                    std::pop_heap(heap.begin(), heap.end(), larger);
+                    heap.back() = Entry(key, values.size());
+                    std::push_heap(heap.begin(), heap.end(), larger);
+                }
+            }
+        }
+        std::sort(heap.begin(), heap.end(), larger);
+        return heap;
+    }
 
 
 private:
 
     size_t _num_shards;
     std::vector<std::unique_ptr<Shard>> _shards;
-    std::atomic<size_t> _size;
+    std::atomic<size_t> _size{ 0 };
+    Metrics::Id _contendedCounter;
+    Metrics::Id _waitCounter;
+
+    // shard's lock held exclusively
+    static void insertLocked(Shard& shard, const keyType& key, const WordLocation& value) {
+        Entry& entry = shard.map[key];
+        auto& values = entry.values;
+        // a file's values come in position order and files in about ID order: insertion
+        // is an append, or a short move when files being indexed together interleave
+        if (values.empty() || !(value < values.back()))
+            values.push_back(value);
+        else
+            values.insert(std::upper_bound(values.begin(), values.end(), value), value);
+        // no reader holds the lock, so no atomic store: that would take the global
+        // shared_ptr spinlock on every insert
+        if (entry.snapshot)
+            entry.snapshot.reset();
+    }
+
+    // Only the contended path is timed, so uncontended lookups pay nothing extra.
+    template<typename Lock>
+    void waitFor(Lock& lock, const Shard&) const {
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        auto& metrics = Metrics::instance();
+        metrics.add(_contendedCounter);
+        metrics.add(_waitCounter, Metrics::microsSince(start));
+    }
 
     size_t hashFunction(const std::string& key) const {
         return std::hash<std::string>{}(key) % _num_shards;
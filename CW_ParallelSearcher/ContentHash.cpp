@@ -0,0 +1,101 @@
+#include "ContentHash.h"
+#include <cstring>
+#include <algorithm>
+
+namespace {
+
+constexpr uint64_t PRIME1 = 11400714785074694791ULL;
+constexpr uint64_t PRIME2 = 14029467366897019727ULL;
+constexpr uint64_t PRIME3 = 1609587929392839161ULL;
+constexpr uint64_t PRIME4 = 9650029242287828579ULL;
+constexpr uint64_t PRIME5 = 2870177450012600261ULL;
+
+inline uint64_t rotl(uint64_t value, int bits) { return (value << bits) | (value >> (64 - bits)); }
+
+// little-endian loads, as on every platform this builds for
+inline uint64_t read64(const char* p) { uint64_t value; std::memcpy(&value, p, 8); return value; }
+inline uint32_t read32(const char* p) { uint32_t value; std::memcpy(&value, p, 4); return value; }
+
+inline uint64_t round(uint64_t lane, uint64_t input)
+{
+    lane += input * PRIME2;
+    return rotl(lane, 31) * PRIME1;
+}
+
+inline uint64_t mergeRound(uint64_t hash, uint64_t lane)
+{
+    hash ^= round(0, lane);
+    return hash * PRIME1 + PRIME4;
+}
+
+}
+
+ContentHash::ContentHash(uint64_t seed)
+    : seed(seed), lanes{ seed + PRIME1 + PRIME2, seed + PRIME2, seed, seed - PRIME1 }
+{
+}
+
+void ContentHash::consumeStripe(const char* stripe)
+{
+    for (int i = 0; i < 4; ++i)
+        lanes[i] = round(lanes[i], read64(stripe + 8 * i));
+}
+
+void ContentHash::update(const char* data, size_t size)
+{
+    totalLength += size;
+    if (buffered > 0) {
+        size_t take = std::min(size, sizeof(buffer) - buffered);
+        std::memcpy(buffer + buffered, data, take);
+        buffered += take;
+        data += take;
+        size -= take;
+        if (buffered < sizeof(buffer))
+            return;
+        consumeStripe(buffer);
+        buffered = 0;
+    }
+    for (; size >= sizeof(buffer); data += sizeof(buffer), size -= sizeof(buffer))
+        consumeStripe(data);
+    std::memcpy(buffer, data, size);
+    buffered = size;
+}
+
+uint64_t ContentHash::digest() const
+{
+    uint64_t hash;
+    if (totalLength >= sizeof(buffer)) {
+        hash = rotl(lanes[0], 1) + rotl(lanes[1], 7) + rotl(lanes[2], 12) + rotl(lanes[3], 18);
+        for (uint64_t lane : lanes)
+            hash = mergeRound(hash, lane);
+    }
+    else {
+        hash = seed + PRIME5;
+    }
+    hash += totalLength;
+
+    const char* p = buffer;
+    const char* end = buffer + buffered;
+    for (; p + 8 <= end; p += 8)
+        hash = rotl(hash ^ round(0, read64(p)), 27) * PRIME1 + PRIME4;
+    if (p + 4 <= end) {
+        hash = rotl(hash ^ (read32(p) * PRIME1), 23) * PRIME2 + PRIME3;
+        p += 4;
+    }
+    for (; p < end; ++p)
+        hash = rotl(hash ^ (static_cast<unsigned char>(*p) * PRIME5), 11) * PRIME1;
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+uint64_t ContentHash::of(std::string_view data)
+{
+    ContentHash hash;
+    hash.update(data);
+    return hash.digest();
+}
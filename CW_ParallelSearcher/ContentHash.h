@@ -0,0 +1,28 @@
+#pragma once
+#include <string_view>
+#include <cstdint>
+#include <cstddef>
+
+// 64-bit xxHash (XXH64) of a byte stream fed in pieces of any size; the digest does not
+// depend on how the stream was split. Fast and well distributed, but not cryptographic:
+// equal digests only make two contents worth comparing byte for byte.
+class ContentHash
+{
+public:
+    explicit ContentHash(uint64_t seed = 0);
+
+    void update(const char* data, size_t size);
+    void update(std::string_view data) { update(data.data(), data.size()); }
+    uint64_t digest() const;
+
+    static uint64_t of(std::string_view data);
+
+private:
+    void consumeStripe(const char* stripe);
+
+    uint64_t seed;
+    uint64_t lanes[4];
+    uint64_t totalLength = 0;
+    char buffer[32];     // a partial stripe
+    size_t buffered = 0;
+};
@@ -1,4 +1,5 @@
 #include "Controller.h"
+#include <cstdio>
 #include <WinSock2.h>
 #include <ws2tcpip.h>
 #pragma comment(lib, "ws2_32.lib")
@@ -6,32 +7,96 @@
 Controller::Controller(std::shared_ptr<ThreadPool> threadPool)
 	: threadPool(threadPool), searcher(this->threadPool) {
 	routeHandlers["POST /addfile"] =
-		[this](const std::string& req) {
+		[this](const std::string& req, const Deadline&) {
 		return this->handleAddFile(req);
 		};
 
+	routeHandlers["POST /appendfile"] =
+		[this](const std::string& req, const Deadline&) {
+		return this->handleAppendFile(req);
+		};
+
 	routeHandlers["GET /search"] =
-		[this](const std::string& req) {
-		return this->handleSearchPhrase(req);
+		[this](const std::string& req, const Deadline& deadline) {
+		return this->handleSearchPhrase(req, deadline);
+		};
+
+	routeHandlers["GET /grep"] =
+		[this](const std::string& req, const Deadline& deadline) {
+		return this->handleGrep(req, deadline);
+		};
+
+	routeHandlers["GET /suggest"] =
+		[this](const std::string& req, const Deadline&) {
+		return this->handleSuggest(req);
 		};
 
 	routeHandlers["GET /file"] =
-		[this](const std::string& req) {
+		[this](const std::string& req, const Deadline&) {
 		return this->handleGetFile(req);
 		};
 
+	routeHandlers["DELETE /file"] =
+		[this](const std::string& req, const Deadline&) {
+		return this->handleDeleteFile(req);
+		};
+
+	routeHandlers["PUT /file"] =
+		[this](const std::string& req, const Deadline&) {
+		return this->handleReplaceFile(req);
+		};
+
+	routeHandlers["GET /indexed"] =
+		[this](const std::string& req, const Deadline&) {
+		return this->handleIndexed(req);
+		};
+
+	routeHandlers["POST /admin/import"] =
+		[this](const std::string& req, const Deadline&) {
+		return this->handleStartImport(req);
+		};
+
+	routeHandlers["GET /admin/import"] =
+		[this](const std::string& req, const Deadline&) {
+		return this->handleImportProgress(req);
+		};
+
+	routeHandlers["DELETE /admin/import"] =
+		[this](const std::string& req, const Deadline&) {
+		return this->handleCancelImport(req);
+		};
+
+	routeHandlers["GET /metrics"] =
+		[this](const std::string& req, const Deadline&) {
+		return this->handleMetrics(req);
+		};
+
+	queryRoutes = { "GET /search", "GET /grep" };
+
 	auto optionRoutes = std::vector<std::string>();
 	for (const auto& route : routeHandlers) {
 		optionRoutes.push_back(route.first.substr(route.first.find(' ') + 1));
 	}
 
 	auto optionHandler =
-		[this](const std::string& req) {
+		[this](const std::string& req, const Deadline&) {
 		return this->handleOptions(req);
 		};
 	for(const auto& route : optionRoutes) {
 		routeHandlers["OPTIONS " + route] = optionHandler;
 	}
+
+	auto& metrics = Metrics::instance();
+	const char* latencyHelp = "Time from reading a request to sending its response";
+	for (const auto& route : routeHandlers) {
+		routeLatency[route.first] = metrics.histogram("http_request_duration_seconds", latencyHelp,
+			"route=\"" + route.first + "\"");
+	}
+	unmatchedLatency = metrics.histogram("http_request_duration_seconds", latencyHelp, "route=\"unmatched\"");
+	serializeStage = metrics.histogram("search_stage_duration_seconds",
+		"Time spent in each stage of a search", "stage=\"serialize\"");
+	duplicateUploads = metrics.counter("ingest_duplicate_uploads_total",
+		"Uploads whose content was stored already, answered with the existing id");
 }
 
 Response Controller::handleAddFile(const std::string& request)
@@ -46,12 +111,81 @@ Response Controller::handleAddFile(const std::string& request)
 		return Response::BadRequest("Missing 'content' parameter");
 	}
 
-	uint32_t fileID = FileManager::SaveFile(fileName, fileData);
-	if(fileID == 0) {
-		return Response::InternalServerError("Failed to save file");
+	// indexed once StorageIO has written it; the worker does not wait for the disk
+	bool duplicate = false;
+	uint64_t fileID = FileManager::SaveFile(fileName, std::move(fileData),
+		[this](uint64_t storedID, bool written) {
+			if (written)
+				searcher.AddFile(storedID);
+			else
+				searcher.AbandonFile(storedID);
+		}, &duplicate);
+	if(duplicate) {
+		// indexed already, or queued for it
+		Metrics::instance().add(duplicateUploads);
+		return Response::Ok("File already stored id=" + std::to_string(fileID));
+	}
+	return Response::Ok("File will be added soon! id=" + std::to_string(fileID));
+}
+
+Response Controller::handleAppendFile(const std::string& request)
+{
+	uint64_t fileId;
+	try {
+		fileId = std::stoull(getParam(request, "id"));
+	}
+	catch (...) {
+		return Response::BadRequest("Invalid 'id' parameter");
+	}
+
+	std::string fileData = getParamFromBody(request, "content");
+	if (fileData.empty()) {
+		return Response::BadRequest("Missing 'content' parameter");
+	}
+
+	uint64_t appendedId;
+	try {
+		appendedId = searcher.AppendFile(fileId, fileData);
+	}
+	catch (const std::invalid_argument& ex) {
+		return Response::BadRequest(ex.what());
+	}
+	if (appendedId == 0) {
+		return Response::InternalServerError("Failed to append to file");
 	}
-	searcher.AddFile(fileID);
-	return Response::Ok("File will be added soon!");
+	if (appendedId != fileId) {
+		// the content was shared with another upload, which keeps it
+		return Response::Ok("Appended to a copy of file " + std::to_string(fileId) + " id=" + std::to_string(appendedId));
+	}
+	return Response::Ok("Appended to file " + std::to_string(fileId));
+}
+
+Response Controller::handleStartImport(const std::string& request)
+{
+	if (importRoot.empty()) {
+		return Response::Forbidden("Imports over HTTP are disabled; start the server with --import-root <directory>");
+	}
+	auto error = importer.start(getParamFromBody(request, "path"), importRoot);
+	if (!error.empty()) {
+		return Response::BadRequest(error);
+	}
+	return Response::Ok(importer.progress().toJSON());
+}
+
+Response Controller::handleImportProgress(const std::string& request)
+{
+	return Response::Ok(importer.progress().toJSON());
+}
+
+Response Controller::handleCancelImport(const std::string& request)
+{
+	importer.cancel();
+	return Response::Ok(importer.progress().toJSON());
+}
+
+Response Controller::handleMetrics(const std::string& request)
+{
+	return Response(Response::Type::Ok, Metrics::instance().renderPrometheus(), "text/plain; version=0.0.4");
 }
 
 Response Controller::handleOptions(const std::string& request)
@@ -59,15 +193,142 @@ Response Controller::handleOptions(const std::string& request)
 	return Response::Ok();
 }
 
-Response Controller::handleSearchPhrase(const std::string& request)
+Response Controller::handleSearchPhrase(const std::string& request, const Deadline& deadline)
 {
 	auto phrase = getParam(request, "phrase");
-	if (phrase.empty()) {
-		return Response::BadRequest("Missing 'phrase' parameter");
+	auto query = getParam(request, "q");
+	if (phrase.empty() && query.empty()) {
+		return Response::BadRequest("Missing 'phrase' or 'q' parameter");
 	}
 
-	auto results = searcher.SearchPhrase(phrase);
-	return Response::Ok(JSONifySearchResults(results));
+	Searcher::SearchOptions options;
+	auto sort = getParam(request, "sort");
+	if (sort == "position") {
+		options.order = Searcher::SearchOptions::Order::Position;
+	}
+	else if (!sort.empty() && sort != "relevance") {
+		return Response::BadRequest("Invalid 'sort' parameter");
+	}
+	auto mode = getParam(request, "mode");
+	if (mode == "count" || mode == "files") {
+		// counts come back in file order whatever the sort
+		options.mode = mode == "count" ? Searcher::SearchOptions::Mode::Count : Searcher::SearchOptions::Mode::Files;
+		options.order = Searcher::SearchOptions::Order::Position;
+	}
+	else if (!mode.empty() && mode != "results") {
+		return Response::BadRequest("Invalid 'mode' parameter");
+	}
+	auto error = parsePaging(request, options);
+	if (!error.empty()) {
+		return Response::BadRequest(error);
+	}
+	options.deadline = deadline;
+
+	try {
+		auto page = query.empty() ? searcher.SearchPhrase(phrase, options) : searcher.SearchQuery(query, options);
+		if (options.mode != Searcher::SearchOptions::Mode::Results)
+			return Response::Ok(JSONifyCounts(*page, options.mode == Searcher::SearchOptions::Mode::Files));
+		return Response::Ok(JSONifySearchResults(*page));
+	}
+	catch (const std::invalid_argument& ex) {
+		return Response::BadRequest(ex.what());
+	}
+}
+
+Response Controller::handleGrep(const std::string& request, const Deadline& deadline)
+{
+	auto pattern = getParam(request, "pattern");
+	if (pattern.empty()) {
+		return Response::BadRequest("Missing 'pattern' parameter");
+	}
+
+	Searcher::SearchOptions options;
+	options.order = Searcher::SearchOptions::Order::Position;
+	auto error = parsePaging(request, options);
+	if (!error.empty()) {
+		return Response::BadRequest(error);
+	}
+	bool ignoreCase = getParam(request, "icase") == "1";
+	options.deadline = deadline;
+
+	try {
+		auto page = searcher.Grep(pattern, ignoreCase, options);
+		return Response::Ok(JSONifySearchResults(*page));
+	}
+	catch (const std::invalid_argument& ex) {
+		return Response::BadRequest(ex.what());
+	}
+}
+
+std::string Controller::parsePaging(const std::string& request, Searcher::SearchOptions& options)
+{
+	try {
+		auto limit = getParam(request, "limit");
+		if (!limit.empty())
+			options.limit = std::min<size_t>(std::stoul(limit), MAX_PAGE_SIZE);
+		auto offset = getParam(request, "offset");
+		if (!offset.empty())
+			options.offset = std::stoul(offset);
+	}
+	catch (...) {
+		return "Invalid 'limit' or 'offset' parameter";
+	}
+	auto after = getParam(request, "after");
+	if (!after.empty() && !options.parseCursor(after)) {
+		return "Invalid 'after' parameter";
+	}
+	return std::string();
+}
+
+// JSON string contents: quotes, backslashes and control characters escaped
+static std::string escapeJson(const std::string& text)
+{
+	std::string escaped;
+	escaped.reserve(text.size());
+	for (char c : text) {
+		if (c == '"' || c == '\\') {
+			escaped += '\\';
+			escaped += c;
+		}
+		else if (static_cast<unsigned char>(c) < 0x20) {
+			char code[8];
+			snprintf(code, sizeof(code), "\\u%04x", static_cast<unsigned char>(c));
+			escaped += code;
+		}
+		else {
+			escaped += c;
+		}
+	}
+	return escaped;
+}
+
+Response Controller::handleSuggest(const std::string& request)
+{
+	auto prefix = getParam(request, "prefix");
+	if (prefix.empty()) {
+		return Response::BadRequest("Missing 'prefix' parameter");
+	}
+	size_t limit = DEFAULT_SUGGEST_LIMIT;
+	try {
+		auto limitParam = getParam(request, "limit");
+		if (!limitParam.empty())
+			limit = std::min<size_t>(std::stoul(limitParam), MAX_PAGE_SIZE);
+	}
+	catch (...) {
+		return Response::BadRequest("Invalid 'limit' parameter");
+	}
+
+	auto suggestions = searcher.Suggest(prefix, limit);
+	std::string json = "{ \"suggestions\": [";
+	for (size_t i = 0; i < suggestions.size(); ++i) {
+		if (i > 0) {
+			json += ", ";
+		}
+		json += "{\"term\": \"" + escapeJson(suggestions[i].term) + "\", \"df\": " +
+			std::to_string(suggestions[i].documentFrequency) + "}";
+	}
+	json += "] }";
+	return Response::Ok(json);
 }
 
 Response Controller::handleGetFile(const std::string& request)
@@ -85,6 +346,76 @@ Response Controller::handleGetFile(const std::string& request)
 	return Response::Ok(fileContent);
 }
 
+Response Controller::handleDeleteFile(const std::string& request)
+{
+	uint64_t fileId;
+	try {
+		fileId = std::stoull(getParam(request, "id"));
+	}
+	catch (...) {
+		return Response::BadRequest("Invalid 'id' parameter");
+	}
+
+	if (!searcher.RemoveDocument(fileId)) {
+		return Response::NotFound("File not found");
+	}
+	return Response::Ok("File deleted id=" + std::to_string(fileId));
+}
+
+Response Controller::handleReplaceFile(const std::string& request)
+{
+	uint64_t fileId;
+	try {
+		fileId = std::stoull(getParam(request, "id"));
+	}
+	catch (...) {
+		return Response::BadRequest("Invalid 'id' parameter");
+	}
+
+	std::string fileData = getParamFromBody(request, "content");
+	if (fileData.empty()) {
+		return Response::BadRequest("Missing 'content' parameter");
+	}
+
+	if (FileManager::getFileName(fileId).empty()) {
+		return Response::NotFound("File " + std::to_string(fileId) + " does not exist");
+	}
+	uint64_t newFileId;
+	try {
+		newFileId = searcher.ReplaceDocument(fileId, fileData);
+	}
+	catch (const std::invalid_argument& ex) {
+		// deleted meanwhile, or replaced already and the new file not indexed yet
+		return Response::BadRequest(ex.what());
+	}
+	if (newFileId == 0) {
+		return Response::InternalServerError("Failed to save file");
+	}
+	return Response::Ok("File will be replaced soon! id=" + std::to_string(newFileId));
+}
+
+Response Controller::handleIndexed(const std::string& request)
+{
+	uint64_t fileId;
+	long waitMs = 0;
+	try {
+		fileId = std::stoull(getParam(request, "id"));
+		auto wait = getParam(request, "wait");
+		if (!wait.empty())
+			waitMs = std::min<long>(std::stol(wait), MAX_INDEXED_WAIT_MS);
+	}
+	catch (...) {
+		return Response::BadRequest("Invalid 'id' or 'wait' parameter");
+	}
+
+	bool indexed = searcher.WaitIndexed(fileId, std::chrono::milliseconds(std::max<long>(waitMs, 0)));
+	// a write that failed after the upload was answered: the ID never becomes searchable
+	bool failed = !indexed && searcher.FileFailed(fileId);
+	return Response::Ok("{\"id\": " + std::to_string(fileId) + ", \"indexed\": " + (indexed ? "true" : "false") +
+		", \"failed\": " + (failed ? "true" : "false") +
+		", \"indexed_up_to\": " + std::to_string(searcher.IndexedUpTo()) + "}");
+}
+
 std::string Controller::urlDecode(const std::string& str) {
 	std::string ret;
 	char ch;
@@ -117,19 +448,64 @@ void Controller::handleClient(int clientSocket)
 		return;
 	}
 
+	auto start = std::chrono::steady_clock::now();
 	std::string path = getRequestInfo(request);
-	if(path.empty()) {
+	auto handlerIt = routeHandlers.find(path);
+	bool query = queryRoutes.count(path) != 0;
+	long timeoutMs = DEFAULT_QUERY_TIMEOUT_MS;
+	auto timeout = query ? getHeader(request, "X-Timeout-Ms") : std::string();
+	try {
+		if (!timeout.empty())
+			timeoutMs = std::min<long>(std::stol(timeout), MAX_QUERY_TIMEOUT_MS);
+	}
+	catch (...) {
+		timeoutMs = -1;
+	}
+	if (path.empty()) {
 		sendResponse(clientSocket, Response::BadRequest("Incorrect path"));
-		return;
 	}
-	
-	auto handlerIt = routeHandlers.find(path);
-	if (handlerIt != routeHandlers.end()) {
-		Response response = handlerIt->second(request);
+	else if (timeoutMs <= 0) {
+		sendResponse(clientSocket, Response::BadRequest("Invalid 'X-Timeout-Ms' header"));
+	}
+	else if (path.find(" /admin/") != std::string::npos &&
+		(!fromLoopback(clientSocket) || !getHeader(request, "Origin").empty())) {
+		sendResponse(clientSocket, Response::Forbidden("Admin requests are only served to local clients"));
+	}
+	else if (handlerIt != routeHandlers.end()) {
+		// uploads, deletes and the like run to completion whatever the header says
+		Deadline deadline;
+		if (query)
+			deadline = Deadline(std::chrono::milliseconds(timeoutMs),
+				[clientSocket]() { return clientDisconnected(clientSocket); });
+		Response response = handlerIt->second(request, deadline);
 		sendResponse(clientSocket, response);
 	} else {
 		sendResponse(clientSocket, Response::BadRequest("Path not found"));
 	}
+	Metrics::instance().observe(handlerIt != routeHandlers.end() ? routeLatency.at(handlerIt->first) : unmatchedLatency,
+		Metrics::microsSince(start));
+}
+
+bool Controller::clientDisconnected(int clientSocket)
+{
+	fd_set readable;
+	FD_ZERO(&readable);
+	FD_SET(clientSocket, &readable);
+	timeval noWait{ 0, 0 };
+	if (select(clientSocket + 1, &readable, nullptr, nullptr, &noWait) <= 0)
+		return false;
+	// readable with nothing to read: the peer sent FIN (0) or the connection broke (< 0)
+	char byte;
+	return recv(clientSocket, &byte, 1, MSG_PEEK) <= 0;
+}
+
+bool Controller::fromLoopback(int clientSocket)
+{
+	sockaddr_in peer;
+	int length = sizeof(peer);
+	if (getpeername(clientSocket, reinterpret_cast<sockaddr*>(&peer), &length) != 0 || peer.sin_family != AF_INET)
+		return false;
+	return (ntohl(peer.sin_addr.s_addr) >> 24) == 127;
 }
 
 std::string Controller::getRequest(int clientSocket)
@@ -176,8 +552,10 @@ std::string Controller::getRequestInfo(const std::string& req)
 	return path;
 }
 
-std::string Controller::JSONifySearchResults(const std::vector<Searcher::SearchResult>& results)
+std::string Controller::JSONifySearchResults(const Searcher::SearchPage& page)
 {
+	Metrics::ScopedTimer timer(serializeStage);
+	const auto& results = page.results;
 	std::string json = "{ \"results\": [";
 	for (size_t i = 0; i < results.size(); ++i) {
 		json += results[i].toJSON();
@@ -185,7 +563,43 @@ std::string Controller::JSONifySearchResults(const std::vector<Searcher::SearchR
 			json += ", ";
 		}
 	}
-	json += "] }";
+	json += "], \"total\": " + std::to_string(page.totalHits);
+	json += ", \"total_exact\": " + std::string(page.totalExact ? "true" : "false");
+	json += ", \"truncated\": " + std::string(page.truncated ? "true" : "false");
+	if (!page.nextCursor.empty()) {
+		json += ", \"next\": \"" + page.nextCursor + "\"";
+	}
+	json += " }";
+	return json;
+}
+
+std::string Controller::JSONifyCounts(const Searcher::SearchPage& page, bool withFiles)
+{
+	Metrics::ScopedTimer timer(serializeStage);
+	std::string json;
+	json.reserve(64 + page.fileHits.size() * 16);
+	json += "{\"hits\":" + std::to_string(page.totalHits) + ",\"files\":" + std::to_string(page.totalFiles);
+	if (page.truncated) {
+		json += ",\"truncated\":true";
+	}
+	if (withFiles) {
+		json += ",\"counts\":[";
+		for (size_t i = 0; i < page.fileHits.size(); ++i) {
+			if (i > 0) {
+				json += ',';
+			}
+			json += '[';
+			json += std::to_string(page.fileHits[i].first);
+			json += ',';
+			json += std::to_string(page.fileHits[i].second);
+			json += ']';
+		}
+		json += ']';
+		if (!page.nextCursor.empty()) {
+			json += ",\"next\":\"" + page.nextCursor + "\"";
+		}
+	}
+	json += '}';
 	return json;
 }
 
@@ -206,6 +620,25 @@ std::string Controller::getParam(const std::string& req, const std::string& key)
 	return urlDecode(query.substr(pos, amp - pos));
 }
 
+std::string Controller::getHeader(const std::string& req, const std::string& name)
+{
+	auto lower = [](std::string text) {
+		std::transform(text.begin(), text.end(), text.begin(),
+			[](unsigned char c) { return std::tolower(c); });
+		return text;
+	};
+	std::string head = lower(req.substr(0, req.find("\r\n\r\n")));
+	auto pos = head.find("\r\n" + lower(name) + ":");
+	if (pos == std::string::npos) return "";
+
+	pos += name.size() + 3;
+	auto end = req.find("\r\n", pos);
+	std::string value = req.substr(pos, end - pos);
+	auto first = value.find_first_not_of(" \t");
+	if (first == std::string::npos) return "";
+	return value.substr(first, value.find_last_not_of(" \t") - first + 1);
+}
+
 std::string Controller::getParamFromBody(const std::string& req, const std::string& key)
 {
 	std::string lowerKey = std::string(key);
@@ -3,16 +3,28 @@
 #include "Searcher.h"
 #include "FileManager.h"
 #include "Response.h"
+#include "Metrics.h"
+#include "Importer.h"
 #include <map>
+#include <set>
+#define DEFAULT_SUGGEST_LIMIT 10
+#define MAX_INDEXED_WAIT_MS 30000
 
 class Controller
 {
 private:
 	std::shared_ptr<ThreadPool> threadPool;
 	Searcher searcher;
+	Importer importer{ searcher };
 
-	using Handler = std::function<Response(const std::string&)>;
+	using Handler = std::function<Response(const std::string&, const Deadline&)>;
 	std::map<std::string, Handler> routeHandlers;
+	std::set<std::string> queryRoutes; // the routes X-Timeout-Ms applies to
+	std::map<std::string, Metrics::Id> routeLatency;
+	Metrics::Id unmatchedLatency;
+	Metrics::Id serializeStage;
+	Metrics::Id duplicateUploads;
+	std::string importRoot; // POST /admin/import is refused while empty
 
 public:
 	Controller(std::shared_ptr<ThreadPool> threadPool);
@@ -21,26 +33,88 @@ public:
 	//POST /addfile
 	Response handleAddFile(const std::string& request);
 
-	//GET /search?word=example
-	Response handleSearchPhrase(const std::string& request);
+	//POST /appendfile?id=123   {"content": "..."}   appends to file 123 and indexes only the
+	//                          new text; 400 while the file is not indexed yet
+	Response handleAppendFile(const std::string& request);
+
+	//GET /search?phrase=example&sort=relevance|position&limit=20&offset=0&after=<cursor>
+	//GET /search?q=(fox OR cat) AND "lazy dog" NOT sleeps&...   boolean query, one result per file
+	//GET /search?q=quick NEAR/2 fox, q=lazy ONEAR/0 dog          proximity, unordered / ordered
+	//GET /search?phrase=...&mode=count|files                      hit totals / [fileid, hits] pairs, no snippets
+	//X-Timeout-Ms: 500   deadline of /search and /grep; past it, or once the client hangs up,
+	//                    what was found so far is returned with "truncated": true. Other
+	//                    routes ignore the header
+	Response handleSearchPhrase(const std::string& request, const Deadline& deadline);
+
+	//GET /grep?pattern=get[A-Z]\w+&icase=1&limit=20&offset=0&after=<cursor>   regex over raw file text
+	Response handleGrep(const std::string& request, const Deadline& deadline);
+
+	//GET /suggest?prefix=exa&limit=10   dictionary terms by document frequency
+	Response handleSuggest(const std::string& request);
 
 	//GET /file?id=123
 	Response handleGetFile(const std::string& request);
 
+	//DELETE /file?id=123   hidden from searches at once, postings dropped by background compaction
+	Response handleDeleteFile(const std::string& request);
+
+	//PUT /file?id=123   {"content": "..."}   stores the content as a new file and returns its id;
+	//                   123 is deleted once the new file is indexed
+	Response handleReplaceFile(const std::string& request);
+
+	//GET /indexed?id=123&wait=5000   whether file 123 and all added before it are searchable,
+	//                                 waiting up to 'wait' ms (at most MAX_INDEXED_WAIT_MS) for it
+	Response handleIndexed(const std::string& request);
+
+	//POST /admin/import   {"path": "/data/corpus"}   copies and indexes every file below path in the
+	//                     background; the reply and GET /admin/import give its progress. Refused
+	//                     unless the server was started with --import-root and path lies below it
+	//DELETE /admin/import  cancels it; what was copied already stays and is indexed
+	// /admin/ routes answer 403 to clients not on loopback and to requests with an Origin
+	// header, which browsers send for pages of any site
+	Response handleStartImport(const std::string& request);
+	Response handleImportProgress(const std::string& request);
+	Response handleCancelImport(const std::string& request);
+
+	//GET /metrics   Prometheus text format
+	Response handleMetrics(const std::string& request);
+
 	//OPTIONS /*
 	Response handleOptions(const std::string& request);
 
-	std::string JSONifySearchResults(const std::vector<Searcher::SearchResult>& results);
+	// limit, offset and after; returns an error message, empty when valid
+	std::string parsePaging(const std::string& request, Searcher::SearchOptions& options);
+	std::string JSONifySearchResults(const Searcher::SearchPage& page);
+	// {"hits":N,"files":M}, "truncated":true when cut short, plus "counts":[[fileid,hits],...] and "next" when withFiles
+	std::string JSONifyCounts(const Searcher::SearchPage& page, bool withFiles);
 	std::string urlDecode(const std::string& str);
 	std::string getParam(const std::string& req, const std::string& key);
 	std::string getParamFromBody(const std::string& req, const std::string& key);
+	std::string getHeader(const std::string& req, const std::string& name);
 
 	void handleClient(int clientSocket);
+	// true when the peer has closed the connection; pipelined bytes do not count
+	static bool clientDisconnected(int clientSocket);
+	static bool fromLoopback(int clientSocket);
 	std::string getRequest(int clientSocket);
 	void sendResponse(int clientSocket, Response response);
 	std::string getRequestInfo(const std::string& req);
 
+	// Starts a bulk import, as POST /admin/import does; returns an error message, empty once started.
+	std::string startImport(const std::string& root) {
+		return importer.start(root);
+	}
+	// Lets POST /admin/import import root and the directories below it.
+	void allowImportsUnder(const std::string& root) {
+		importRoot = root;
+	}
+	Importer::Progress importProgress() const {
+		return importer.progress();
+	}
+
 	void stopSearcher() {
+		importer.cancel();
+		StorageIO::instance().flush(); // their completions index into searcher
 		searcher.stopUpdate();
 	}
 };
\ No newline at end of file
@@ -0,0 +1,55 @@
+#pragma once
+#include <chrono>
+#include <functional>
+#include <cstdint>
+#define DEFAULT_QUERY_TIMEOUT_MS 2000
+#define MAX_QUERY_TIMEOUT_MS 60000
+#define DEADLINE_CHECK_INTERVAL 64     // expired() calls between two clock reads
+#define DEADLINE_PROBE_INTERVAL_MS 20  // least time between two clientGone probes
+
+// Time budget of one request. Long loops call expired() at every file boundary; the clock
+// is read only every DEADLINE_CHECK_INTERVAL calls and the clientGone probe (a socket poll)
+// at most every DEADLINE_PROBE_INTERVAL_MS, so checking often costs next to nothing.
+// Once expired it stays expired. Not thread-safe: it belongs to the thread serving the request.
+class Deadline
+{
+public:
+    using Clock = std::chrono::steady_clock;
+    using Probe = std::function<bool()>;
+
+    // never expires
+    Deadline() = default;
+    explicit Deadline(std::chrono::milliseconds timeout, Probe clientGone = nullptr)
+        : bounded(true), limit(Clock::now() + timeout), lastProbe(Clock::now()), clientGone(std::move(clientGone)) {
+    }
+
+    bool expired() const {
+        if (!bounded || hit)
+            return hit;
+        if (++calls % DEADLINE_CHECK_INTERVAL != 0)
+            return false;
+        return expiredNow();
+    }
+
+    bool expiredNow() const {
+        if (!bounded || hit)
+            return hit;
+        auto now = Clock::now();
+        if (now >= limit) {
+            hit = true;
+        }
+        else if (clientGone && now - lastProbe >= std::chrono::milliseconds(DEADLINE_PROBE_INTERVAL_MS)) {
+            lastProbe = now;
+            hit = clientGone();
+        }
+        return hit;
+    }
+
+private:
+    bool bounded = false;
+    Clock::time_point limit;
+    mutable Clock::time_point lastProbe;
+    Probe clientGone;
+    mutable uint32_t calls = 0;
+    mutable bool hit = false;
+};
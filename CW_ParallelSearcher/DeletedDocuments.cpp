@@ -0,0 +1,37 @@
+#include "DeletedDocuments.h"
+
+DeletedDocuments::DeletedDocuments()
+    : pages(new std::atomic<Page*>[PAGE_COUNT])
+{
+    for (size_t i = 0; i < PAGE_COUNT; ++i)
+        pages[i].store(nullptr, std::memory_order_relaxed);
+}
+
+DeletedDocuments::~DeletedDocuments()
+{
+    for (size_t i = 0; i < PAGE_COUNT; ++i)
+        delete pages[i].load(std::memory_order_relaxed);
+}
+
+bool DeletedDocuments::add(uint32_t fileID)
+{
+    std::atomic<Page*>& slot = pages[fileID >> DELETED_PAGE_BITS];
+    Page* page = slot.load(std::memory_order_acquire);
+    if (!page) {
+        Page* fresh = new Page;
+        for (auto& word : fresh->words)
+            word.store(0, std::memory_order_relaxed);
+        // two first deletes in one page race: the loser frees its page and uses the winner's
+        if (slot.compare_exchange_strong(page, fresh, std::memory_order_acq_rel))
+            page = fresh;
+        else
+            delete fresh;
+    }
+
+    uint64_t bit = uint64_t(1) << (fileID & 63);
+    uint64_t previous = page->words[(fileID & PAGE_MASK) >> 6].fetch_or(bit, std::memory_order_release);
+    if (previous & bit)
+        return false;
+    count.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
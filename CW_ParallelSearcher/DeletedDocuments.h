@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <cstdint>
+#include <cstddef>
+#define DELETED_PAGE_BITS 16 // a page holds the bits of 1 << DELETED_PAGE_BITS fileIDs
+
+// Bitmap of deleted fileIDs, tested by queries for every posting they read, so a delete
+// hides a file at once and the index is cleaned up later by compaction. Pages are
+// allocated on first use and never moved or freed, so contains() is two atomic loads and
+// needs no lock, even while another thread adds. IDs are never reused: a deleted ID stays
+// deleted.
+class DeletedDocuments
+{
+public:
+    DeletedDocuments();
+    ~DeletedDocuments();
+    DeletedDocuments(const DeletedDocuments&) = delete;
+    DeletedDocuments& operator=(const DeletedDocuments&) = delete;
+
+    // false when fileID was deleted already
+    bool add(uint32_t fileID);
+
+    bool contains(uint32_t fileID) const {
+        const Page* page = pages[fileID >> DELETED_PAGE_BITS].load(std::memory_order_acquire);
+        return page && (page->words[(fileID & PAGE_MASK) >> 6].load(std::memory_order_relaxed) >> (fileID & 63)) & 1;
+    }
+
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr uint32_t PAGE_MASK = (1u << DELETED_PAGE_BITS) - 1;
+    static constexpr size_t PAGE_COUNT = size_t(1) << (32 - DELETED_PAGE_BITS);
+
+    struct Page {
+        std::atomic<uint64_t> words[(1u << DELETED_PAGE_BITS) / 64];
+    };
+
+    std::unique_ptr<std::atomic<Page*>[]> pages;
+    std::atomic<size_t> count{ 0 };
+};
@@ -0,0 +1,84 @@
+#include "DocumentRegistry.h"
+
+DocumentRegistry::DocumentRegistry()
+    : pages(new std::atomic<Page*>[PAGE_COUNT])
+{
+    for (size_t i = 0; i < PAGE_COUNT; ++i)
+        pages[i].store(nullptr, std::memory_order_relaxed);
+}
+
+DocumentRegistry::~DocumentRegistry()
+{
+    for (size_t i = 0; i < PAGE_COUNT; ++i) {
+        Page* page = pages[i].load(std::memory_order_relaxed);
+        if (!page)
+            continue;
+        for (auto& entry : page->entries)
+            delete entry.load(std::memory_order_relaxed);
+        delete page;
+    }
+}
+
+std::atomic<const DocumentEntry*>& DocumentRegistry::slot(uint32_t fileID)
+{
+    std::atomic<Page*>& pageSlot = pages[fileID >> DOCUMENT_PAGE_BITS];
+    Page* page = pageSlot.load(std::memory_order_relaxed);
+    if (!page) {
+        // only writers get here, one at a time; readers see the page once it is stored
+        page = new Page;
+        for (auto& entry : page->entries)
+            entry.store(nullptr, std::memory_order_relaxed);
+        pageSlot.store(page, std::memory_order_release);
+    }
+    return page->entries[fileID & PAGE_MASK];
+}
+
+void DocumentRegistry::retire(const DocumentEntry* entry)
+{
+    if (entry)
+        retired.emplace_back(entry);
+}
+
+void DocumentRegistry::publish(uint32_t fileID, std::string path, uint64_t size, bool compressed)
+{
+    const DocumentEntry* fresh = new DocumentEntry(std::move(path), size, compressed);
+    const DocumentEntry* previous = slot(fileID).exchange(fresh, std::memory_order_acq_rel);
+    if (previous)
+        retire(previous);
+    else
+        count.fetch_add(1, std::memory_order_relaxed);
+    if (fileID >= end.load(std::memory_order_relaxed))
+        end.store(fileID + 1, std::memory_order_release);
+}
+
+bool DocumentRegistry::remove(uint32_t fileID)
+{
+    if (!find(fileID))
+        return false;
+    retire(slot(fileID).exchange(nullptr, std::memory_order_acq_rel));
+    count.fetch_sub(1, std::memory_order_relaxed);
+    return true;
+}
+
+void DocumentRegistry::setSize(uint32_t fileID, uint64_t size)
+{
+    if (const DocumentEntry* entry = find(fileID))
+        entry->size.store(size, std::memory_order_relaxed);
+}
+
+std::vector<uint64_t> DocumentRegistry::ids() const
+{
+    std::vector<uint64_t> fileIDs;
+    fileIDs.reserve(size());
+    uint32_t last = end.load(std::memory_order_acquire);
+    for (uint32_t first = 0; first < last; first += PAGE_MASK + 1) {
+        const Page* page = pages[first >> DOCUMENT_PAGE_BITS].load(std::memory_order_acquire);
+        if (!page)
+            continue;
+        for (uint32_t i = 0; i <= PAGE_MASK && first + i < last; ++i) {
+            if (page->entries[i].load(std::memory_order_acquire))
+                fileIDs.push_back(first + i);
+        }
+    }
+    return fileIDs;
+}
@@ -0,0 +1,67 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#define DOCUMENT_PAGE_BITS 16 // a page holds the entries of 1 << DOCUMENT_PAGE_BITS fileIDs
+
+// What is known about one stored file. The path never changes once published; the size
+// grows with appends.
+struct DocumentEntry
+{
+    DocumentEntry(std::string path, uint64_t size, bool compressed)
+        : path(std::move(path)), compressed(compressed), size(size) {}
+
+    const std::string path;
+    const bool compressed; // a BlockStore
+    mutable std::atomic<uint64_t> size; // bytes of text; the registry's writers update it
+};
+
+// fileID -> DocumentEntry in dense pages, the same layout as DeletedDocuments. Readers
+// (every query, for every result) take no lock: find() is two acquire loads. Writers
+// are serialized by the caller. Pages are never moved or freed, and an entry that is
+// removed or replaced is retired rather than freed, since a reader may still hold it.
+// Retired entries are freed with the registry; IDs are never reused, so that is one
+// small entry per deleted file.
+class DocumentRegistry
+{
+public:
+    DocumentRegistry();
+    ~DocumentRegistry();
+    DocumentRegistry(const DocumentRegistry&) = delete;
+    DocumentRegistry& operator=(const DocumentRegistry&) = delete;
+
+    // nullptr when fileID is unknown or removed
+    const DocumentEntry* find(uint32_t fileID) const {
+        const Page* page = pages[fileID >> DOCUMENT_PAGE_BITS].load(std::memory_order_acquire);
+        return page ? page->entries[fileID & PAGE_MASK].load(std::memory_order_acquire) : nullptr;
+    }
+
+    // Writers only, serialized by the caller.
+    void publish(uint32_t fileID, std::string path, uint64_t size, bool compressed = false);
+    // false when fileID was not there
+    bool remove(uint32_t fileID);
+    void setSize(uint32_t fileID, uint64_t size);
+
+    // Live fileIDs in ascending order.
+    std::vector<uint64_t> ids() const;
+    size_t size() const { return count.load(std::memory_order_relaxed); }
+
+private:
+    static constexpr uint32_t PAGE_MASK = (1u << DOCUMENT_PAGE_BITS) - 1;
+    static constexpr size_t PAGE_COUNT = size_t(1) << (32 - DOCUMENT_PAGE_BITS);
+
+    struct Page {
+        std::atomic<const DocumentEntry*> entries[1u << DOCUMENT_PAGE_BITS];
+    };
+
+    std::atomic<const DocumentEntry*>& slot(uint32_t fileID);
+    void retire(const DocumentEntry* entry);
+
+    std::unique_ptr<std::atomic<Page*>[]> pages;
+    std::atomic<uint32_t> end{ 0 }; // one past the highest fileID ever published
+    std::atomic<size_t> count{ 0 };
+    std::vector<std::unique_ptr<const DocumentEntry>> retired; // writers only
+};
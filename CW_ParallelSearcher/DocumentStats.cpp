@@ -0,0 +1,35 @@
+#include "DocumentStats.h"
+#include <algorithm>
+
+void DocumentStats::setDocument(uint32_t fileID, uint32_t length)
+{
+    std::unique_lock<std::shared_mutex> lock(_mtx);
+    if (fileID >= _lengths.size()) {
+        size_t newSize = std::max<size_t>(static_cast<size_t>(fileID) + 1, _lengths.size() * 2);
+        _lengths.resize(newSize, 0);
+    }
+    uint32_t previous = _lengths[fileID];
+    if (previous == 0 && length != 0)
+        _documents.fetch_add(1, std::memory_order_relaxed);
+    _totalLength.fetch_add(length, std::memory_order_relaxed);
+    _totalLength.fetch_sub(previous, std::memory_order_relaxed);
+    _lengths[fileID] = length;
+}
+
+void DocumentStats::removeDocument(uint32_t fileID)
+{
+    std::unique_lock<std::shared_mutex> lock(_mtx);
+    if (fileID >= _lengths.size() || _lengths[fileID] == 0)
+        return;
+    _documents.fetch_sub(1, std::memory_order_relaxed);
+    _totalLength.fetch_sub(_lengths[fileID], std::memory_order_relaxed);
+    _lengths[fileID] = 0;
+}
+
+double DocumentStats::averageLength() const
+{
+    size_t documents = documentCount();
+    if (documents == 0)
+        return 0.0;
+    return static_cast<double>(_totalLength.load(std::memory_order_relaxed)) / documents;
+}
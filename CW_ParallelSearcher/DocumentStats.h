@@ -0,0 +1,50 @@
+#pragma once
+#include <vector>
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Per-document statistics collected while indexing, kept in dense arrays
+// indexed by fileID so ranking can read them without hashing.
+class DocumentStats
+{
+public:
+    DocumentStats() = default;
+    DocumentStats(const DocumentStats&) = delete;
+    DocumentStats& operator=(const DocumentStats&) = delete;
+
+    void setDocument(uint32_t fileID, uint32_t length);
+    // A deleted document no longer counts towards the document count or average length.
+    void removeDocument(uint32_t fileID);
+
+    size_t documentCount() const { return _documents.load(std::memory_order_relaxed); }
+    double averageLength() const;
+
+    // Keeps the arrays read-locked while a query ranks its candidates.
+    class ReadView {
+    public:
+        explicit ReadView(const DocumentStats& stats) : _stats(stats), _lock(stats._mtx) {}
+        uint32_t length(uint32_t fileID) const {
+            return fileID < _stats._lengths.size() ? _stats._lengths[fileID] : 0;
+        }
+        uint32_t maxFileID() const {
+            return _stats._lengths.empty() ? 0 : static_cast<uint32_t>(_stats._lengths.size() - 1);
+        }
+        // Gives the arrays back once ranking is done, before snippets read files, so
+        // indexing is not held up by disk reads; nothing may be read through the view after.
+        void release() const {
+            if (_lock.owns_lock())
+                _lock.unlock();
+        }
+    private:
+        const DocumentStats& _stats;
+        mutable std::shared_lock<std::shared_mutex> _lock;
+    };
+
+private:
+    mutable std::shared_mutex _mtx;
+    std::vector<uint32_t> _lengths; // tokens per document
+    std::atomic<size_t> _documents{ 0 };
+    std::atomic<uint64_t> _totalLength{ 0 };
+};
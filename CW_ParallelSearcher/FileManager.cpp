@@ -1,9 +1,21 @@
 #include "FileManager.h"
 #include <iostream>
+#include <algorithm>
+#include <cstring>
 
 uint64_t FileManager::currentFileId = 0;
 std::mutex FileManager::fileSaveMutex;
-std::map<uint64_t, std::string> FileManager::fileIndexMap;
+DocumentRegistry FileManager::documents;
+MappedFileCache FileManager::mappedFiles;
+std::vector<std::string> FileManager::removedPaths;
+std::unordered_map<uint64_t, std::vector<uint64_t>> FileManager::filesByContent;
+std::unordered_map<uint64_t, uint64_t> FileManager::contentOf;
+std::unordered_map<uint64_t, std::shared_ptr<const std::string>> FileManager::pendingFiles;
+std::unordered_set<std::string> FileManager::pendingPaths;
+std::unordered_map<uint64_t, uint32_t> FileManager::sharedBy;
+bool FileManager::compressNewFiles = false;
+std::atomic<uint64_t> FileManager::temporaryCount{ 0 };
+std::function<void(uint64_t)> FileManager::idTaken;
 
 std::string FileManager::getTodayFolder()
 {
@@ -16,48 +28,310 @@ std::string FileManager::getTodayFolder()
     return ss.str();
 }
 
-uint64_t FileManager::SaveFile(const std::string& fileName, const std::string& fileData)
+std::string FileManager::storedName(const std::string& fileName)
+{
+    if (compressNewFiles) {
+        return fileName + BLOCK_STORE_EXTENSION;
+    }
+    // would be taken for a temporary file and removed at startup
+    return std::filesystem::path(fileName).extension() == STORAGE_TEMP_EXTENSION ? fileName + ".txt" : fileName;
+}
+
+bool FileManager::isCompressed(const std::filesystem::path& filePath)
+{
+    return filePath.extension() == BLOCK_STORE_EXTENSION;
+}
+
+bool FileManager::writeDocument(const std::string& filePath, const std::string& fileData)
+{
+    if (isCompressed(filePath)) {
+        return BlockStore::write(filePath, fileData);
+    }
+    std::ofstream outFile(filePath, std::ios::binary);
+    if (!outFile) {
+        return false;
+    }
+    outFile.write(fileData.c_str(), fileData.size());
+    outFile.close();
+    return static_cast<bool>(outFile);
+}
+
+void FileManager::SetCompression(bool enabled)
+{
+    compressNewFiles = enabled;
+}
+
+void FileManager::SetIdTaken(std::function<void(uint64_t)> taken)
 {
     std::lock_guard<std::mutex> lock(fileSaveMutex);
+    idTaken = std::move(taken);
+}
+
+uint64_t FileManager::takeFileId()
+{
+    uint64_t fileId = ++currentFileId;
+    if (idTaken) {
+        idTaken(fileId);
+    }
+    return fileId;
+}
+
+uint64_t FileManager::SaveFile(const std::string& fileName, std::string fileData,
+    std::function<void(uint64_t, bool)> stored, bool* duplicate)
+{
+    uint64_t hash = ContentHash::of(fileData);
+    auto data = std::make_shared<const std::string>(std::move(fileData));
+    // encoded before the lock, like the hash; wasted only on a duplicate
+    auto bytes = compressNewFiles ? std::make_shared<const std::string>(BlockStore::encode(*data)) : data;
+    std::unique_lock<std::mutex> lock(fileSaveMutex);
+
+    if (uint64_t existingId = findContent(hash, *data, lock)) {
+        ++sharedBy[existingId];
+        if (duplicate) {
+            *duplicate = true;
+        }
+        return existingId;
+    }
 
     std::string todayFolder = std::string(STORAGE_DIR) + "/" + getTodayFolder() + "/";
     std::filesystem::create_directories(todayFolder);
 
-    uint64_t fileId = ++currentFileId;
+    uint64_t fileId = takeFileId();
+    // an earlier upload of the same name may still be on its way to disk
+    std::string filePath = freePath(todayFolder, fileName);
+    pendingPaths.insert(filePath);
+    pendingFiles[fileId] = data;
+    rememberContent(fileId, hash);
+    // writeFile may wait for earlier writes, whose completions take the lock
+    lock.unlock();
 
-    std::string filePath = todayFolder + fileName;
+    StorageIO::instance().writeFile(filePath, bytes, [fileId, filePath, data, stored](bool written) {
+        {
+            std::lock_guard<std::mutex> lock(fileSaveMutex);
+            pendingFiles.erase(fileId);
+            pendingPaths.erase(filePath);
+            if (written) {
+                documents.publish(static_cast<uint32_t>(fileId), filePath, data->size(), isCompressed(filePath));
+            }
+            else {
+                forgetContent(fileId);
+            }
+        }
+        if (stored) {
+            stored(fileId, written);
+        }
+    });
+    return fileId;
+}
 
-    std::ofstream outFile(filePath, std::ios::binary);
-    if (!outFile) {
+uint64_t FileManager::findContent(uint64_t hash, std::string_view data, std::unique_lock<std::mutex>& lock)
+{
+    struct Candidate {
+        uint64_t fileId;
+        std::shared_ptr<const std::string> pending; // its content, while it is being written
+    };
+    std::unordered_set<uint64_t> compared;
+    // files with this hash come and go while the lock is released: done once every one
+    // still there has been compared
+    for (;;) {
+        auto files = filesByContent.find(hash);
+        if (files == filesByContent.end()) {
+            return 0;
+        }
+        std::vector<Candidate> candidates;
+        for (uint64_t fileId : files->second) {
+            if (compared.insert(fileId).second) {
+                auto pending = pendingFiles.find(fileId);
+                candidates.push_back({ fileId, pending != pendingFiles.end() ? pending->second : nullptr });
+            }
+        }
+        if (candidates.empty()) {
+            return 0;
+        }
+
+        lock.unlock();
+        uint64_t match = 0;
+        for (const auto& candidate : candidates) {
+            if (candidate.pending) {
+                if (*candidate.pending == data) {
+                    match = candidate.fileId;
+                    break;
+                }
+                continue;
+            }
+            if (GetFileSize(candidate.fileId) != data.size()) {
+                continue;
+            }
+            if (OpenText(candidate.fileId).equals(data)) {
+                match = candidate.fileId;
+                break;
+            }
+        }
+        lock.lock();
+        // appended to, replaced, deleted or failed to write meanwhile: its content is forgotten then
+        auto content = contentOf.find(match);
+        if (match != 0 && content != contentOf.end() && content->second == hash) {
+            return match;
+        }
+    }
+}
+
+void FileManager::rememberContent(uint64_t fileId, uint64_t hash)
+{
+    if (contentOf.emplace(fileId, hash).second) {
+        filesByContent[hash].push_back(fileId);
+    }
+}
+
+void FileManager::forgetContent(uint64_t fileId)
+{
+    auto it = contentOf.find(fileId);
+    if (it == contentOf.end()) {
+        return;
+    }
+    auto& files = filesByContent[it->second];
+    files.erase(std::remove(files.begin(), files.end(), fileId), files.end());
+    if (files.empty()) {
+        filesByContent.erase(it->second);
+    }
+    contentOf.erase(it);
+}
+
+bool FileManager::NeedsContentHash(uint64_t fileId)
+{
+    std::lock_guard<std::mutex> lock(fileSaveMutex);
+    return !contentOf.count(fileId) && documents.find(static_cast<uint32_t>(fileId));
+}
+
+void FileManager::RememberContent(uint64_t fileId, uint64_t hash)
+{
+    std::lock_guard<std::mutex> lock(fileSaveMutex);
+    if (documents.find(static_cast<uint32_t>(fileId))) {
+        rememberContent(fileId, hash);
+    }
+}
+
+uint64_t FileManager::ImportFile(const std::filesystem::path& source, const std::string& fileName)
+{
+    std::error_code ec;
+    std::string todayFolder = std::string(STORAGE_DIR) + "/" + getTodayFolder() + "/";
+    std::filesystem::create_directories(todayFolder, ec);
+
+    // compressed into a temporary file first, then linked in under a free name
+    std::string temporary;
+    uint64_t size = 0;
+    if (compressNewFiles) {
+        MappedFile text(source.string());
+        temporary = todayFolder + "import-" + std::to_string(++temporaryCount) + STORAGE_TEMP_EXTENSION;
+        if (!BlockStore::write(temporary, std::string_view(text.data(), text.size()))) {
+            return 0;
+        }
+        size = text.size();
+    }
+    auto place = [&](const std::filesystem::path& target) {
+        if (temporary.empty()) {
+            return std::filesystem::copy_file(source, target, std::filesystem::copy_options::none, ec);
+        }
+        std::filesystem::create_hard_link(temporary, target, ec);
+        return !ec;
+    };
+
+    // never overwrite: a file of that name may be indexed already, or being written; a
+    // name taken by something else meanwhile is tried again with the next free one
+    std::string filePath;
+    bool placed = false;
+    for (int attempt = 0; !placed && attempt <= MAX_NAME_SUFFIX; ++attempt) {
+        {
+            std::lock_guard<std::mutex> lock(fileSaveMutex);
+            filePath = freePath(todayFolder, fileName);
+            pendingPaths.insert(filePath);
+        }
+        placed = place(filePath);
+        std::lock_guard<std::mutex> lock(fileSaveMutex);
+        pendingPaths.erase(filePath);
+        if (!placed && ec != std::errc::file_exists) {
+            break;
+        }
+    }
+    if (!temporary.empty()) {
+        std::error_code removeError;
+        std::filesystem::remove(temporary, removeError);
+    }
+    if (!placed) {
         return 0;
     }
-    outFile.write(fileData.c_str(), fileData.size());
-    outFile.close();
+    if (temporary.empty()) {
+        size = std::filesystem::file_size(filePath, ec);
+    }
 
-    fileIndexMap[fileId] = filePath;
+    std::lock_guard<std::mutex> lock(fileSaveMutex);
+    uint64_t fileId = takeFileId();
+    documents.publish(static_cast<uint32_t>(fileId), filePath, ec ? 0 : size, !temporary.empty());
     return fileId;
 }
 
 std::string FileManager::getFileText(uint64_t fileId)
 {
-    std::string filePath = fileIndexMap[fileId];
-    std::ifstream inFile(filePath, std::ios::binary);
+    TextReader reader = OpenText(fileId);
+    uint64_t base;
+    return std::string(reader.read(0, reader.size(), &base));
+}
 
-    if (!inFile) {
-        return "";
+FileManager::TextReader FileManager::OpenText(uint64_t fileId)
+{
+    TextReader reader;
+    const DocumentEntry* entry = documents.find(static_cast<uint32_t>(fileId));
+    if (entry && entry->compressed) {
+        reader.store = std::make_shared<const BlockStore>(entry->path);
+        reader.textSize = reader.store->size();
     }
+    else {
+        reader.mapped = MapFile(fileId);
+        reader.textSize = reader.mapped->size();
+    }
+    return reader;
+}
 
-    std::string fileContent(
-        (std::istreambuf_iterator<char>(inFile)),
-        std::istreambuf_iterator<char>()
-    );
+std::string_view FileManager::TextReader::read(uint64_t begin, uint64_t end, uint64_t* base)
+{
+    *base = 0;
+    if (mapped) {
+        return std::string_view(mapped->data(), mapped->size());
+    }
+    decoded = store->readBlocks(begin, end, base);
+    return decoded;
+}
 
-    return fileContent;
+bool FileManager::TextReader::equals(std::string_view data)
+{
+    if (data.size() != textSize) {
+        return false;
+    }
+    for (uint64_t at = 0; at < textSize;) {
+        uint64_t base;
+        std::string_view text = read(at, at + BLOCK_STORE_READ_BYTES, &base);
+        if (base + text.size() <= at) {
+            return false;
+        }
+        size_t length = static_cast<size_t>(std::min<uint64_t>(base + text.size(), textSize) - at);
+        if (std::memcmp(text.data() + (at - base), data.data() + at, length) != 0) {
+            return false;
+        }
+        at += length;
+    }
+    return true;
 }
 
 std::string FileManager::getFileName(uint64_t fileId)
 {
-    return fileIndexMap[fileId];
+    const DocumentEntry* entry = documents.find(static_cast<uint32_t>(fileId));
+    return entry ? entry->path : std::string();
+}
+
+uint64_t FileManager::GetFileSize(uint64_t fileId)
+{
+    const DocumentEntry* entry = documents.find(static_cast<uint32_t>(fileId));
+    return entry ? entry->size.load(std::memory_order_relaxed) : 0;
 }
 
 void FileManager::Initialize(const std::string& storageDir)
@@ -71,7 +345,6 @@ void FileManager::Initialize(const std::string& storageDir)
         }
 
         currentFileId = 0;
-        fileIndexMap.clear();
 
         for (const auto& dirEntry : std::filesystem::directory_iterator(storageDir))
         {
@@ -82,10 +355,17 @@ void FileManager::Initialize(const std::string& storageDir)
             {
                 if (!fileEntry.is_regular_file()) continue;
 
-                std::string filePath = fileEntry.path().string();
+                std::error_code ec;
+                if (fileEntry.path().extension() == STORAGE_TEMP_EXTENSION) {
+                    // left over from a write that did not finish; uploads never end so (see storedName)
+                    std::filesystem::remove(fileEntry.path(), ec);
+                    continue;
+                }
+                bool compressed = isCompressed(fileEntry.path());
+                uint64_t size = compressed ? BlockStore(fileEntry.path().string()).size() : fileEntry.file_size(ec);
 
-                ++currentFileId;
-                fileIndexMap[currentFileId] = filePath;
+                uint64_t fileId = takeFileId();
+                documents.publish(static_cast<uint32_t>(fileId), fileEntry.path().string(), ec ? 0 : size, compressed);
             }
         }
         std::cout << "FileManager initialized. Files indexed: " << currentFileId << std::endl;
@@ -98,26 +378,179 @@ void FileManager::Initialize(const std::string& storageDir)
 
 std::string FileManager::GetFilePart(uint64_t fileId, size_t partIndex, size_t partSize)
 {
-    std::string filePath = fileIndexMap[fileId];
-    std::ifstream inFile(filePath, std::ios::binary);
-
-    if (!inFile)
+    if (partIndex >= GetFileSize(fileId))
+        return "";
+    uint64_t base;
+    auto mapped = MapRange(fileId, partIndex, partIndex + partSize, &base);
+    size_t offset = static_cast<size_t>(partIndex - base);
+    if (offset >= mapped->size())
         return "";
+    return std::string(mapped->data() + offset, std::min(partSize, mapped->size() - offset));
+}
 
-    inFile.seekg(partIndex, std::ios::beg);
+MappedFilePtr FileManager::MapFile(uint64_t fileId)
+{
+    const DocumentEntry* entry = documents.find(static_cast<uint32_t>(fileId));
+    if (entry && entry->compressed) {
+        return MappedFile::ofText(BlockStore(entry->path).readAll());
+    }
+    return mappedFiles.get(fileId, entry ? entry->path : std::string());
+}
 
-    std::vector<char> buffer(partSize);
-    inFile.read(buffer.data(), partSize);
-    size_t bytesRead = inFile.gcount();
+MappedFilePtr FileManager::MapRange(uint64_t fileId, uint64_t begin, uint64_t end, uint64_t* base)
+{
+    *base = 0;
+    const DocumentEntry* entry = documents.find(static_cast<uint32_t>(fileId));
+    if (!entry || !entry->compressed) {
+        return MapFile(fileId);
+    }
+    // decoded blocks are not cached: the next range is most likely in another file
+    return MappedFile::ofText(BlockStore(entry->path).readBlocks(begin, end, base));
+}
 
-    return std::string(buffer.data(), bytesRead);
+bool FileManager::AppendFile(uint64_t fileId, const std::string& data)
+{
+    std::string filePath = getFileName(fileId);
+    if (filePath.empty()) {
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(fileSaveMutex);
+    // the content is not what was hashed any more
+    forgetContent(fileId);
+    if (isCompressed(filePath)) {
+        uint64_t textSize;
+        if (!BlockStore::append(filePath, data, &textSize)) {
+            return false;
+        }
+        documents.setSize(static_cast<uint32_t>(fileId), textSize);
+        return true;
+    }
+    std::ofstream outFile(filePath, std::ios::binary | std::ios::app);
+    if (!outFile) {
+        return false;
+    }
+    outFile.write(data.c_str(), data.size());
+    outFile.close();
+    if (!outFile) {
+        return false;
+    }
+    auto mapped = mappedFiles.refresh(fileId, filePath);
+    documents.setSize(static_cast<uint32_t>(fileId), mapped->size());
+    return true;
 }
 
-std::vector<uint64_t> FileManager::GetAllFileIds()
+std::string FileManager::freePath(const std::string& folder, const std::string& fileName)
 {
-    std::vector<uint64_t> fileIds;
-    for (const auto& entry : fileIndexMap) {
-        fileIds.push_back(entry.first);
+    std::filesystem::path name(fileName);
+    std::string filePath = folder + storedName(fileName);
+    auto taken = [](const std::string& path) { return pendingPaths.count(path) || std::filesystem::exists(path); };
+    for (int suffix = 1; taken(filePath) && suffix <= MAX_NAME_SUFFIX; ++suffix) {
+        filePath = folder + storedName(name.stem().string() + "-" + std::to_string(suffix) + name.extension().string());
     }
-	return fileIds;
+    return filePath;
+}
+
+bool FileManager::IsShared(uint64_t fileId)
+{
+    std::lock_guard<std::mutex> lock(fileSaveMutex);
+    return sharedBy.count(fileId) > 0;
+}
+
+bool FileManager::ReleaseShared(uint64_t fileId)
+{
+    std::lock_guard<std::mutex> lock(fileSaveMutex);
+    auto it = sharedBy.find(fileId);
+    if (it == sharedBy.end()) {
+        return false;
+    }
+    if (--it->second == 0) {
+        sharedBy.erase(it);
+    }
+    return true;
+}
+
+bool FileManager::RemoveDocument(uint64_t fileId)
+{
+    std::lock_guard<std::mutex> lock(fileSaveMutex);
+    const DocumentEntry* entry = documents.find(static_cast<uint32_t>(fileId));
+    if (!entry) {
+        return false;
+    }
+    sharedBy.erase(fileId);
+    removedPaths.push_back(entry->path);
+    documents.remove(static_cast<uint32_t>(fileId));
+    forgetContent(fileId);
+    mappedFiles.erase(fileId);
+    return true;
+}
+
+uint64_t FileManager::ReplaceDocument(uint64_t fileId, const std::string& fileData)
+{
+    std::string filePath;
+    {
+        std::lock_guard<std::mutex> lock(fileSaveMutex);
+        const DocumentEntry* entry = documents.find(static_cast<uint32_t>(fileId));
+        if (!entry) {
+            return 0;
+        }
+        // a new path: the old file is still read for results until the new one is indexed
+        std::string todayFolder = std::string(STORAGE_DIR) + "/" + getTodayFolder() + "/";
+        std::filesystem::create_directories(todayFolder);
+        std::filesystem::path oldName = std::filesystem::path(entry->path).filename();
+        if (entry->compressed) {
+            oldName.replace_extension();
+        }
+        filePath = freePath(todayFolder, oldName.string());
+        pendingPaths.insert(filePath);
+    }
+
+    // hashed and written without the lock, so uploads go on meanwhile
+    uint64_t hash = ContentHash::of(fileData);
+    bool written = writeDocument(filePath, fileData);
+    std::lock_guard<std::mutex> lock(fileSaveMutex);
+    pendingPaths.erase(filePath);
+    if (!written) {
+        return 0;
+    }
+    if (!documents.find(static_cast<uint32_t>(fileId))) {
+        // deleted meanwhile: nothing is left to replace
+        removedPaths.push_back(filePath);
+        return 0;
+    }
+
+    uint64_t newFileId = takeFileId();
+    documents.publish(static_cast<uint32_t>(newFileId), filePath, fileData.size(), isCompressed(filePath));
+    // the old ID is about to be deleted: uploads must not be mapped to it any more
+    forgetContent(fileId);
+    rememberContent(newFileId, hash);
+    return newFileId;
+}
+
+size_t FileManager::PurgeRemovedFiles()
+{
+    std::lock_guard<std::mutex> lock(fileSaveMutex);
+    if (removedPaths.empty()) {
+        return 0;
+    }
+
+    // every file has a path of its own (see freePath), so a removed path is nobody else's
+    size_t removed = 0;
+    std::vector<std::string> retry;
+    for (const auto& path : removedPaths) {
+        std::error_code ec;
+        if (std::filesystem::remove(path, ec)) {
+            ++removed;
+        }
+        else if (ec) {
+            retry.push_back(path); // still mapped, on some platforms
+        }
+    }
+    removedPaths.swap(retry);
+    return removed;
+}
+
+std::vector<uint64_t> FileManager::GetAllFileIds()
+{
+    return documents.ids();
 }
@@ -3,32 +3,147 @@
 #include <fstream>
 #include <vector>
 #include <mutex>
-#include <map>
+#include <unordered_set>
+#include <unordered_map>
+#include <string_view>
+#include <atomic>
+#include <functional>
 #include <filesystem>
 #include <chrono>
 #include <iomanip>
 #include <sstream>
+#include "MappedFile.h"
+#include "ContentHash.h"
+#include "DocumentRegistry.h"
+#include "BlockStore.h"
+#include "StorageIO.h"
 
 #define STORAGE_DIR "storage"
+#define MAX_NAME_SUFFIX 1000 // "name-N.ext" tried when an imported name is taken
 
 class FileManager
 {
 private:
     static uint64_t currentFileId;
-    static std::mutex fileSaveMutex;
+    static std::mutex fileSaveMutex; // serializes writers; readers of documents take no lock
 
-    static std::map<uint64_t, std::string> fileIndexMap; // maps file ID to file path
+    static DocumentRegistry documents; // file ID -> path and size
+    static MappedFileCache mappedFiles;
+    static std::vector<std::string> removedPaths; // of deleted files, not removed from disk yet
+    // content hash -> files with that hash, and back; only files whose content is known
+    static std::unordered_map<uint64_t, std::vector<uint64_t>> filesByContent;
+    static std::unordered_map<uint64_t, uint64_t> contentOf;
+    // files being written by StorageIO: their IDs are taken but not published yet
+    static std::unordered_map<uint64_t, std::shared_ptr<const std::string>> pendingFiles;
+    // paths of files being written or placed, not on disk yet: freePath never hands them out
+    static std::unordered_set<std::string> pendingPaths;
+    // uploads beyond the first that deduplication handed a file's ID to
+    static std::unordered_map<uint64_t, uint32_t> sharedBy;
+    static bool compressNewFiles;
+    static std::atomic<uint64_t> temporaryCount; // names temporary files of concurrent imports
+    static std::function<void(uint64_t)> idTaken;
+
+    // The next file ID, reported to idTaken; fileSaveMutex held
+    static uint64_t takeFileId();
 
     static std::string getTodayFolder();
+    // fileName as stored: with BLOCK_STORE_EXTENSION when new files are compressed, and
+    // never ending in STORAGE_TEMP_EXTENSION
+    static std::string storedName(const std::string& fileName);
+    static bool writeDocument(const std::string& filePath, const std::string& fileData);
+    static bool isCompressed(const std::filesystem::path& filePath);
+    // storedName(fileName) in folder, or that of "name-N.ext" when it exists already or is
+    // in pendingPaths; fileSaveMutex held
+    static std::string freePath(const std::string& folder, const std::string& fileName);
+    // A stored file whose bytes equal data, 0 if none. Equal hashes are confirmed byte for
+    // byte against the stored file, so a hash collision can never merge two contents.
+    // Called with lock held on fileSaveMutex, which it releases while files are mapped and
+    // compared; a match is confirmed still current once it is held again.
+    static uint64_t findContent(uint64_t hash, std::string_view data, std::unique_lock<std::mutex>& lock);
+    // fileSaveMutex held
+    static void rememberContent(uint64_t fileId, uint64_t hash);
+    static void forgetContent(uint64_t fileId);
 
 public:
     FileManager() = delete;
-    static uint64_t SaveFile(const std::string& fileName, const std::string& fileData);
+    // Takes an ID and a free path for fileData and has StorageIO write it; stored(ID, written)
+    // runs on the I/O thread once the write is done, and the file is known from then if
+    // written. Blocks while StorageIO has too much queued. When a
+    // file stored or being stored has exactly this content already, nothing is written,
+    // stored is not called and that file's ID is returned, with *duplicate set; the file
+    // then counts one more upload sharing it (see ReleaseShared).
+    static uint64_t SaveFile(const std::string& fileName, std::string fileData,
+        std::function<void(uint64_t, bool)> stored, bool* duplicate = nullptr);
+    // Calls taken(ID) for every file ID from now on, as it is taken and before any later
+    // one is; the ingest queue reserves them so its watermark never passes a file still
+    // being stored. nullptr stops it.
+    static void SetIdTaken(std::function<void(uint64_t)> taken);
+    // Copies source into today's folder under fileName, or "name-N.ext" when that is taken,
+    // and returns its new ID; 0 when it cannot be copied. The copy runs outside the lock,
+    // with its path reserved in pendingPaths.
+    static uint64_t ImportFile(const std::filesystem::path& source, const std::string& fileName);
     static std::string getFileText(uint64_t fileId);
+
+    // Reads a stored file's text a range at a time. A plain file is mapped once and every
+    // read returns the whole mapping; a compressed one decodes only the blocks of each
+    // range, and nothing decoded is cached. Sees the file as it was when opened.
+    class TextReader
+    {
+    public:
+        uint64_t size() const { return textSize; }
+        // Text covering at least [begin, end) clipped to size(), starting at text offset
+        // *base and valid until the next read; empty when a block does not decode.
+        std::string_view read(uint64_t begin, uint64_t end, uint64_t* base);
+        // Whether the text is exactly data, compared a range at a time.
+        bool equals(std::string_view data);
+
+    private:
+        friend class FileManager;
+        MappedFilePtr mapped;                    // a plain file
+        std::shared_ptr<const BlockStore> store; // a compressed one
+        std::string decoded;
+        uint64_t textSize = 0;
+    };
+    // A reader of fileId's text; its size() is 0 when the file is unknown.
+    static TextReader OpenText(uint64_t fileId);
+
+    // Path of a stored file, "" when unknown. Lock-free, as are MapFile and GetFileSize.
     static std::string getFileName(uint64_t fileId);
+    static uint64_t GetFileSize(uint64_t fileId);
     static void Initialize(const std::string& storageDir = STORAGE_DIR);
+    // Stores files saved, imported or replaced from now on as BlockStores. Files already
+    // stored keep their format; each is read the way it was written. Call before Initialize.
+    static void SetCompression(bool enabled);
     static std::string GetFilePart(uint64_t fileId, size_t partIndex, size_t partSize);
+    // Whole-file read-only mapping of a plain file, shared through a small LRU. A compressed
+    // file is decoded whole on every call and never cached; read those with OpenText.
+    static MappedFilePtr MapFile(uint64_t fileId);
+    // Text covering [begin, end) of a file, starting at its offset *base: the whole
+    // mapping for a plain file, else only the blocks of the range.
+    static MappedFilePtr MapRange(uint64_t fileId, uint64_t begin, uint64_t end, uint64_t* base);
+    // Appends data to a stored file; false when the file is unknown or cannot be written.
+    // Callers serialize appends to one file.
+    static bool AppendFile(uint64_t fileId, const std::string& data);
 	static std::vector<uint64_t> GetAllFileIds();
+    // Whether deduplication handed fileId to more than one upload.
+    static bool IsShared(uint64_t fileId);
+    // Lets one of the uploads sharing fileId go. True when others still hold it: the file
+    // stays, and only when this returns false is it the caller's to delete.
+    static bool ReleaseShared(uint64_t fileId);
+    // Forgets a file at once; it is removed from disk by PurgeRemovedFiles. False when unknown.
+    static bool RemoveDocument(uint64_t fileId);
+    // Stores data as a new file named like fileId's, next to nothing it could overwrite, and
+    // returns the new ID; 0 when fileId is unknown, deleted while data was written, or data
+    // cannot be written. The lock is only held to pick the path and to publish the file.
+    static uint64_t ReplaceDocument(uint64_t fileId, const std::string& fileData);
+    // Removes deleted files from disk; what cannot be removed yet is retried next time.
+    // Returns how many were removed.
+    static size_t PurgeRemovedFiles();
+    // Whether fileId is stored and the upload path has not hashed it (found at startup or
+    // imported); its indexer then hashes the text for RememberContent.
+    static bool NeedsContentHash(uint64_t fileId);
+    // Records the ContentHash of such a file, so later uploads of the same bytes are recognized.
+    static void RememberContent(uint64_t fileId, uint64_t hash);
 
 
 };
\ No newline at end of file
@@ -0,0 +1,317 @@
+#include "Importer.h"
+#include <iostream>
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+
+namespace {
+
+// true when inner is outer or lies below it; both canonical
+bool within(const std::filesystem::path& inner, const std::filesystem::path& outer)
+{
+    auto mismatch = std::mismatch(outer.begin(), outer.end(), inner.begin(), inner.end());
+    return mismatch.first == outer.end();
+}
+
+std::string escapeJson(const std::string& text)
+{
+    std::string escaped;
+    escaped.reserve(text.size());
+    for (char c : text) {
+        if (c == '"' || c == '\\')
+            escaped += '\\';
+        escaped += c;
+    }
+    return escaped;
+}
+
+}
+
+double Importer::Progress::megabytesPerSecond() const
+{
+    return seconds > 0.0 ? bytesIndexed / (1024.0 * 1024.0) / seconds : 0.0;
+}
+
+double Importer::Progress::documentsPerSecond() const
+{
+    return seconds > 0.0 ? filesIndexed / seconds : 0.0;
+}
+
+std::string Importer::Progress::toJSON() const
+{
+    std::ostringstream json;
+    json << std::fixed << std::setprecision(2);
+    json << "{\"running\": " << (running ? "true" : "false")
+        << ", \"cancelled\": " << (cancelled ? "true" : "false")
+        << ", \"root\": \"" << escapeJson(root) << "\""
+        << ", \"files_found\": " << filesFound
+        << ", \"files_copied\": " << filesCopied
+        << ", \"files_indexed\": " << filesIndexed
+        << ", \"files_failed\": " << filesFailed
+        << ", \"bytes_copied\": " << bytesCopied
+        << ", \"bytes_indexed\": " << bytesIndexed
+        << ", \"seconds\": " << seconds
+        << ", \"mb_per_second\": " << megabytesPerSecond()
+        << ", \"docs_per_second\": " << documentsPerSecond();
+    if (!error.empty())
+        json << ", \"error\": \"" << escapeJson(error) << "\"";
+    json << "}";
+    return json.str();
+}
+
+std::string Importer::Progress::toString() const
+{
+    std::ostringstream line;
+    line << std::fixed << std::setprecision(1);
+    line << "Import " << root << ": " << filesIndexed << " of " << filesFound << " files indexed ("
+        << bytesIndexed / (1024.0 * 1024.0) << " MB, " << filesFailed << " failed) in " << seconds << " s, "
+        << megabytesPerSecond() << " MB/s, " << documentsPerSecond() << " docs/s";
+    if (!error.empty())
+        line << " - " << error;
+    return line.str();
+}
+
+Importer::Importer(Searcher& searcher)
+    : searcher(searcher)
+{
+    auto& metrics = Metrics::instance();
+    importedFiles = metrics.counter("import_files_total", "Files copied into storage by bulk imports");
+    importedBytes = metrics.counter("import_bytes_total", "Bytes copied into storage by bulk imports");
+    failedFiles = metrics.counter("import_failed_files_total", "Files a bulk import could not copy");
+    runningGauge = metrics.gauge("import_running", "1 while a bulk import is running",
+        [this]() { return progress().running ? 1.0 : 0.0; });
+}
+
+Importer::~Importer()
+{
+    cancel();
+    if (runner.joinable())
+        runner.join();
+}
+
+std::string Importer::start(const std::string& path, const std::string& allowedRoot)
+{
+    if (path.empty())
+        return "Missing 'path' parameter";
+    std::error_code ec;
+    auto directory = std::filesystem::canonical(path, ec);
+    if (ec || !std::filesystem::is_directory(directory, ec))
+        return "Not a directory: " + path;
+    if (!allowedRoot.empty()) {
+        auto allowed = std::filesystem::canonical(allowedRoot, ec);
+        if (ec || !within(directory, allowed))
+            return "Not below the import root: " + path;
+    }
+    auto storage = std::filesystem::weakly_canonical(STORAGE_DIR, ec);
+    if (!ec && (within(storage, directory) || within(directory, storage)))
+        return "Cannot import from inside or around the storage directory";
+
+    std::lock_guard<std::mutex> startLock(startMutex);
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (running)
+            return "An import is already running";
+    }
+    if (runner.joinable())
+        runner.join(); // the last import has finished; its thread is only reporting
+
+    std::lock_guard<std::mutex> lock(stateMutex);
+    root = directory;
+    directories.assign(1, directory);
+    directoriesOpen = 1;
+    files = std::make_unique<BoundedQueue<std::filesystem::path>>(IMPORT_QUEUE_DEPTH);
+    unindexed.clear();
+    bytesUnindexed = 0;
+    filesFound = 0;
+    filesCopied = 0;
+    filesFailed = 0;
+    bytesCopied = 0;
+    cancelled = false;
+    error.clear();
+    running = true;
+    started = std::chrono::steady_clock::now();
+    runner = std::thread([this]() { this->run(); });
+    return "";
+}
+
+void Importer::cancel()
+{
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        if (!running)
+            return;
+        cancelled = true;
+        files->close();
+    }
+    std::lock_guard<std::mutex> lock(directoriesMutex);
+    directoriesChanged.notify_all();
+}
+
+bool Importer::waitDone(std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(stateMutex);
+    return stateChanged.wait_for(lock, timeout, [this]() { return !running; });
+}
+
+Importer::Progress Importer::progress() const
+{
+    Progress progress;
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        progress.running = running;
+        progress.cancelled = cancelled;
+        progress.root = root.string();
+        progress.error = error;
+        auto until = running ? std::chrono::steady_clock::now() : ended;
+        progress.seconds = started.time_since_epoch().count() == 0 ? 0.0
+            : std::chrono::duration<double>(until - started).count();
+    }
+    progress.filesFound = filesFound;
+    progress.filesFailed = filesFailed;
+    progress.filesCopied = filesCopied;
+    progress.bytesCopied = bytesCopied;
+
+    std::lock_guard<std::mutex> lock(unindexedMutex);
+    uint64_t indexedUpTo = searcher.IndexedUpTo();
+    uint64_t waitingFiles = 0, waitingBytes = 0;
+    for (auto it = unindexed.upper_bound({ indexedUpTo, UINT64_MAX }); it != unindexed.end(); ++it) {
+        ++waitingFiles;
+        waitingBytes += it->second;
+    }
+    // copied and indexed are read at slightly different times
+    progress.filesIndexed = progress.filesCopied - std::min(progress.filesCopied, waitingFiles);
+    progress.bytesIndexed = progress.bytesCopied - std::min(progress.bytesCopied, waitingBytes);
+    return progress;
+}
+
+void Importer::run()
+{
+    std::vector<std::thread> walkers, copiers;
+    for (size_t i = 0; i < IMPORT_WALKERS; ++i)
+        walkers.emplace_back([this]() { this->walk(); });
+    for (size_t i = 0; i < IMPORT_COPIERS; ++i)
+        copiers.emplace_back([this]() { this->copy(); });
+
+    for (auto& walker : walkers)
+        walker.join();
+    files->close();
+    for (auto& copier : copiers)
+        copier.join();
+
+    if (waitForIndexing(0))
+        finish("");
+    else
+        finish("cancelled");
+}
+
+void Importer::walk()
+{
+    while (true) {
+        std::filesystem::path directory;
+        {
+            std::unique_lock<std::mutex> lock(directoriesMutex);
+            directoriesChanged.wait(lock, [this]() { return cancelled || !directories.empty() || directoriesOpen == 0; });
+            if (cancelled || directories.empty())
+                return; // nothing queued and nothing being listed that could add more
+            directory = std::move(directories.front());
+            directories.pop_front();
+        }
+
+        std::error_code ec;
+        for (std::filesystem::directory_iterator it(directory, ec), end; !ec && it != end && !cancelled; it.increment(ec)) {
+            // symlinks are skipped, so a link cycle cannot make the walk endless
+            std::error_code statusError;
+            auto status = it->symlink_status(statusError);
+            if (std::filesystem::is_directory(status)) {
+                std::lock_guard<std::mutex> lock(directoriesMutex);
+                directories.push_back(it->path());
+                ++directoriesOpen;
+                directoriesChanged.notify_one();
+            }
+            else if (std::filesystem::is_regular_file(status)) {
+                ++filesFound;
+                if (!files->push(it->path()))
+                    break;
+            }
+        }
+        if (ec)
+            std::cerr << "Import cannot list " << directory.string() << ": " << ec.message() << std::endl;
+
+        std::lock_guard<std::mutex> lock(directoriesMutex);
+        if (--directoriesOpen == 0)
+            directoriesChanged.notify_all();
+    }
+}
+
+void Importer::copy()
+{
+    std::filesystem::path file;
+    while (files->pop(file)) {
+        if (!waitForIndexing(IMPORT_MAX_UNINDEXED - 1))
+            return;
+
+        std::error_code ec;
+        uint64_t bytes = std::filesystem::file_size(file, ec);
+        uint64_t fileID = ec ? 0 : FileManager::ImportFile(file, storageName(file));
+        if (fileID == 0) {
+            ++filesFailed;
+            Metrics::instance().add(failedFiles);
+            std::cerr << "Import cannot copy " << file.string() << std::endl;
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(unindexedMutex);
+            unindexed.emplace(fileID, bytes);
+            bytesUnindexed += bytes;
+        }
+        ++filesCopied;
+        bytesCopied += bytes;
+        Metrics::instance().add(importedFiles);
+        Metrics::instance().add(importedBytes, bytes);
+        searcher.AddFile(fileID);
+    }
+}
+
+bool Importer::waitForIndexing(size_t maxUnindexed)
+{
+    while (!cancelled) {
+        uint64_t oldest;
+        {
+            std::lock_guard<std::mutex> lock(unindexedMutex);
+            forgetIndexed();
+            if (unindexed.size() <= maxUnindexed)
+                return true;
+            oldest = unindexed.begin()->first;
+        }
+        // bounded, so that a cancel is noticed
+        searcher.WaitIndexed(oldest, std::chrono::milliseconds(100));
+    }
+    return false;
+}
+
+void Importer::forgetIndexed()
+{
+    auto indexed = unindexed.upper_bound({ searcher.IndexedUpTo(), UINT64_MAX });
+    for (auto it = unindexed.begin(); it != indexed; ++it)
+        bytesUnindexed -= it->second;
+    unindexed.erase(unindexed.begin(), indexed);
+}
+
+std::string Importer::storageName(const std::filesystem::path& file) const
+{
+    std::string name = file.lexically_relative(root).generic_string();
+    std::replace(name.begin(), name.end(), '/', '_');
+    return name;
+}
+
+void Importer::finish(const std::string& reason)
+{
+    {
+        std::lock_guard<std::mutex> lock(stateMutex);
+        running = false;
+        error = reason;
+        ended = std::chrono::steady_clock::now();
+    }
+    std::cout << progress().toString() << std::endl;
+    stateChanged.notify_all();
+}
@@ -0,0 +1,112 @@
+#pragma once
+#include "Searcher.h"
+#include "FileManager.h"
+#include "BoundedQueue.h"
+#include "Metrics.h"
+#include <string>
+#include <vector>
+#include <deque>
+#include <set>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <chrono>
+#include <filesystem>
+#include <memory>
+#define IMPORT_WALKERS 4         // threads listing directories
+#define IMPORT_COPIERS 4         // threads copying files into storage
+#define IMPORT_QUEUE_DEPTH 1024  // files found and not copied yet
+#define IMPORT_MAX_UNINDEXED 256 // files copied and not indexed yet
+
+// Bulk import of every regular file under a directory tree, as a pipeline of three stages:
+//
+//   walk  - IMPORT_WALKERS threads list directories, each subdirectory becoming more work
+//   copy  - IMPORT_COPIERS threads copy the files found into storage and hand them to the
+//           Searcher's ingest queue
+//   index - the Searcher tokenizes and indexes them on its thread pool
+//
+// Each stage is bounded: walkers block once IMPORT_QUEUE_DEPTH files wait to be copied, and
+// copiers block once IMPORT_MAX_UNINDEXED copied files wait to be indexed, so a huge tree
+// is streamed through at the pace of indexing instead of being listed or copied up front.
+// One import runs at a time; it has its own threads so that blocking on back-pressure
+// never takes a pool worker away from indexing.
+class Importer
+{
+public:
+    struct Progress {
+        bool running = false;
+        bool cancelled = false;
+        std::string root;
+        std::string error;     // why the last import stopped early, empty otherwise
+        uint64_t filesFound = 0;
+        uint64_t filesCopied = 0;
+        uint64_t filesIndexed = 0;
+        uint64_t filesFailed = 0;
+        uint64_t bytesCopied = 0;
+        uint64_t bytesIndexed = 0;
+        double seconds = 0.0;  // since the import started, until it ended
+
+        double megabytesPerSecond() const;  // indexed bytes
+        double documentsPerSecond() const;  // indexed files
+        std::string toJSON() const;
+        std::string toString() const;       // one line for the console
+    };
+
+    explicit Importer(Searcher& searcher);
+    ~Importer();
+
+    // Starts importing root in the background. Returns an error message, empty once started.
+    // When allowedRoot is given, root must be it or lie below it (after resolving links).
+    std::string start(const std::string& root, const std::string& allowedRoot = "");
+    void cancel();
+    // Waits at most timeout for the running import to end; true when none is running.
+    bool waitDone(std::chrono::milliseconds timeout);
+    Progress progress() const;
+
+private:
+    void run();
+    void walk();
+    void copy();
+    // Blocks until at most maxUnindexed copied files are not indexed yet; false once cancelled.
+    bool waitForIndexing(size_t maxUnindexed);
+    void forgetIndexed(); // unindexedMutex held
+    // storage name of a file: its path below root, with separators turned into '_'
+    std::string storageName(const std::filesystem::path& file) const;
+    void finish(const std::string& error);
+
+    Searcher& searcher;
+    std::filesystem::path root;
+    std::thread runner;
+
+    std::mutex startMutex; // held by start() throughout, so it may join the last runner unlocked
+    mutable std::mutex stateMutex;
+    std::condition_variable stateChanged;
+    bool running = false;
+    std::string error;
+    std::chrono::steady_clock::time_point started;
+    std::chrono::steady_clock::time_point ended;
+    std::atomic<bool> cancelled{ false };
+
+    // walk stage: directories listed or waiting to be, and the files they hold
+    std::mutex directoriesMutex;
+    std::condition_variable directoriesChanged;
+    std::deque<std::filesystem::path> directories;
+    size_t directoriesOpen = 0; // queued or being listed
+    std::unique_ptr<BoundedQueue<std::filesystem::path>> files; // one per import, closed when walked
+
+    // index stage: copied files not indexed yet, with their sizes
+    mutable std::mutex unindexedMutex;
+    std::set<std::pair<uint64_t, uint64_t>> unindexed; // (fileID, bytes)
+
+    std::atomic<uint64_t> filesFound{ 0 };
+    std::atomic<uint64_t> filesCopied{ 0 };
+    std::atomic<uint64_t> filesFailed{ 0 };
+    std::atomic<uint64_t> bytesCopied{ 0 };
+    uint64_t bytesUnindexed = 0; // unindexedMutex held
+
+    Metrics::Id importedFiles;
+    Metrics::Id importedBytes;
+    Metrics::Id failedFiles;
+    Metrics::Gauge runningGauge; // last: unregistered before what it reads is destroyed
+};
@@ -0,0 +1,157 @@
+#include "IngestQueue.h"
+#include <algorithm>
+
+IngestQueue::IngestQueue(size_t maxTasks, std::chrono::milliseconds maxLatency, size_t maxBatch)
+    : maxTasks(std::max<size_t>(maxTasks, 1)), maxLatency(maxLatency), maxBatch(std::max<size_t>(maxBatch, 1))
+{
+}
+
+void IngestQueue::reserve(uint64_t fileID)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (outstanding.insert(fileID).second)
+        reserved.insert(fileID);
+}
+
+void IngestQueue::abandon(uint64_t fileID)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (reserved.erase(fileID)) {
+            outstanding.erase(fileID);
+            failed.insert(fileID);
+        }
+    }
+    indexedChanged.notify_all();
+}
+
+void IngestQueue::push(uint64_t fileID)
+{
+    push(std::vector<uint64_t>{ fileID });
+}
+
+void IngestQueue::push(const std::vector<uint64_t>& fileIDs)
+{
+    if (fileIDs.empty())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto now = Clock::now();
+        for (uint64_t fileID : fileIDs) {
+            if (!reserved.erase(fileID) && !outstanding.insert(fileID).second)
+                continue; // already queued or being indexed
+            waiting.emplace_back(fileID, now);
+            highestPushed = std::max(highestPushed, fileID);
+        }
+    }
+    changed.notify_all();
+}
+
+std::vector<uint64_t> IngestQueue::nextBatch()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    while (!stopped) {
+        if (waiting.empty() || tasks >= maxTasks) {
+            changed.wait(lock);
+            continue;
+        }
+        auto due = waiting.front().second + maxLatency;
+        if (tasks == 0 || waiting.size() >= maxBatch || Clock::now() >= due)
+            break;
+        changed.wait_until(lock, due);
+    }
+    if (stopped)
+        return {};
+
+    // idle: spread what is queued over the free slots; busy: one full batch
+    size_t freeTasks = maxTasks - tasks;
+    size_t size = tasks == 0 ? (waiting.size() + freeTasks - 1) / freeTasks : waiting.size();
+    size = std::min(size, maxBatch);
+
+    std::vector<uint64_t> batch;
+    batch.reserve(size);
+    for (size_t i = 0; i < size; ++i) {
+        batch.push_back(waiting.front().first);
+        waiting.pop_front();
+    }
+    ++tasks;
+    return batch;
+}
+
+void IngestQueue::indexed(uint64_t fileID)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        outstanding.erase(fileID);
+    }
+    indexedChanged.notify_all();
+}
+
+void IngestQueue::finishBatch()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        --tasks;
+    }
+    changed.notify_all();
+}
+
+void IngestQueue::stop()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopped = true;
+    }
+    changed.notify_all();
+    indexedChanged.notify_all();
+}
+
+uint64_t IngestQueue::watermark() const
+{
+    return outstanding.empty() ? highestPushed : *outstanding.begin() - 1;
+}
+
+uint64_t IngestQueue::indexedUpTo() const
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return watermark();
+}
+
+bool IngestQueue::waitIndexed(uint64_t fileID, std::chrono::milliseconds timeout)
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    indexedChanged.wait_for(lock, timeout, [this, fileID]() { return stopped || fileID <= watermark(); });
+    return fileID <= watermark() && !failed.count(fileID);
+}
+
+bool IngestQueue::abandoned(uint64_t fileID) const
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return failed.count(fileID) > 0;
+}
+
+bool IngestQueue::idle() const
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return outstanding.empty() && tasks == 0;
+}
+
+size_t IngestQueue::queued() const
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return waiting.size();
+}
+
+size_t IngestQueue::indexing() const
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    return outstanding.size() - reserved.size() - waiting.size();
+}
+
+double IngestQueue::lagSeconds() const
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    if (waiting.empty())
+        return 0.0;
+    return std::chrono::duration<double>(Clock::now() - waiting.front().second).count();
+}
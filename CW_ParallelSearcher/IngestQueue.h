@@ -0,0 +1,71 @@
+#pragma once
+#include <vector>
+#include <deque>
+#include <set>
+#include <utility>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <cstdint>
+#define INGEST_MAX_LATENCY_MS 250 // longest a file is held back while indexing is busy
+#define INGEST_MAX_BATCH 64       // files indexed by one pool task
+
+// Files waiting to be indexed, handed out in batches to a dispatcher thread.
+//
+// While nothing is being indexed, queued files go out at once, spread over the free task
+// slots. While batches are in flight, files are held back until a full batch has gathered
+// or the oldest has waited maxLatency, so a burst of uploads becomes a few large tasks
+// instead of one per file, and at most maxTasks pool workers are ever busy indexing.
+//
+// The watermark is the highest fileID such that every file with an ID up to it has been
+// indexed. IDs are reserved as they are taken, before their file is stored and pushed, so
+// one still being written holds the watermark back; an ID whose file was never stored is
+// abandoned and no longer does, and is reported as failed from then on.
+class IngestQueue
+{
+public:
+    using Clock = std::chrono::steady_clock;
+
+    IngestQueue(size_t maxTasks, std::chrono::milliseconds maxLatency = std::chrono::milliseconds(INGEST_MAX_LATENCY_MS),
+        size_t maxBatch = INGEST_MAX_BATCH);
+
+    void reserve(uint64_t fileID);
+    void abandon(uint64_t fileID);
+    void push(uint64_t fileID);
+    void push(const std::vector<uint64_t>& fileIDs);
+
+    // Blocks until a batch may go out; empty once stopped. Every batch returned takes a
+    // task slot until finishBatch().
+    std::vector<uint64_t> nextBatch();
+    void indexed(uint64_t fileID);
+    void finishBatch();
+    void stop();
+
+    uint64_t indexedUpTo() const;
+    // Waits at most timeout for fileID to be indexed or abandoned; returns whether it is indexed.
+    bool waitIndexed(uint64_t fileID, std::chrono::milliseconds timeout);
+    bool abandoned(uint64_t fileID) const;
+
+    bool idle() const;          // nothing queued or being indexed
+    size_t queued() const;
+    size_t indexing() const;
+    double lagSeconds() const;  // age of the oldest queued file
+
+private:
+    uint64_t watermark() const; // mtx held
+
+    const size_t maxTasks;
+    const std::chrono::milliseconds maxLatency;
+    const size_t maxBatch;
+
+    mutable std::mutex mtx;
+    std::condition_variable changed;        // queue, task slots or stop
+    std::condition_variable indexedChanged;
+    std::deque<std::pair<uint64_t, Clock::time_point>> waiting;
+    std::set<uint64_t> outstanding;         // reserved, queued or being indexed
+    std::set<uint64_t> reserved;            // taken and not pushed yet
+    std::set<uint64_t> failed;              // abandoned: never stored, so never indexed
+    uint64_t highestPushed = 0;
+    size_t tasks = 0;
+    bool stopped = false;
+};
@@ -11,6 +11,10 @@ Listener::Listener()
 {
 	threadPool.reset(new ThreadPool(12));
 	controller = new Controller(threadPool);
+	acceptedConnections = Metrics::instance().counter("http_connections_accepted_total",
+		"Connections handed to the thread pool");
+	rejectedConnections = Metrics::instance().counter("http_connections_rejected_total",
+		"Connections closed because MAX_CLIENTS were already being served");
 }
 
 Listener::~Listener()
@@ -34,18 +38,20 @@ void Listener::handleClient(int serverSocket, std::atomic<uint32_t>& client_coun
 	if (clientSocket == INVALID_SOCKET) {
 		return;
 	}
-	char client_addr[INET_ADDRSTRLEN];
-	inet_ntop(AF_INET, &(clientAddr.sin_addr), client_addr, INET_ADDRSTRLEN);
-	std::cout << "Connection accepted from " << client_addr << ":" <<
-		ntohs(clientAddr.sin_port) << std::endl;
 	if (client_counter.load() <= MAX_CLIENTS)
 	{
+		Metrics::instance().add(acceptedConnections);
 		client_counter++;
 		threadPool->enqueue([this, clientSocket, &client_counter]() {
 			this->controller->handleClient(clientSocket);
+			closesocket(clientSocket);
 			client_counter--;
 			});
 	}
+	else {
+		Metrics::instance().add(rejectedConnections);
+		closesocket(clientSocket);
+	}
 }
 
 int Listener::processListening()
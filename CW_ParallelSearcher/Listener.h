@@ -9,6 +9,8 @@ private:
 	std::shared_ptr<ThreadPool> threadPool;
 	static Listener* instance;
 	std::atomic<bool> listening{ true };
+	Metrics::Id acceptedConnections;
+	Metrics::Id rejectedConnections;
 public:
 	Listener();
 	~Listener();
@@ -18,4 +20,8 @@ public:
 	int startSocket();
 
 	void stopListening();
+
+	std::string startImport(const std::string& root) { return controller->startImport(root); }
+	void allowImportsUnder(const std::string& root) { controller->allowImportsUnder(root); }
+	Importer::Progress importProgress() const { return controller->importProgress(); }
 };
\ No newline at end of file
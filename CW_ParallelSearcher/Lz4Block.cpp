@@ -0,0 +1,125 @@
+#include "Lz4Block.h"
+#include <vector>
+#include <algorithm>
+#include <cstring>
+
+namespace
+{
+    constexpr size_t MIN_MATCH = 4;
+    constexpr size_t LAST_LITERALS = 5; // a block ends with at least this many literals
+    constexpr size_t MATCH_FIND_LIMIT = 12; // and its last match starts this far from the end
+    constexpr size_t MAX_OFFSET = 65535;
+
+    inline uint32_t read32(const char* p) { uint32_t value; std::memcpy(&value, p, 4); return value; }
+    inline uint32_t hash(uint32_t sequence) { return (sequence * 2654435761u) >> (32 - LZ4_HASH_BITS); }
+
+    void writeLength(std::string& out, size_t length)
+    {
+        for (; length >= 255; length -= 255)
+            out.push_back(static_cast<char>(255));
+        out.push_back(static_cast<char>(length));
+    }
+
+    void writeSequence(std::string& out, const char* literals, size_t literalLength, size_t offset, size_t matchLength)
+    {
+        size_t matchCode = matchLength ? matchLength - MIN_MATCH : 0;
+        out.push_back(static_cast<char>((std::min<size_t>(literalLength, 15) << 4) | std::min<size_t>(matchCode, 15)));
+        if (literalLength >= 15)
+            writeLength(out, literalLength - 15);
+        out.append(literals, literalLength);
+        if (!matchLength)
+            return; // the last sequence has literals only
+        out.push_back(static_cast<char>(offset & 0xFF));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (matchCode >= 15)
+            writeLength(out, matchCode - 15);
+    }
+
+    // false when the length runs past end
+    bool readLength(const unsigned char*& in, const unsigned char* end, size_t& length)
+    {
+        unsigned char byte;
+        do {
+            if (in == end)
+                return false;
+            byte = *in++;
+            length += byte;
+        } while (byte == 255);
+        return true;
+    }
+}
+
+size_t Lz4Block::compress(const char* src, size_t size, std::string& out)
+{
+    size_t before = out.size();
+    size_t anchor = 0;
+    if (size > MATCH_FIND_LIMIT) {
+        // positions + 1, so 0 means none
+        std::vector<uint32_t> table(size_t(1) << LZ4_HASH_BITS, 0);
+        size_t matchLimit = size - LAST_LITERALS;
+        size_t findLimit = size - MATCH_FIND_LIMIT;
+        size_t pos = 0;
+        while (pos < findLimit) {
+            uint32_t sequence = read32(src + pos);
+            uint32_t& slot = table[hash(sequence)];
+            size_t candidate = slot;
+            slot = static_cast<uint32_t>(pos + 1);
+            if (!candidate || pos - (candidate - 1) > MAX_OFFSET || read32(src + candidate - 1) != sequence) {
+                // skip faster through text that does not compress
+                pos += 1 + ((pos - anchor) >> 6);
+                continue;
+            }
+            size_t match = candidate - 1;
+            size_t length = MIN_MATCH;
+            while (pos + length < matchLimit && src[match + length] == src[pos + length])
+                ++length;
+            writeSequence(out, src + anchor, pos - anchor, pos - match, length);
+            pos += length;
+            anchor = pos;
+        }
+    }
+    writeSequence(out, src + anchor, size - anchor, 0, 0);
+    return out.size() - before;
+}
+
+bool Lz4Block::decompress(const char* src, size_t size, char* dst, size_t rawSize)
+{
+    const unsigned char* in = reinterpret_cast<const unsigned char*>(src);
+    const unsigned char* end = in + size;
+    size_t out = 0;
+    while (in < end) {
+        unsigned char token = *in++;
+        size_t literalLength = token >> 4;
+        if (literalLength == 15 && !readLength(in, end, literalLength))
+            return false;
+        if (literalLength > static_cast<size_t>(end - in) || literalLength > rawSize - out)
+            return false;
+        std::memcpy(dst + out, in, literalLength);
+        in += literalLength;
+        out += literalLength;
+        if (in == end)
+            break;
+
+        if (end - in < 2)
+            return false;
+        size_t offset = in[0] | (size_t(in[1]) << 8);
+        in += 2;
+        size_t matchLength = token & 15;
+        if (matchLength == 15 && !readLength(in, end, matchLength))
+            return false;
+        matchLength += MIN_MATCH;
+        if (offset == 0 || offset > out || matchLength > rawSize - out)
+            return false;
+        // byte by byte when the match overlaps what it copies
+        const char* match = dst + out - offset;
+        if (offset >= matchLength) {
+            std::memcpy(dst + out, match, matchLength);
+        }
+        else {
+            for (size_t i = 0; i < matchLength; ++i)
+                dst[out + i] = match[i];
+        }
+        out += matchLength;
+    }
+    return out == rawSize;
+}
@@ -0,0 +1,17 @@
+#pragma once
+#include <string>
+#include <cstdint>
+#include <cstddef>
+#define LZ4_HASH_BITS 14 // positions remembered by the compressor: 1 << LZ4_HASH_BITS
+
+// The LZ4 block format: a greedy single-pass compressor and a bounds-checked
+// decompressor, so any LZ4 block decoder can read what this writes. Blocks are
+// independent; neither side keeps state between calls.
+namespace Lz4Block
+{
+    // Appends the compressed form of src to out; returns its size.
+    size_t compress(const char* src, size_t size, std::string& out);
+    // Decodes a block that expands to exactly rawSize bytes into dst; false when src is
+    // not such a block. Never reads or writes out of bounds, whatever src holds.
+    bool decompress(const char* src, size_t size, char* dst, size_t rawSize);
+}
@@ -0,0 +1,123 @@
+#include "MappedFile.h"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile(const std::string& path)
+{
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE,
+        nullptr, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE)
+        return;
+    LARGE_INTEGER fileSize;
+    if (!GetFileSizeEx(file, &fileSize) || fileSize.QuadPart == 0) {
+        CloseHandle(file);
+        return;
+    }
+    HANDLE mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!mapping)
+        return;
+    // the view keeps the mapping object alive
+    void* view = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+    CloseHandle(mapping);
+    if (!view)
+        return;
+    _data = static_cast<const char*>(view);
+    _size = static_cast<size_t>(fileSize.QuadPart);
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return;
+    struct stat info;
+    if (fstat(fd, &info) != 0 || info.st_size == 0) {
+        close(fd);
+        return;
+    }
+    void* view = mmap(nullptr, static_cast<size_t>(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED)
+        return;
+    _data = static_cast<const char*>(view);
+    _size = static_cast<size_t>(info.st_size);
+#endif
+}
+
+std::shared_ptr<const MappedFile> MappedFile::ofText(std::string text)
+{
+    std::shared_ptr<MappedFile> mapped(new MappedFile);
+    mapped->owned = std::move(text);
+    mapped->_data = mapped->owned.data();
+    mapped->_size = mapped->owned.size();
+    return mapped;
+}
+
+MappedFile::~MappedFile()
+{
+    if (!_data || _data == owned.data())
+        return;
+#ifdef _WIN32
+    UnmapViewOfFile(_data);
+#else
+    munmap(const_cast<char*>(_data), _size);
+#endif
+}
+
+MappedFilePtr MappedFileCache::get(uint64_t fileID, const std::string& path)
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = entries.find(fileID);
+        if (it != entries.end()) {
+            recent.splice(recent.begin(), recent, it->second);
+            return it->second->second;
+        }
+    }
+
+    // map outside the lock; if two threads race, the longer mapping wins
+    return insert(fileID, std::make_shared<const MappedFile>(path));
+}
+
+MappedFilePtr MappedFileCache::refresh(uint64_t fileID, const std::string& path)
+{
+    return insert(fileID, std::make_shared<const MappedFile>(path));
+}
+
+void MappedFileCache::erase(uint64_t fileID)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = entries.find(fileID);
+    if (it == entries.end())
+        return;
+    recent.erase(it->second);
+    entries.erase(it);
+}
+
+MappedFilePtr MappedFileCache::insert(uint64_t fileID, MappedFilePtr mapped)
+{
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = entries.find(fileID);
+    if (it != entries.end()) {
+        // one mapped before an append must not replace one mapped after it
+        if (it->second->second->size() > mapped->size())
+            mapped = it->second->second;
+        it->second->second = mapped;
+        recent.splice(recent.begin(), recent, it->second);
+        return mapped;
+    }
+    recent.emplace_front(fileID, mapped);
+    entries[fileID] = recent.begin();
+    if (entries.size() > capacity) {
+        entries.erase(recent.back().first);
+        recent.pop_back();
+    }
+    return mapped;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <memory>
+#include <list>
+#include <unordered_map>
+#include <mutex>
+#include <cstdint>
+#include <cstddef>
+#define MAPPED_FILE_CACHE_SIZE 64
+
+// Read-only memory mapping of a whole file. An empty or unreadable file maps to
+// size() == 0. Files in storage only grow at the end (POST /appendfile), so a mapping
+// may be shorter than its file but the bytes it covers never change. Decoded text of a
+// BlockStore can be wrapped as one too (ofText), which the MappedFile then owns.
+class MappedFile
+{
+public:
+    explicit MappedFile(const std::string& path);
+    ~MappedFile();
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const char* data() const { return _data; }
+    size_t size() const { return _size; }
+
+    // A "mapping" that owns text instead.
+    static std::shared_ptr<const MappedFile> ofText(std::string text);
+
+private:
+    MappedFile() = default;
+
+    const char* _data = nullptr;
+    size_t _size = 0;
+    std::string owned; // the text, when not mapped
+};
+using MappedFilePtr = std::shared_ptr<const MappedFile>;
+
+// Bounded LRU of mapped files, so repeated hits in the same file map it only once.
+// Evicted mappings stay valid for as long as a caller still holds them.
+class MappedFileCache
+{
+public:
+    explicit MappedFileCache(size_t capacity = MAPPED_FILE_CACHE_SIZE) : capacity(capacity) {}
+
+    // Plain files only: decoded text is never cached (see FileManager::OpenText).
+    MappedFilePtr get(uint64_t fileID, const std::string& path);
+    // Maps the file again after it grew; older mappings stay valid for their holders.
+    MappedFilePtr refresh(uint64_t fileID, const std::string& path);
+    void erase(uint64_t fileID);
+
+private:
+    using Entry = std::pair<uint64_t, MappedFilePtr>;
+
+    // Caches mapped unless a longer, so newer, mapping of the file is there; returns the one kept.
+    MappedFilePtr insert(uint64_t fileID, MappedFilePtr mapped);
+
+    size_t capacity;
+    std::mutex mtx;
+    std::list<Entry> recent; // most recently used first
+    std::unordered_map<uint64_t, std::list<Entry>::iterator> entries;
+};
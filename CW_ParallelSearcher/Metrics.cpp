@@ -0,0 +1,207 @@
+#include "Metrics.h"
+#include <map>
+#include <sstream>
+#include <stdexcept>
+#include <algorithm>
+
+Metrics& Metrics::instance()
+{
+    static Metrics metrics;
+    return metrics;
+}
+
+Metrics::ThreadSlots::ThreadSlots()
+{
+    for (auto& counter : counters)
+        counter.store(0, std::memory_order_relaxed);
+    for (auto& histogram : histograms) {
+        for (auto& bucket : histogram.buckets)
+            bucket.store(0, std::memory_order_relaxed);
+        histogram.sumMicros.store(0, std::memory_order_relaxed);
+        histogram.count.store(0, std::memory_order_relaxed);
+    }
+}
+
+Metrics::ThreadSlots& Metrics::localSlots()
+{
+    // hands the slots back when the thread exits; what they counted stays in the totals,
+    // and the next thread counts on from there
+    struct Owner {
+        ThreadSlots* slots = nullptr;
+        ~Owner() {
+            if (!slots)
+                return;
+            Metrics& metrics = Metrics::instance();
+            std::lock_guard<std::mutex> lock(metrics.registryMutex);
+            metrics.freeSlots.push_back(slots);
+        }
+    };
+    thread_local Owner owner;
+    if (!owner.slots) {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        if (!freeSlots.empty()) {
+            owner.slots = freeSlots.back();
+            freeSlots.pop_back();
+        }
+        else {
+            owner.slots = new ThreadSlots();
+            threadSlots.push_back(owner.slots);
+        }
+    }
+    return *owner.slots;
+}
+
+Metrics::Id Metrics::registerSeries(Series entry, size_t capacity, size_t& used)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    for (const auto& existing : series) {
+        if (existing.kind == entry.kind && existing.name == entry.name && existing.labels == entry.labels)
+            return existing.slot;
+    }
+    if (used == capacity)
+        throw std::runtime_error("Metrics capacity exceeded for " + entry.name);
+    entry.slot = static_cast<Id>(used++);
+    series.push_back(std::move(entry));
+    return series.back().slot;
+}
+
+Metrics::Id Metrics::counter(const std::string& name, const std::string& help, const std::string& labels, double scale)
+{
+    return registerSeries(Series(Series::Kind::Counter, name, help, labels, scale), METRICS_MAX_COUNTERS, countersUsed);
+}
+
+Metrics::Id Metrics::histogram(const std::string& name, const std::string& help, const std::string& labels)
+{
+    return registerSeries(Series(Series::Kind::Histogram, name, help, labels), METRICS_MAX_HISTOGRAMS, histogramsUsed);
+}
+
+Metrics::Gauge Metrics::gauge(const std::string& name, const std::string& help, std::function<double()> read, const std::string& labels)
+{
+    std::lock_guard<std::mutex> lock(registryMutex);
+    Series entry(Series::Kind::Gauge, name, help, labels);
+    entry.gaugeKey = ++lastGaugeKey;
+    entry.read = std::move(read);
+    series.push_back(std::move(entry));
+    return Gauge(lastGaugeKey);
+}
+
+void Metrics::unregisterGauge(uint64_t key)
+{
+    // waits for a scrape that may be running the read function
+    std::lock_guard<std::mutex> gaugeLock(gaugeMutex);
+    std::lock_guard<std::mutex> lock(registryMutex);
+    series.erase(std::remove_if(series.begin(), series.end(),
+        [key](const Series& entry) { return entry.gaugeKey == key; }), series.end());
+}
+
+Metrics::Gauge& Metrics::Gauge::operator=(Gauge&& other) noexcept
+{
+    if (this != &other) {
+        if (key)
+            Metrics::instance().unregisterGauge(key);
+        key = other.key;
+        other.key = 0;
+    }
+    return *this;
+}
+
+Metrics::Gauge::~Gauge()
+{
+    if (key)
+        Metrics::instance().unregisterGauge(key);
+}
+
+// single writer per slot: a relaxed load + store is enough and avoids a locked instruction
+static void bump(std::atomic<uint64_t>& slot, uint64_t delta)
+{
+    slot.store(slot.load(std::memory_order_relaxed) + delta, std::memory_order_relaxed);
+}
+
+void Metrics::add(Id counterId, uint64_t delta)
+{
+    bump(localSlots().counters[counterId], delta);
+}
+
+void Metrics::observe(Id histogramId, uint64_t micros)
+{
+    HistogramSlots& histogram = localSlots().histograms[histogramId];
+    size_t bucket = 0;
+    while (bucket < METRICS_HISTOGRAM_BUCKETS && micros > (1ull << bucket))
+        ++bucket;
+    bump(histogram.buckets[bucket], 1);
+    bump(histogram.sumMicros, micros);
+    bump(histogram.count, 1);
+}
+
+static std::string withLabels(const std::string& labels, const std::string& extra = "")
+{
+    std::string all = labels;
+    if (!extra.empty())
+        all += (all.empty() ? "" : ",") + extra;
+    return all.empty() ? "" : "{" + all + "}";
+}
+
+std::string Metrics::renderPrometheus()
+{
+    // gauges read below stay registered, and their owners alive, until the scrape is done
+    std::lock_guard<std::mutex> gaugeLock(gaugeMutex);
+    std::vector<Series> registered;
+    std::vector<ThreadSlots*> threads;
+    {
+        std::lock_guard<std::mutex> lock(registryMutex);
+        registered = series;
+        threads = threadSlots;
+    }
+
+    // one HELP/TYPE header per metric name, series of the same name grouped under it
+    std::map<std::string, std::vector<const Series*>> byName;
+    for (const auto& entry : registered)
+        byName[entry.name].push_back(&entry);
+
+    std::ostringstream out;
+    out.precision(9);
+    for (const auto& [name, entries] : byName) {
+        const Series& first = *entries.front();
+        const char* type = first.kind == Series::Kind::Counter ? "counter"
+            : first.kind == Series::Kind::Histogram ? "histogram" : "gauge";
+        out << "# HELP " << name << " " << first.help << "\n";
+        out << "# TYPE " << name << " " << type << "\n";
+
+        for (const Series* entry : entries) {
+            if (entry->kind == Series::Kind::Gauge) {
+                out << name << withLabels(entry->labels) << " " << entry->read() << "\n";
+            }
+            else if (entry->kind == Series::Kind::Counter) {
+                uint64_t total = 0;
+                for (ThreadSlots* slots : threads)
+                    total += slots->counters[entry->slot].load(std::memory_order_relaxed);
+                out << name << withLabels(entry->labels) << " " << total / entry->scale << "\n";
+            }
+            else {
+                uint64_t buckets[METRICS_HISTOGRAM_BUCKETS + 1] = {};
+                uint64_t sumMicros = 0, count = 0;
+                for (ThreadSlots* slots : threads) {
+                    const HistogramSlots& histogram = slots->histograms[entry->slot];
+                    for (size_t b = 0; b <= METRICS_HISTOGRAM_BUCKETS; ++b)
+                        buckets[b] += histogram.buckets[b].load(std::memory_order_relaxed);
+                    sumMicros += histogram.sumMicros.load(std::memory_order_relaxed);
+                    count += histogram.count.load(std::memory_order_relaxed);
+                }
+                uint64_t cumulative = 0;
+                for (size_t b = 0; b <= METRICS_HISTOGRAM_BUCKETS; ++b) {
+                    cumulative += buckets[b];
+                    std::ostringstream le;
+                    if (b == METRICS_HISTOGRAM_BUCKETS)
+                        le << "+Inf";
+                    else
+                        le << (1ull << b) / 1e6;
+                    out << name << "_bucket" << withLabels(entry->labels, "le=\"" + le.str() + "\"")
+                        << " " << cumulative << "\n";
+                }
+                out << name << "_sum" << withLabels(entry->labels) << " " << sumMicros / 1e6 << "\n";
+                out << name << "_count" << withLabels(entry->labels) << " " << count << "\n";
+            }
+        }
+    }
+    return out.str();
+}
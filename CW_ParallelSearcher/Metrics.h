@@ -0,0 +1,114 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <chrono>
+#include <functional>
+#include <cstdint>
+#define METRICS_MAX_COUNTERS 256
+#define METRICS_MAX_HISTOGRAMS 64
+#define METRICS_HISTOGRAM_BUCKETS 24 // upper bounds 1us, 2us, 4us ... ~8.4s, plus +Inf
+
+// Process-wide telemetry rendered in the Prometheus text format.
+//
+// Every thread records into its own block of slots, so add() and observe() are a relaxed
+// load and store on memory no other thread writes: no locks, no shared cache lines. The
+// scrape sums the blocks of all threads that ever recorded. Series are registered once
+// (usually at construction of the owning object) and addressed by index afterwards.
+// Registering a counter or histogram again under the same name and labels returns the
+// slot it already has, so objects created more than once share their series.
+class Metrics
+{
+public:
+    using Id = uint32_t;
+
+    // Keeps a gauge registered while it lives. Owners hold it as their last member, so
+    // it is destroyed first: after that no scrape runs or will run its read function.
+    class Gauge {
+    public:
+        Gauge() = default;
+        Gauge(Gauge&& other) noexcept : key(other.key) { other.key = 0; }
+        Gauge& operator=(Gauge&& other) noexcept;
+        ~Gauge();
+    private:
+        friend class Metrics;
+        explicit Gauge(uint64_t gaugeKey) : key(gaugeKey) {}
+        uint64_t key = 0;
+    };
+
+    static Metrics& instance();
+
+    Metrics(const Metrics&) = delete;
+    Metrics& operator=(const Metrics&) = delete;
+
+    // labels are given pre-formatted, e.g. "route=\"GET /search\""; scale divides the
+    // raw value at render time (1e6 renders microsecond totals as seconds)
+    Id counter(const std::string& name, const std::string& help, const std::string& labels = "", double scale = 1.0);
+    Id histogram(const std::string& name, const std::string& help, const std::string& labels = "");
+    // sampled on every scrape until the returned handle is destroyed
+    [[nodiscard]] Gauge gauge(const std::string& name, const std::string& help, std::function<double()> read, const std::string& labels = "");
+
+    void add(Id counterId, uint64_t delta = 1);
+    void observe(Id histogramId, uint64_t micros);
+
+    std::string renderPrometheus();
+
+    static uint64_t microsSince(std::chrono::steady_clock::time_point start) {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+            std::chrono::steady_clock::now() - start).count());
+    }
+
+    // Observes the lifetime of the scope.
+    class ScopedTimer {
+    public:
+        explicit ScopedTimer(Id histogramId) : id(histogramId), start(std::chrono::steady_clock::now()) {}
+        ~ScopedTimer() { Metrics::instance().observe(id, microsSince(start)); }
+    private:
+        Id id;
+        std::chrono::steady_clock::time_point start;
+    };
+
+private:
+    Metrics() = default;
+
+    struct HistogramSlots {
+        std::atomic<uint64_t> buckets[METRICS_HISTOGRAM_BUCKETS + 1];
+        std::atomic<uint64_t> sumMicros;
+        std::atomic<uint64_t> count;
+    };
+    struct alignas(64) ThreadSlots {
+        std::atomic<uint64_t> counters[METRICS_MAX_COUNTERS];
+        HistogramSlots histograms[METRICS_MAX_HISTOGRAMS];
+        ThreadSlots();
+    };
+    struct Series {
+        enum class Kind { Counter, Histogram, Gauge };
+        Series(Kind seriesKind, const std::string& seriesName, const std::string& seriesHelp,
+            const std::string& seriesLabels, double seriesScale = 1.0)
+            : kind(seriesKind), name(seriesName), help(seriesHelp), labels(seriesLabels), scale(seriesScale) {}
+        Kind kind;
+        std::string name;
+        std::string help;
+        std::string labels;
+        double scale = 1.0;
+        Id slot = 0;
+        uint64_t gaugeKey = 0; // of gauges, what their handle unregisters
+        std::function<double()> read;
+    };
+
+    // The calling thread's slots: those of a thread that exited when there are any, so a
+    // server that keeps starting threads (imports do) holds one set per live thread only.
+    ThreadSlots& localSlots();
+    Id registerSeries(Series series, size_t capacity, size_t& used);
+    void unregisterGauge(uint64_t key);
+
+    std::mutex gaugeMutex; // held while gauges are read; taken before registryMutex
+    std::mutex registryMutex;
+    std::vector<Series> series;
+    size_t countersUsed = 0;
+    size_t histogramsUsed = 0;
+    uint64_t lastGaugeKey = 0;
+    std::vector<ThreadSlots*> threadSlots; // never freed: counts survive thread exit
+    std::vector<ThreadSlots*> freeSlots;   // of those, the ones no live thread writes
+};
@@ -0,0 +1,740 @@
+#include "QueryEngine.h"
+#include "Ranking.h"
+#include <algorithm>
+#include <cctype>
+#include <stdexcept>
+#include <unordered_map>
+
+// ---- QUERY PARSING ----
+
+std::string QueryNode::toString() const
+{
+    switch (type) {
+    case Type::Term:
+        return words[0];
+    case Type::Phrase: {
+        std::string text = "\"";
+        for (size_t i = 0; i < words.size(); ++i)
+            text += (i ? " " : "") + words[i];
+        return text + "\"";
+    }
+    case Type::Not:
+        return "NOT " + children[0]->toString();
+    case Type::Near: {
+        std::string op = std::string(ordered ? " ONEAR/" : " NEAR/") + std::to_string(slop) + " ";
+        std::string text = "(";
+        for (size_t i = 0; i < words.size(); ++i)
+            text += (i ? op : "") + words[i];
+        return text + ")";
+    }
+    default: {
+        std::string text = "(";
+        for (size_t i = 0; i < children.size(); ++i) {
+            if (i)
+                text += type == Type::And ? " AND " : " OR ";
+            text += children[i]->toString();
+        }
+        return text + ")";
+    }
+    }
+}
+
+namespace
+{
+    struct QueryToken {
+        enum class Kind { Word, Phrase, And, Or, Not, Near, Open, Close, End };
+        Kind kind;
+        std::string text;
+        uint32_t slop = 0;    // Near
+        bool ordered = false; // Near
+    };
+
+    // "NEAR/k" or "ONEAR/k"
+    bool lexProximity(const std::string& word, QueryToken& token)
+    {
+        bool ordered = word.rfind("ONEAR/", 0) == 0;
+        if (!ordered && word.rfind("NEAR/", 0) != 0)
+            return false;
+        std::string distance = word.substr(ordered ? 6 : 5);
+        if (distance.empty() || distance.size() > 4 ||
+            !std::all_of(distance.begin(), distance.end(), [](unsigned char c) { return std::isdigit(c); }))
+            throw std::invalid_argument("Expected a distance in '" + word + "'");
+        token.kind = QueryToken::Kind::Near;
+        token.text = word;
+        token.slop = static_cast<uint32_t>(std::stoul(distance));
+        token.ordered = ordered;
+        if (token.slop > MAX_PROXIMITY_SLOP)
+            throw std::invalid_argument("Distance in '" + word + "' exceeds " + std::to_string(MAX_PROXIMITY_SLOP));
+        return true;
+    }
+
+    std::vector<QueryToken> lexQuery(const std::string& query)
+    {
+        std::vector<QueryToken> tokens;
+        size_t i = 0;
+        while (i < query.size()) {
+            char c = query[i];
+            if (std::isspace(static_cast<unsigned char>(c))) {
+                ++i;
+            }
+            else if (c == '(' || c == ')') {
+                tokens.push_back({ c == '(' ? QueryToken::Kind::Open : QueryToken::Kind::Close, "" });
+                ++i;
+            }
+            else if (c == '"') {
+                size_t close = query.find('"', i + 1);
+                if (close == std::string::npos)
+                    throw std::invalid_argument("Unterminated quote in query");
+                tokens.push_back({ QueryToken::Kind::Phrase, query.substr(i + 1, close - i - 1) });
+                i = close + 1;
+            }
+            else {
+                size_t end = i;
+                while (end < query.size() && !std::isspace(static_cast<unsigned char>(query[end]))
+                    && query[end] != '(' && query[end] != ')' && query[end] != '"')
+                    ++end;
+                std::string word = query.substr(i, end - i);
+                QueryToken proximity;
+                if (lexProximity(word, proximity))
+                    tokens.push_back(proximity);
+                else if (word == "AND")
+                    tokens.push_back({ QueryToken::Kind::And, word });
+                else if (word == "OR")
+                    tokens.push_back({ QueryToken::Kind::Or, word });
+                else if (word == "NOT")
+                    tokens.push_back({ QueryToken::Kind::Not, word });
+                else
+                    tokens.push_back({ QueryToken::Kind::Word, word });
+                i = end;
+            }
+        }
+        tokens.push_back({ QueryToken::Kind::End, "" });
+        return tokens;
+    }
+
+    class QueryParser
+    {
+    public:
+        QueryParser(std::vector<QueryToken> tokens, const QueryEngine::Analyzer& analyze)
+            : tokens(std::move(tokens)), analyze(analyze) {
+        }
+
+        std::unique_ptr<QueryNode> parseQuery() {
+            auto node = parseOr();
+            if (peek() != QueryToken::Kind::End)
+                throw std::invalid_argument("Unexpected ')' in query");
+            return node;
+        }
+
+    private:
+        std::vector<QueryToken> tokens;
+        const QueryEngine::Analyzer& analyze;
+        size_t pos = 0;
+
+        QueryToken::Kind peek() const { return tokens[pos].kind; }
+
+        static bool startsOperand(QueryToken::Kind kind) {
+            return kind == QueryToken::Kind::Word || kind == QueryToken::Kind::Phrase
+                || kind == QueryToken::Kind::Not || kind == QueryToken::Kind::Open;
+        }
+
+        static std::unique_ptr<QueryNode> combine(QueryNode::Type type, std::vector<std::unique_ptr<QueryNode>> operands) {
+            if (operands.size() == 1)
+                return std::move(operands[0]);
+            auto node = std::make_unique<QueryNode>(type);
+            node->children = std::move(operands);
+            return node;
+        }
+
+        std::unique_ptr<QueryNode> parseOr() {
+            std::vector<std::unique_ptr<QueryNode>> operands;
+            operands.push_back(parseAnd());
+            while (peek() == QueryToken::Kind::Or) {
+                ++pos;
+                operands.push_back(parseAnd());
+            }
+            return combine(QueryNode::Type::Or, std::move(operands));
+        }
+
+        std::unique_ptr<QueryNode> parseAnd() {
+            std::vector<std::unique_ptr<QueryNode>> operands;
+            operands.push_back(parseNot());
+            while (true) {
+                if (peek() == QueryToken::Kind::And)
+                    ++pos;
+                else if (!startsOperand(peek()))
+                    break;
+                operands.push_back(parseNot());
+            }
+            return combine(QueryNode::Type::And, std::move(operands));
+        }
+
+        std::unique_ptr<QueryNode> parseNot() {
+            if (peek() != QueryToken::Kind::Not)
+                return parseNear();
+            ++pos;
+            auto node = std::make_unique<QueryNode>(QueryNode::Type::Not);
+            node->children.push_back(parseNot());
+            return node;
+        }
+
+        std::unique_ptr<QueryNode> parseNear() {
+            auto operand = parsePrimary();
+            if (peek() != QueryToken::Kind::Near)
+                return operand;
+
+            auto node = std::make_unique<QueryNode>(QueryNode::Type::Near);
+            node->slop = tokens[pos].slop;
+            node->ordered = tokens[pos].ordered;
+            addProximityWord(*node, *operand);
+            while (peek() == QueryToken::Kind::Near) {
+                const QueryToken& op = tokens[pos++];
+                if (op.slop != node->slop || op.ordered != node->ordered)
+                    throw std::invalid_argument("Chained proximity operators must be identical, got '" + op.text + "'");
+                addProximityWord(*node, *parsePrimary());
+            }
+            return node;
+        }
+
+        static void addProximityWord(QueryNode& near, const QueryNode& operand) {
+            if (operand.type != QueryNode::Type::Term)
+                throw std::invalid_argument("NEAR operands must be single words, got " + operand.toString());
+            near.words.push_back(operand.words[0]);
+        }
+
+        std::unique_ptr<QueryNode> parsePrimary() {
+            const QueryToken& token = tokens[pos];
+            switch (token.kind) {
+            case QueryToken::Kind::Open: {
+                ++pos;
+                auto node = parseOr();
+                if (peek() != QueryToken::Kind::Close)
+                    throw std::invalid_argument("Missing ')' in query");
+                ++pos;
+                return node;
+            }
+            case QueryToken::Kind::Word:
+            case QueryToken::Kind::Phrase: {
+                ++pos;
+                auto words = analyze(token.text);
+                if (words.empty())
+                    throw std::invalid_argument("Query term '" + token.text + "' has no searchable characters");
+                auto node = std::make_unique<QueryNode>(
+                    words.size() == 1 ? QueryNode::Type::Term : QueryNode::Type::Phrase);
+                node->words = std::move(words);
+                return node;
+            }
+            default:
+                throw std::invalid_argument("Expected a word, phrase or '(' in query");
+            }
+        }
+    };
+}
+
+std::unique_ptr<QueryNode> QueryEngine::parse(const std::string& query, const Analyzer& analyze)
+{
+    QueryParser parser(lexQuery(query), analyze);
+    return parser.parseQuery();
+}
+
+// ---- POSTING HELPERS ----
+
+size_t QueryEngine::seekFile(const Postings& postings, size_t from, uint32_t fileID)
+{
+    // gallop first: consecutive seeks usually land close by
+    size_t step = 1;
+    size_t hi = from;
+    while (hi < postings.size() && postings[hi].fileID < fileID) {
+        from = hi + 1;
+        hi += step;
+        step *= 2;
+    }
+    hi = std::min(hi, postings.size());
+    return std::lower_bound(postings.begin() + from, postings.begin() + hi, fileID,
+        [](const ConcurrentHashMap::WordLocation& loc, uint32_t id) { return loc.fileID < id; }) - postings.begin();
+}
+
+uint32_t QueryEngine::alignFiles(const std::vector<PostingsPtr>& postings, std::vector<size_t>& cursors, uint32_t fileID)
+{
+    // leapfrog until every word's cursor sits in the same file
+    bool aligned = false;
+    while (!aligned) {
+        aligned = true;
+        for (size_t i = 0; i < postings.size(); ++i) {
+            cursors[i] = seekFile(*postings[i], cursors[i], fileID);
+            if (cursors[i] == postings[i]->size())
+                return DocIterator::NO_MORE_DOCS;
+            uint32_t found = (*postings[i])[cursors[i]].fileID;
+            if (found != fileID) {
+                fileID = found;
+                aligned = false;
+            }
+        }
+    }
+    return fileID;
+}
+
+// ---- ITERATORS ----
+
+static std::vector<PhrasePart> consecutiveWords(std::vector<PostingsPtr> postings)
+{
+    std::vector<PhrasePart> parts;
+    for (size_t i = 0; i < postings.size(); ++i)
+        parts.push_back({ std::move(postings[i]), static_cast<uint32_t>(i) });
+    return parts;
+}
+
+PhraseIterator::PhraseIterator(std::vector<PostingsPtr> postingLists)
+    : PhraseIterator(consecutiveWords(std::move(postingLists)))
+{
+}
+
+PhraseIterator::PhraseIterator(std::vector<PhrasePart> parts)
+    : cursors(parts.size(), 0)
+{
+    minFiles = SIZE_MAX;
+    for (auto& part : parts) {
+        fileCounts.push_back(part.postings->files);
+        minFiles = std::min(minFiles, fileCounts.back());
+        words = std::max(words, part.offset + part.words);
+        postings.push_back(std::move(part.postings));
+        offsets.push_back(part.offset);
+    }
+    if (postings.empty()) {
+        minFiles = 0;
+        current = NO_MORE_DOCS;
+        return;
+    }
+    advance(0);
+}
+
+uint32_t PhraseIterator::advance(uint32_t target)
+{
+    if (current == NO_MORE_DOCS || (current >= target && !currentMatches.empty()))
+        return current;
+
+    while (true) {
+        uint32_t file = QueryEngine::alignFiles(postings, cursors, target);
+        if (file == NO_MORE_DOCS) {
+            currentMatches.clear();
+            return current = NO_MORE_DOCS;
+        }
+
+        // positions p where part i sits at p + offset_i
+        currentMatches.clear();
+        std::vector<size_t> scan(cursors);
+        const auto& first = *postings[0];
+        size_t firstEnd = QueryEngine::seekFile(first, cursors[0], file + 1);
+        for (size_t f = cursors[0]; f < firstEnd; ++f) {
+            if (first[f].wordPosition < offsets[0])
+                continue;
+            uint32_t start = first[f].wordPosition - offsets[0];
+            bool matched = true;
+            for (size_t i = 1; i < postings.size() && matched; ++i) {
+                const auto& list = *postings[i];
+                uint32_t expected = start + offsets[i];
+                while (scan[i] < list.size() && list[scan[i]].fileID == file && list[scan[i]].wordPosition < expected)
+                    ++scan[i];
+                matched = scan[i] < list.size() && list[scan[i]].fileID == file && list[scan[i]].wordPosition == expected;
+            }
+            if (matched)
+                currentMatches.push_back({ file, start, first[f].byteOffset });
+        }
+
+        if (!currentMatches.empty())
+            return current = file;
+        target = file + 1;
+    }
+}
+
+double PhraseIterator::score(const ScoringContext& ctx) const
+{
+    // the phrase is scored as a pseudo-term whose idf is the sum of its words' idfs
+    // and whose tf is the number of phrase occurrences in the document
+    double idf = 0.0;
+    for (size_t files : fileCounts)
+        idf += Ranking::idf(files, ctx.documentCount);
+    return Ranking::bm25(hits(), idf, ctx.stats.length(current), ctx.averageLength);
+}
+
+ProximityIterator::ProximityIterator(std::vector<PostingsPtr> postingLists, uint32_t slop, bool ordered)
+    : postings(std::move(postingLists)), cursors(postings.size(), 0), slop(slop), ordered(ordered)
+{
+    minFiles = SIZE_MAX;
+    for (const auto& list : postings) {
+        fileCounts.push_back(list->files);
+        minFiles = std::min(minFiles, fileCounts.back());
+    }
+    advance(0);
+}
+
+uint32_t ProximityIterator::advance(uint32_t target)
+{
+    if (current == NO_MORE_DOCS || (current >= target && windows > 0))
+        return current;
+
+    while (true) {
+        uint32_t file = QueryEngine::alignFiles(postings, cursors, target);
+        if (file == NO_MORE_DOCS) {
+            windows = 0;
+            return current = NO_MORE_DOCS;
+        }
+        windows = ordered ? countOrdered(file) : countUnordered(file);
+        if (windows > 0)
+            return current = file;
+        target = file + 1;
+    }
+}
+
+// For each position of the first word, the earliest following position of every next
+// word gives the shortest ordered span starting there. Scan pointers only move forward.
+uint32_t ProximityIterator::countOrdered(uint32_t file)
+{
+    const size_t n = postings.size();
+    std::vector<size_t> scan(cursors);
+    const auto& first = *postings[0];
+    size_t firstEnd = QueryEngine::seekFile(first, cursors[0], file + 1);
+    uint32_t found = 0;
+    for (size_t f = cursors[0]; f < firstEnd; ++f) {
+        uint32_t previous = first[f].wordPosition;
+        bool complete = true;
+        for (size_t i = 1; i < n && complete; ++i) {
+            const auto& list = *postings[i];
+            while (scan[i] < list.size() && list[scan[i]].fileID == file && list[scan[i]].wordPosition <= previous)
+                ++scan[i];
+            complete = scan[i] < list.size() && list[scan[i]].fileID == file;
+            if (complete)
+                previous = list[scan[i]].wordPosition;
+        }
+        if (!complete)
+            break;  // a later start cannot complete either
+        if (previous - first[f].wordPosition - (n - 1) <= slop) {
+            if (found++ == 0)
+                firstOffset = first[f].byteOffset;
+        }
+    }
+    return found;
+}
+
+// Classic minimum-window merge: keep one position per word, and whenever the span from
+// the smallest to the largest is short enough count a window; then move the smallest on.
+uint32_t ProximityIterator::countUnordered(uint32_t file)
+{
+    const size_t n = postings.size();
+    std::vector<size_t> scan(cursors);
+    std::vector<size_t> ends(n);
+    for (size_t i = 0; i < n; ++i)
+        ends[i] = QueryEngine::seekFile(*postings[i], cursors[i], file + 1);
+
+    uint32_t found = 0;
+    while (true) {
+        size_t lowest = 0;
+        uint32_t low = UINT32_MAX, high = 0;
+        bool distinct = true;
+        for (size_t i = 0; i < n; ++i) {
+            uint32_t position = (*postings[i])[scan[i]].wordPosition;
+            for (size_t j = 0; j < i && distinct; ++j)
+                distinct = (*postings[j])[scan[j]].wordPosition != position;
+            if (position < low) {
+                low = position;
+                lowest = i;
+            }
+            high = std::max(high, position);
+        }
+        // the same word given twice must match two different occurrences
+        if (distinct && high - low - (n - 1) <= slop) {
+            if (found++ == 0)
+                firstOffset = (*postings[lowest])[scan[lowest]].byteOffset;
+        }
+        if (++scan[lowest] == ends[lowest])
+            return found;
+    }
+}
+
+double ProximityIterator::score(const ScoringContext& ctx) const
+{
+    // scored like a phrase: the windows are the pseudo-term occurrences
+    double idf = 0.0;
+    for (size_t files : fileCounts)
+        idf += Ranking::idf(files, ctx.documentCount);
+    return Ranking::bm25(windows, idf, ctx.stats.length(current), ctx.averageLength);
+}
+
+namespace
+{
+    class TermIterator final : public DocIterator
+    {
+    public:
+        explicit TermIterator(PostingsPtr postingList)
+            : postings(std::move(postingList)), files(postings->files) {
+            advance(0);
+        }
+
+        uint32_t doc() const override { return current; }
+        uint32_t advance(uint32_t target) override {
+            if (current == NO_MORE_DOCS || (current >= target && sliceEnd > cursor))
+                return current;
+            cursor = QueryEngine::seekFile(*postings, sliceEnd, target);
+            if (cursor == postings->size())
+                return current = NO_MORE_DOCS;
+            current = (*postings)[cursor].fileID;
+            sliceEnd = QueryEngine::seekFile(*postings, cursor, current + 1);
+            return current;
+        }
+        double score(const ScoringContext& ctx) const override {
+            return Ranking::bm25(hits(), Ranking::idf(files, ctx.documentCount),
+                ctx.stats.length(current), ctx.averageLength);
+        }
+        uint32_t hits() const override { return static_cast<uint32_t>(sliceEnd - cursor); }
+        uint32_t firstByteOffset() const override { return (*postings)[cursor].byteOffset; }
+        size_t cost() const override { return files; }
+
+    private:
+        PostingsPtr postings;
+        size_t files;
+        size_t cursor = 0;
+        size_t sliceEnd = 0;
+        uint32_t current = 0;
+    };
+
+    class AndIterator final : public DocIterator
+    {
+    public:
+        explicit AndIterator(std::vector<DocIteratorPtr> operands) : children(std::move(operands)) {
+            // the rarest operand leads, the others are only probed
+            std::sort(children.begin(), children.end(),
+                [](const DocIteratorPtr& a, const DocIteratorPtr& b) { return a->cost() < b->cost(); });
+            advance(0);
+        }
+
+        uint32_t doc() const override { return current; }
+        uint32_t advance(uint32_t target) override {
+            uint32_t candidate = target;
+            while (true) {
+                candidate = children[0]->advance(candidate);
+                if (candidate == NO_MORE_DOCS)
+                    return current = NO_MORE_DOCS;
+                bool all = true;
+                for (size_t i = 1; i < children.size(); ++i) {
+                    uint32_t found = children[i]->advance(candidate);
+                    if (found != candidate) {
+                        candidate = found;
+                        all = false;
+                        break;
+                    }
+                }
+                if (all)
+                    return current = candidate;
+            }
+        }
+        double score(const ScoringContext& ctx) const override {
+            double total = 0.0;
+            for (const auto& child : children)
+                total += child->score(ctx);
+            return total;
+        }
+        uint32_t hits() const override {
+            uint32_t total = 0;
+            for (const auto& child : children)
+                total += child->hits();
+            return total;
+        }
+        uint32_t firstByteOffset() const override {
+            uint32_t first = UINT32_MAX;
+            for (const auto& child : children)
+                first = std::min(first, child->firstByteOffset());
+            return first;
+        }
+        size_t cost() const override { return children[0]->cost(); }
+
+    private:
+        std::vector<DocIteratorPtr> children;
+        uint32_t current = 0;
+    };
+
+    class OrIterator final : public DocIterator
+    {
+    public:
+        explicit OrIterator(std::vector<DocIteratorPtr> operands) : children(std::move(operands)) {
+            advance(0);
+        }
+
+        uint32_t doc() const override { return current; }
+        uint32_t advance(uint32_t target) override {
+            current = NO_MORE_DOCS;
+            for (auto& child : children) {
+                if (child->doc() < target)
+                    child->advance(target);
+                current = std::min(current, child->doc());
+            }
+            return current;
+        }
+        double score(const ScoringContext& ctx) const override {
+            double total = 0.0;
+            for (const auto& child : children)
+                if (child->doc() == current)
+                    total += child->score(ctx);
+            return total;
+        }
+        uint32_t hits() const override {
+            uint32_t total = 0;
+            for (const auto& child : children)
+                if (child->doc() == current)
+                    total += child->hits();
+            return total;
+        }
+        uint32_t firstByteOffset() const override {
+            uint32_t first = UINT32_MAX;
+            for (const auto& child : children)
+                if (child->doc() == current)
+                    first = std::min(first, child->firstByteOffset());
+            return first;
+        }
+        size_t cost() const override {
+            size_t total = 0;
+            for (const auto& child : children)
+                total += child->cost();
+            return total;
+        }
+
+    private:
+        std::vector<DocIteratorPtr> children;
+        uint32_t current = 0;
+    };
+
+    // Documents of 'include' that 'exclude' does not match.
+    class AndNotIterator final : public DocIterator
+    {
+    public:
+        AndNotIterator(DocIteratorPtr include, DocIteratorPtr exclude)
+            : include(std::move(include)), exclude(std::move(exclude)) {
+            advance(0);
+        }
+
+        uint32_t doc() const override { return current; }
+        uint32_t advance(uint32_t target) override {
+            while (true) {
+                uint32_t candidate = include->advance(target);
+                if (candidate == NO_MORE_DOCS || exclude->advance(candidate) != candidate)
+                    return current = candidate;
+                target = candidate + 1;
+            }
+        }
+        double score(const ScoringContext& ctx) const override { return include->score(ctx); }
+        uint32_t hits() const override { return include->hits(); }
+        uint32_t firstByteOffset() const override { return include->firstByteOffset(); }
+        size_t cost() const override { return include->cost(); }
+
+    private:
+        DocIteratorPtr include;
+        DocIteratorPtr exclude;
+        uint32_t current = 0;
+    };
+
+    // Every indexed document; the base a purely negative query subtracts from.
+    class AllDocsIterator final : public DocIterator
+    {
+    public:
+        explicit AllDocsIterator(const ScoringContext& ctx)
+            : stats(ctx.stats), lastFile(ctx.stats.maxFileID()), documents(ctx.documentCount) {
+            advance(0);
+        }
+
+        uint32_t doc() const override { return current; }
+        uint32_t advance(uint32_t target) override {
+            for (uint32_t file = std::max(target, current); file <= lastFile && file != NO_MORE_DOCS; ++file) {
+                if (stats.length(file) > 0)
+                    return current = file;
+            }
+            return current = NO_MORE_DOCS;
+        }
+        double score(const ScoringContext&) const override { return 0.0; }
+        uint32_t hits() const override { return 0; }
+        uint32_t firstByteOffset() const override { return 0; }
+        size_t cost() const override { return documents; }
+
+    private:
+        const DocumentStats::ReadView& stats;
+        uint32_t lastFile;
+        size_t documents;
+        uint32_t current = 0;
+    };
+
+    struct CompileContext {
+        std::unordered_map<std::string, PostingsPtr> fetched;
+        const QueryEngine::PostingLookup& lookup;
+        const QueryEngine::PhrasePlanner& planPhrase;
+        const ScoringContext& ctx;
+    };
+
+    DocIteratorPtr compileNode(const QueryNode& node, CompileContext& compile)
+    {
+        auto& fetched = compile.fetched;
+        auto& lookup = compile.lookup;
+        auto& ctx = compile.ctx;
+        auto postingsOf = [&](const std::string& word) {
+            auto it = fetched.find(word);
+            if (it == fetched.end())
+                it = fetched.emplace(word, lookup(word)).first;
+            return it->second;
+        };
+
+        switch (node.type) {
+        case QueryNode::Type::Term:
+            return std::make_unique<TermIterator>(postingsOf(node.words[0]));
+
+        case QueryNode::Type::Phrase:
+            return std::make_unique<PhraseIterator>(compile.planPhrase(node.words));
+
+        case QueryNode::Type::Near: {
+            std::vector<PostingsPtr> lists;
+            for (const auto& word : node.words)
+                lists.push_back(postingsOf(word));
+            return std::make_unique<ProximityIterator>(std::move(lists), node.slop, node.ordered);
+        }
+
+        case QueryNode::Type::Not:
+            return std::make_unique<AndNotIterator>(std::make_unique<AllDocsIterator>(ctx),
+                compileNode(*node.children[0], compile));
+
+        case QueryNode::Type::Or: {
+            std::vector<DocIteratorPtr> operands;
+            for (const auto& child : node.children)
+                operands.push_back(compileNode(*child, compile));
+            return std::make_unique<OrIterator>(std::move(operands));
+        }
+
+        case QueryNode::Type::And: {
+            // NOT operands of a conjunction become exclusions instead of full-corpus scans
+            std::vector<DocIteratorPtr> required, excluded;
+            for (const auto& child : node.children) {
+                if (child->type == QueryNode::Type::Not)
+                    excluded.push_back(compileNode(*child->children[0], compile));
+                else
+                    required.push_back(compileNode(*child, compile));
+            }
+            DocIteratorPtr base;
+            if (required.empty())
+                base = std::make_unique<AllDocsIterator>(ctx);
+            else if (required.size() == 1)
+                base = std::move(required[0]);
+            else
+                base = std::make_unique<AndIterator>(std::move(required));
+
+            if (excluded.empty())
+                return base;
+            DocIteratorPtr exclusion = excluded.size() == 1 ? std::move(excluded[0])
+                : std::make_unique<OrIterator>(std::move(excluded));
+            return std::make_unique<AndNotIterator>(std::move(base), std::move(exclusion));
+        }
+        }
+        throw std::invalid_argument("Unknown query node");
+    }
+}
+
+DocIteratorPtr QueryEngine::compile(const QueryNode& node, const PostingLookup& lookup, const PhrasePlanner& planPhrase,
+    const ScoringContext& ctx)
+{
+    CompileContext compile{ {}, lookup, planPhrase, ctx };
+    return compileNode(node, compile);
+}
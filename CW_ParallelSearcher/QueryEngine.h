@@ -0,0 +1,164 @@
+#pragma once
+#include "ConcurrentHashMap.h"
+#include "DocumentStats.h"
+#include <memory>
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#define MAX_PROXIMITY_SLOP 1000
+
+using Postings = ConcurrentHashMap::PostingList;      // sorted by (fileID, wordPosition)
+using PostingsPtr = std::shared_ptr<const Postings>;
+
+// Parsed form of a /search?q= query.
+//   query   := or
+//   or      := and ( OR and )*
+//   and     := not ( [AND] not )*      adjacent operands are ANDed implicitly
+//   not     := NOT not | near
+//   near    := primary ( NEAR/k primary )*  |  primary ( ONEAR/k primary )*
+//   primary := ( query ) | "quoted phrase" | word
+// Operators are recognised only in upper case; anything inside quotes is a phrase.
+// NEAR/k matches when all its words occur, in any order, with at most k other words
+// between the first and the last of them; ONEAR/k additionally requires them in order.
+struct QueryNode {
+    enum class Type { Term, Phrase, And, Or, Not, Near };
+
+    Type type;
+    std::vector<std::string> words;                    // Term: one word, Phrase / Near: words in order
+    std::vector<std::unique_ptr<QueryNode>> children;  // And / Or: operands, Not: the negated operand
+    uint32_t slop = 0;                                 // Near: k
+    bool ordered = false;                              // Near: ONEAR
+
+    explicit QueryNode(Type type) : type(type) {}
+    std::string toString() const;
+};
+
+struct ScoringContext {
+    const DocumentStats::ReadView& stats;
+    size_t documentCount;
+    double averageLength;
+};
+
+// Document-at-a-time iterator over files matching a (sub)query, in ascending fileID order.
+// Iterators are positioned on their first match as soon as they are built and only move
+// forward, so evaluation touches no more documents than the caller asks for.
+class DocIterator
+{
+public:
+    static constexpr uint32_t NO_MORE_DOCS = UINT32_MAX;
+
+    virtual ~DocIterator() = default;
+
+    virtual uint32_t doc() const = 0;
+    // Moves to the first matching file >= target and returns it.
+    virtual uint32_t advance(uint32_t target) = 0;
+    uint32_t next() { return doc() == NO_MORE_DOCS ? NO_MORE_DOCS : advance(doc() + 1); }
+
+    // The following describe the current document.
+    virtual double score(const ScoringContext& ctx) const = 0;
+    virtual uint32_t hits() const = 0;
+    virtual uint32_t firstByteOffset() const = 0;
+
+    // Upper bound of matching documents, used to order conjunctions.
+    virtual size_t cost() const = 0;
+};
+using DocIteratorPtr = std::unique_ptr<DocIterator>;
+
+// One posting list of a phrase plan: a word, or a word pair from the bigram index,
+// expected 'offset' positions after the start of the phrase.
+struct PhrasePart {
+    PostingsPtr postings;
+    uint32_t offset;
+    uint32_t words = 1;
+};
+
+// Exact phrase: part i must sit at position p + offset_i. Keeps the matches of the current
+// document so callers that need every occurrence can read them.
+class PhraseIterator final : public DocIterator
+{
+public:
+    struct Match {
+        uint32_t fileID;
+        uint32_t wordPosition; // position of the first phrase word
+        uint32_t byteOffset;
+    };
+
+    // word i at offset i
+    explicit PhraseIterator(std::vector<PostingsPtr> postings);
+    // parts sorted by offset; the first one should start the phrase (offset 0)
+    explicit PhraseIterator(std::vector<PhrasePart> parts);
+
+    uint32_t doc() const override { return current; }
+    uint32_t advance(uint32_t target) override;
+    double score(const ScoringContext& ctx) const override;
+    uint32_t hits() const override { return static_cast<uint32_t>(currentMatches.size()); }
+    uint32_t firstByteOffset() const override { return currentMatches.front().byteOffset; }
+    size_t cost() const override { return minFiles; }
+
+    const std::vector<Match>& matches() const { return currentMatches; }
+    uint32_t wordCount() const { return words; }
+
+private:
+    std::vector<PostingsPtr> postings;
+    std::vector<uint32_t> offsets;
+    uint32_t words = 0;
+    std::vector<size_t> cursors;
+    std::vector<Match> currentMatches;
+    std::vector<size_t> fileCounts; // document frequency of each word
+    size_t minFiles = 0;
+    uint32_t current = 0;
+};
+
+// Words within a window of the same document: slop extra positions, ordered or not.
+// Each window is found with a sliding-window merge over the positions of all words in
+// the current document, so no per-word phrase query is run.
+class ProximityIterator final : public DocIterator
+{
+public:
+    ProximityIterator(std::vector<PostingsPtr> postings, uint32_t slop, bool ordered);
+
+    uint32_t doc() const override { return current; }
+    uint32_t advance(uint32_t target) override;
+    double score(const ScoringContext& ctx) const override;
+    uint32_t hits() const override { return windows; }
+    uint32_t firstByteOffset() const override { return firstOffset; }
+    size_t cost() const override { return minFiles; }
+
+private:
+    uint32_t countOrdered(uint32_t file);
+    uint32_t countUnordered(uint32_t file);
+
+    std::vector<PostingsPtr> postings;
+    std::vector<size_t> cursors;
+    std::vector<size_t> fileCounts;
+    size_t minFiles = 0;
+    uint32_t slop;
+    bool ordered;
+    uint32_t windows = 0;
+    uint32_t firstOffset = 0;
+    uint32_t current = 0;
+};
+
+class QueryEngine
+{
+public:
+    // Splits raw query text into cleaned index words.
+    using Analyzer = std::function<std::vector<std::string>(const std::string&)>;
+    // Returns the sorted postings of a cleaned word.
+    using PostingLookup = std::function<PostingsPtr(const std::string&)>;
+    // Chooses the posting lists that answer a phrase of cleaned words.
+    using PhrasePlanner = std::function<std::vector<PhrasePart>(const std::vector<std::string>&)>;
+
+    QueryEngine() = delete;
+
+    // Throws std::invalid_argument on malformed queries.
+    static std::unique_ptr<QueryNode> parse(const std::string& query, const Analyzer& analyze);
+    static DocIteratorPtr compile(const QueryNode& node, const PostingLookup& lookup, const PhrasePlanner& planPhrase,
+        const ScoringContext& ctx);
+
+    // Index of the first posting at or after 'from' whose file is >= fileID.
+    static size_t seekFile(const Postings& postings, size_t from, uint32_t fileID);
+    // Moves every cursor to the first file >= fileID present in all lists; NO_MORE_DOCS if none.
+    static uint32_t alignFiles(const std::vector<PostingsPtr>& postings, std::vector<size_t>& cursors, uint32_t fileID);
+};
@@ -0,0 +1,24 @@
+#pragma once
+#include <cmath>
+#include <cstdint>
+#define BM25_K1 1.2
+#define BM25_B 0.75
+
+// Okapi BM25 building blocks.
+namespace Ranking
+{
+    // Probabilistic IDF, floored at zero by the +1 inside the log.
+    inline double idf(size_t documentFrequency, size_t documentCount) {
+        double df = static_cast<double>(documentFrequency);
+        double n = static_cast<double>(documentCount);
+        return std::log(1.0 + (n - df + 0.5) / (df + 0.5));
+    }
+
+    // Score contribution of a term (or a whole phrase, using its occurrences as tf)
+    // with frequency tf in a document of docLength tokens.
+    inline double bm25(uint32_t tf, double idf, uint32_t docLength, double averageLength) {
+        double norm = averageLength > 0.0 ? docLength / averageLength : 1.0;
+        double freq = static_cast<double>(tf);
+        return idf * freq * (BM25_K1 + 1.0) / (freq + BM25_K1 * (1.0 - BM25_B + BM25_B * norm));
+    }
+}
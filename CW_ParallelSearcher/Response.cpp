@@ -18,6 +18,11 @@ Response Response::BadRequest(const std::string& msg)
     return Response(Type::BadRequest, msg);
 }
 
+Response Response::Forbidden(const std::string& msg)
+{
+    return Response(Type::Forbidden, msg);
+}
+
 Response Response::NotFound(const std::string& msg)
 {
     return Response(Type::NotFound, msg);
@@ -40,7 +45,7 @@ std::string Response::toHttpString() const
         ss << "Content-Type: " << contentType << "\r\n";
     }
     ss << "Access-Control-Allow-Origin: *\r\n";
-    ss << "Access-Control-Allow-Methods: GET, POST, OPTIONS\r\n";
+    ss << "Access-Control-Allow-Methods: GET, POST, PUT, DELETE, OPTIONS\r\n";
     ss << "Access-Control-Allow-Headers: Content-Type\r\n";
     ss << "Connection: close\r\n";
 
@@ -8,6 +8,7 @@ public:
     enum class Type {
         Ok = 200,
         BadRequest = 400,
+        Forbidden = 403,
         NotFound = 404,
         InternalError = 500
     };
@@ -21,6 +22,7 @@ private:
         static const std::unordered_map<Type, std::string> map = {
             { Type::Ok,            "OK" },
             { Type::BadRequest,    "Bad Request" },
+            { Type::Forbidden,     "Forbidden" },
             { Type::NotFound,      "Not Found" },
             { Type::InternalError, "Internal Server Error" }
         };
@@ -37,6 +39,8 @@ public:
 
     static Response BadRequest(const std::string& msg = "Bad Request");
 
+    static Response Forbidden(const std::string& msg = "Forbidden");
+
     static Response NotFound(const std::string& msg = "Not Found");
 
     static Response InternalServerError(const std::string& msg = "Internal Server Error");
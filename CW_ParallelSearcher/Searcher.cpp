@@ -1,194 +1,1210 @@
 #include "Searcher.h"
 #include <regex>
+#include <queue>
+#include <sstream>
+#include <iterator>
 
-Searcher::Searcher(std::shared_ptr<ThreadPool> threadPool) : threadPool(threadPool), fileCount(0)
+// at most half the pool indexes, so searches keep workers during a bulk load
+Searcher::Searcher(std::shared_ptr<ThreadPool> threadPool)
+    : threadPool(threadPool), ingestQueue(threadPool->size() / 2), fileCount(0)
 {
+    FileManager::SetIdTaken([this](uint64_t fileID) { ingestQueue.reserve(fileID); });
 	FileManager::Initialize();
-    filesToAdd = FileManager::GetAllFileIds();
-	threadPool->enqueue([this]() { this->batchUpdate(); });
+    ingestQueue.push(FileManager::GetAllFileIds());
+    registerMetrics();
+    ingestThread = std::thread([this]() { this->dispatchIngest(); });
+    compactionThread = std::thread([this]() { this->runCompaction(); });
 }
 
 Searcher::~Searcher()
 {
+    stopUpdate();
+}
+
+void Searcher::stopUpdate()
+{
+    FileManager::SetIdTaken(nullptr);
+    ingestQueue.stop();
+    if (ingestThread.joinable())
+        ingestThread.join();
+    {
+        std::lock_guard<std::mutex> lock(compactionMutex);
+        stopCompaction = true;
+    }
+    compactionWake.notify_all();
+    if (compactionThread.joinable())
+        compactionThread.join();
+    // postings die with the process; deleted files must not come back at the next start
+    FileManager::PurgeRemovedFiles();
 }
 
 void Searcher::AddFile(const uint64_t fileID)
 {
-	std::lock_guard<std::mutex> lock(fileAddMutex);
-	filesToAdd.push_back(fileID);
+    ingestQueue.push(fileID);
 }
 
-struct MatchedLocation {
-    uint64_t fileID;
-    size_t wordPositionW1;
-    size_t wordPositionW2;
-};
+void Searcher::AbandonFile(const uint64_t fileID)
+{
+    ingestQueue.abandon(fileID);
+}
+
+bool Searcher::WaitIndexed(uint64_t fileID, std::chrono::milliseconds timeout)
+{
+    return ingestQueue.waitIndexed(fileID, timeout);
+}
+
+void Searcher::registerMetrics()
+{
+    auto& metrics = Metrics::instance();
+    const char* stageHelp = "Time spent in each stage of a search";
+    lookupStage = metrics.histogram("search_stage_duration_seconds", stageHelp, "stage=\"lookup\"");
+    intersectStage = metrics.histogram("search_stage_duration_seconds", stageHelp, "stage=\"intersect\"");
+    snippetStage = metrics.histogram("search_stage_duration_seconds", stageHelp, "stage=\"snippet\"");
+    verifyStage = metrics.histogram("search_stage_duration_seconds", stageHelp, "stage=\"verify\"");
+    truncatedSearches = metrics.counter("search_truncated_total",
+        "Searches cut short by their deadline or by the client disconnecting");
+    filesIndexed = metrics.counter("ingest_files_indexed_total", "Files added to the index");
+    wordsIndexed = metrics.counter("ingest_words_indexed_total", "Word occurrences added to the index");
+    appendsIndexed = metrics.counter("ingest_appends_total", "Appends to indexed files");
+    filesDeleted = metrics.counter("index_files_deleted_total", "Files deleted or replaced");
+    compactionRuns = metrics.counter("index_compactions_total", "Compactions that dropped postings of deleted files");
+    postingsPurged = metrics.counter("index_postings_purged_total", "Postings of deleted files dropped by compaction");
+
+    gauges.push_back(metrics.gauge("index_postings", "Word occurrences in the index",
+        [this]() { return static_cast<double>(hashTable.size()); }));
+    gauges.push_back(metrics.gauge("index_bigram_postings", "Stopword bigram occurrences in the index",
+        [this]() { return static_cast<double>(pairTable.size()); }));
+    gauges.push_back(metrics.gauge("index_frequent_pairs_ready", "1 once phrases of frequent words use the bigram index",
+        [this]() { return readyFrequentTerms() ? 1.0 : 0.0; }));
+    gauges.push_back(metrics.gauge("index_trigrams", "Distinct trigrams in the substring index",
+        [this]() { return static_cast<double>(trigramIndex.size()); }));
+    gauges.push_back(metrics.gauge("index_deleted_documents", "Files deleted since the start",
+        [this]() { return static_cast<double>(deletedDocuments.size()); }));
+    gauges.push_back(metrics.gauge("index_awaiting_compaction", "Deleted files whose postings are not dropped yet",
+        [this]() {
+            std::lock_guard<std::mutex> lock(compactionMutex);
+            return static_cast<double>(awaitingCompaction.size());
+        }));
+    gauges.push_back(metrics.gauge("index_documents", "Files in the index",
+        [this]() { return static_cast<double>(documentStats.documentCount()); }));
+    gauges.push_back(metrics.gauge("ingest_pending_files", "Files queued and not handed to the thread pool yet",
+        [this]() { return static_cast<double>(ingestQueue.queued()); }));
+    gauges.push_back(metrics.gauge("ingest_indexing_files", "Files handed to the thread pool and not indexed yet",
+        [this]() { return static_cast<double>(ingestQueue.indexing()); }));
+    gauges.push_back(metrics.gauge("ingest_lag_seconds", "Age of the oldest queued file",
+        [this]() { return ingestQueue.lagSeconds(); }));
+    gauges.push_back(metrics.gauge("ingest_indexed_up_to", "Highest fileID up to which every added file is indexed",
+        [this]() { return static_cast<double>(ingestQueue.indexedUpTo()); }));
+}
+
+bool Searcher::SearchOptions::parseCursor(const std::string& cursor)
+{
+    // position order: "<fileID>:<wordPosition>" or "<fileID>" for whole files,
+    // relevance order: "r:<score>:<fileID>"
+    bool rankedCursor = cursor.rfind("r:", 0) == 0;
+    if (rankedCursor != (order == Order::Relevance))
+        return false;
+    std::string body = rankedCursor ? cursor.substr(2) : cursor;
+    auto sep = body.find(':');
+    if (sep == std::string::npos && !rankedCursor) {
+        body += ":" + std::to_string(UINT32_MAX);
+        sep = body.find(':');
+    }
+    if (sep == std::string::npos)
+        return false;
+    try {
+        if (rankedCursor) {
+            afterScore = std::stod(body.substr(0, sep));
+            afterFileID = static_cast<uint32_t>(std::stoul(body.substr(sep + 1)));
+        }
+        else {
+            afterFileID = static_cast<uint32_t>(std::stoul(body.substr(0, sep)));
+            afterWordPosition = static_cast<uint32_t>(std::stoul(body.substr(sep + 1)));
+        }
+    }
+    catch (...) {
+        return false;
+    }
+    hasAfter = true;
+    return true;
+}
+
+std::string Searcher::SearchOptions::key() const
+{
+    static const char* modes[] = { "", "c/", "f/" };
+    std::string key = modes[static_cast<int>(mode)] + std::string(order == Order::Relevance ? "r/" : "p/") +
+        std::to_string(limit) + "/" + std::to_string(offset);
+    if (hasAfter) {
+        key += "/" + std::to_string(afterFileID) + ":" + std::to_string(afterWordPosition);
+        if (order == Order::Relevance) {
+            // as precise as the cursor, or cursors a few ulps apart would share a page
+            std::ostringstream score;
+            score.precision(17);
+            score << afterScore;
+            key += ":" + score.str();
+        }
+    }
+    return key;
+}
 
 using WordLocation = ConcurrentHashMap::WordLocation;
-using WordLocations = std::vector<WordLocation>;
-WordLocations intersectDocIndices(const WordLocations& currentResults, const WordLocations& nextWordDocs)
+using WordLocations = ConcurrentHashMap::PostingList;
+
+std::vector<std::string> Searcher::analyze(const std::string& text)
+{
+    Tokenizer tokenizer;
+    std::vector<std::string> words;
+    for (const auto& token : tokenizer.tokenize(text)) {
+        words.emplace_back(token.word);
+        // "term*" asks for prefix expansion
+        bool prefix = text[token.byteOffset + token.rawLength - 1] == '*';
+        if (prefix && !words.back().empty())
+            words.back() += '*';
+    }
+    return words;
+}
+
+PostingsPtr Searcher::sortedPostings(const std::string& word, const Deadline& deadline)
+{
+    Metrics::ScopedTimer timer(lookupStage);
+    if (word.size() > 1 && word.back() == '*') {
+        // the most frequent expansions only, so a short prefix cannot pull in the whole vocabulary
+        auto postings = std::make_shared<WordLocations>();
+        for (const auto& entry : termDictionary.withPrefix(word.substr(0, word.size() - 1), PREFIX_EXPANSION_LIMIT)) {
+            // each merge rewrites the list so far: read the clock before every one
+            if (deadline.expiredNow())
+                break;
+            auto expansion = hashTable.snapshot(entry.term);
+            if (!expansion)
+                continue;
+            size_t middle = postings->size();
+            postings->insert(postings->end(), expansion->begin(), expansion->end());
+            std::inplace_merge(postings->begin(), postings->begin() + middle, postings->end());
+        }
+        postings->countFiles();
+        return withoutDeleted(postings, deadline);
+    }
+    return withoutDeleted(hashTable.snapshot(word), deadline);
+}
+
+// The shared snapshot itself unless it holds a deleted file, which only happens between a
+// delete and the compaction that purges it.
+PostingsPtr Searcher::withoutDeleted(PostingsPtr postings, const Deadline& deadline) const
+{
+    if (!postings)
+        return std::make_shared<const WordLocations>();
+    auto deleted = [this](const WordLocation& location) { return deletedDocuments.contains(location.fileID); };
+    if (deletedDocuments.size() == 0 || std::none_of(postings->begin(), postings->end(), deleted))
+        return postings;
+    auto kept = std::make_shared<WordLocations>();
+    kept->reserve(postings->size());
+    for (size_t i = 0; i < postings->size(); ++i) {
+        const WordLocation& location = (*postings)[i];
+        // stops at a file boundary, so the list holds whole files
+        if ((i == 0 || (*postings)[i - 1].fileID != location.fileID) && deadline.expired())
+            break;
+        if (!deleted(location))
+            kept->push_back(location);
+    }
+    kept->countFiles();
+    return kept;
+}
+
+PostingsPtr Searcher::sortedPairPostings(const std::string& first, const std::string& second, const Deadline& deadline)
+{
+    Metrics::ScopedTimer timer(lookupStage);
+    return withoutDeleted(pairTable.snapshot(first + ' ' + second), deadline);
+}
+
+// Covers the phrase left to right: a pair that the bigram index holds (one with a stopword
+// in it, or two frequent words) becomes one part, any other word its own part. Prefix
+// words ("term*") have no bigrams; a stopword next to one is left unconstrained.
+std::vector<PhrasePart> Searcher::planPhrase(const std::vector<std::string>& words, const Deadline& deadline)
+{
+    std::vector<PhrasePart> parts;
+    auto frequent = readyFrequentTerms();
+    auto pairIndexed = [this, &frequent](const std::string& first, const std::string& second) {
+        auto isPrefix = [](const std::string& word) { return word.size() > 1 && word.back() == '*'; };
+        if (isPrefix(first) || isPrefix(second))
+            return false;
+        return isStopword(first) || isStopword(second) || (frequent && isFrequentPair(*frequent, first, second));
+    };
+    for (size_t i = 0; i < words.size() && !deadline.expiredNow();) {
+        const std::string& word = words[i];
+        if (i + 1 < words.size() && pairIndexed(word, words[i + 1])) {
+            parts.push_back({ sortedPairPostings(word, words[i + 1], deadline), static_cast<uint32_t>(i), 2 });
+            i += 2;
+        }
+        else if (i > 0 && pairIndexed(words[i - 1], word)) {
+            // last of an odd run: pair it with the word before, which is already covered
+            parts.push_back({ sortedPairPostings(words[i - 1], word, deadline), static_cast<uint32_t>(i - 1), 2 });
+            ++i;
+        }
+        else {
+            if (!isStopword(word))
+                parts.push_back({ sortedPostings(word, deadline), static_cast<uint32_t>(i) });
+            ++i;
+        }
+    }
+    std::stable_sort(parts.begin(), parts.end(), [](const PhrasePart& a, const PhrasePart& b) { return a.offset < b.offset; });
+    return parts;
+}
+
+std::vector<TermDictionary::Entry> Searcher::Suggest(const std::string& prefix, size_t limit)
+{
+    std::string cleanPrefix = Tokenizer::clean(prefix);
+    if (cleanPrefix.empty())
+        return {};
+    return termDictionary.withPrefix(cleanPrefix, limit);
+}
+
+// The deadline passed while the posting lists were gathered: nothing was matched yet.
+static Searcher::SearchPage truncatedPage()
+{
+    Searcher::SearchPage page;
+    page.truncated = true;
+    page.totalExact = false;
+    return page;
+}
+
+Searcher::SearchPagePtr Searcher::runShared(const std::string& key, const SearchOptions& options,
+    const std::function<SearchPage()>& compute)
+{
+    auto page = inFlightSearches.run(key + '\n' + options.key(), compute);
+    // callers that joined a leader whose deadline was shorter would otherwise all
+    // recompute at once; the first of them runs the retry and the rest wait for it
+    if (page->truncated && !options.deadline.expiredNow())
+        page = inFlightSearches.run("retry\n" + key + '\n' + options.key(), compute);
+    if (page->truncated)
+        Metrics::instance().add(truncatedSearches);
+    return page;
+}
+
+Searcher::SearchPagePtr Searcher::SearchPhrase(const std::string& phrase, const SearchOptions& options)
+{
+    auto words = analyze(phrase);
+    if (words.empty())
+        return std::make_shared<const SearchPage>();
+
+    std::string normalizedPhrase;
+    for (const auto& word : words)
+        normalizedPhrase += word + ' ';
+
+    // identical requests arriving together share one lookup and one round of snippet reads
+    return runShared("phrase\n" + normalizedPhrase, options,
+        [this, &words, &options]() {
+            PhraseIterator phrase(planPhrase(words, options.deadline));
+            if (options.deadline.expired())
+                return truncatedPage();
+            if (options.mode != SearchOptions::Mode::Results)
+                return countMatches(phrase, options);
+
+            DocumentStats::ReadView stats(documentStats);
+            ScoringContext ctx{ stats, std::max<size_t>(documentStats.documentCount(), 1), documentStats.averageLength() };
+            if (options.order == SearchOptions::Order::Relevance)
+                return rankFiles(phrase, ctx, options, phrase.wordCount());
+            return collectPhraseMatches(phrase, ctx, options);
+        });
+}
+
+Searcher::SearchPagePtr Searcher::SearchQuery(const std::string& query, const SearchOptions& options)
+{
+    // throws std::invalid_argument for malformed queries
+    std::shared_ptr<const QueryNode> root = QueryEngine::parse(query,
+        [this](const std::string& text) { return this->analyze(text); });
+
+    return runShared("query\n" + root->toString(), options,
+        [this, &root, &options]() {
+            DocumentStats::ReadView stats(documentStats);
+            ScoringContext ctx{ stats, std::max<size_t>(documentStats.documentCount(), 1), documentStats.averageLength() };
+            auto matcher = QueryEngine::compile(*root,
+                [this, &options](const std::string& word) { return this->sortedPostings(word, options.deadline); },
+                [this, &options](const std::vector<std::string>& words) { return this->planPhrase(words, options.deadline); }, ctx);
+            if (options.deadline.expired())
+                return truncatedPage();
+            if (options.mode != SearchOptions::Mode::Results)
+                return countMatches(*matcher, options);
+            if (options.order == SearchOptions::Order::Relevance)
+                return rankFiles(*matcher, ctx, options, 1);
+            return collectFiles(*matcher, ctx, options);
+        });
+}
+
+Searcher::SearchPagePtr Searcher::Grep(const std::string& pattern, bool ignoreCase, const SearchOptions& options)
 {
-    std::unordered_map<uint64_t, std::vector<const WordLocation*>> map1;
-    std::unordered_map<uint64_t, std::vector<size_t>> map2;
+    auto flags = std::regex::ECMAScript | std::regex::optimize;
+    if (ignoreCase)
+        flags |= std::regex::icase;
+    std::regex regex;
+    try {
+        regex = std::regex(pattern, flags);
+    }
+    catch (const std::regex_error& ex) {
+        throw std::invalid_argument(std::string("Invalid pattern: ") + ex.what());
+    }
+
+    return runShared("grep\n" + std::string(ignoreCase ? "i" : "") + '\n' + pattern, options,
+        [this, &pattern, &regex, &options]() {
+            SearchPage page;
+            const size_t needed = options.offset + options.limit + 1;
+            const uint32_t startFile = options.hasAfter ? options.afterFileID : 0;
+
+            TrigramIndex::FileIDs files;
+            {
+                Metrics::ScopedTimer timer(lookupStage);
+                if (!trigramIndex.candidates(TrigramIndex::compile(pattern), files)) {
+                    // no literal to narrow by: every stored file is a candidate
+                    for (uint64_t fileID : FileManager::GetAllFileIds())
+                        files.push_back(static_cast<uint32_t>(fileID));
+                    std::sort(files.begin(), files.end());
+                }
+                files.erase(std::remove_if(files.begin(), files.end(),
+                    [this](uint32_t fileID) { return deletedDocuments.contains(fileID); }), files.end());
+            }
+            auto first = std::lower_bound(files.begin(), files.end(), startFile);
 
-    for (const auto& loc : currentResults)
-        map1[loc.fileID].push_back(&loc);
+            std::vector<Snippets::Hit> matches;
+            size_t scannedFiles = 0;
+            {
+                Metrics::ScopedTimer timer(verifyStage);
+                for (auto file = first; file != files.end() && matches.size() < needed && !page.truncated; ++file) {
+                    if (options.deadline.expired()) {
+                        page.truncated = true;
+                        break;
+                    }
+                    ++scannedFiles;
+                    // read a block at a time too, so a compressed file is never decoded whole
+                    auto reader = FileManager::OpenText(*file);
+                    const uint64_t textSize = reader.size();
+                    // a regex search cannot be interrupted, so it runs a block at a time; matches
+                    // starting in the overlap are left to the next block
+                    for (uint64_t blockBegin = 0; blockBegin < textSize && matches.size() < needed;) {
+                        if (blockBegin != 0 && options.deadline.expiredNow()) {
+                            page.truncated = true;
+                            break;
+                        }
+                        uint64_t blockLimit = std::min<uint64_t>(textSize, blockBegin + GREP_SCAN_BLOCK);
+                        uint64_t windowLimit = std::min<uint64_t>(textSize, blockLimit + GREP_SCAN_OVERLAP);
+                        uint64_t base;
+                        std::string_view window = reader.read(blockBegin ? blockBegin - 1 : 0, windowLimit, &base);
+                        if (base + window.size() < windowLimit)
+                            break; // a block that does not decode
+                        const char* block = window.data() + (blockBegin - base);
+                        const char* blockEnd = window.data() + (blockLimit - base);
+                        const char* windowEnd = window.data() + (windowLimit - base);
+                        // ^ and \b see the character before the window, $ only matches at the end of the file
+                        auto flags = std::regex_constants::match_default;
+                        if (blockBegin != 0)
+                            flags |= std::regex_constants::match_prev_avail;
+                        if (windowLimit != textSize)
+                            flags |= std::regex_constants::match_not_eol;
+                        uint64_t next = blockLimit;
+                        for (std::cregex_iterator it(block, windowEnd, regex, flags), end; it != end; ++it) {
+                            const char* match = block + it->position();
+                            if (match >= blockEnd)
+                                break;
+                            if (options.deadline.expired()) {
+                                page.truncated = true;
+                                break;
+                            }
+                            uint32_t offset = static_cast<uint32_t>(base + (match - window.data()));
+                            next = std::max<uint64_t>(blockLimit, offset + it->length());
+                            if (options.hasAfter && *file == options.afterFileID && offset <= options.afterWordPosition)
+                                continue;
+                            matches.push_back({ *file, offset, static_cast<uint32_t>(it->length()) });
+                            if (matches.size() >= needed)
+                                break;
+                        }
+                        if (page.truncated)
+                            break;
+                        blockBegin = next;
+                    }
+                }
+            }
 
-    for (const auto& loc : nextWordDocs)
-        map2[loc.fileID].push_back(loc.wordPosition);
+            bool stoppedEarly = matches.size() >= needed;
+            size_t candidateFiles = files.end() - first;
+            page.totalExact = !stoppedEarly && !page.truncated && !options.hasAfter;
+            page.totalHits = (stoppedEarly || page.truncated) && scannedFiles > 0
+                ? std::max(matches.size(), matches.size() * candidateFiles / scannedFiles)
+                : matches.size();
 
-    for (auto& [file, positions] : map1)
-        std::sort(positions.begin(), positions.end(),
-            [](const WordLocation* a, const WordLocation* b) { return a->wordPosition < b->wordPosition; });
+            size_t pageEnd = std::min(matches.size(), options.offset + options.limit);
+            if (pageEnd > options.offset)
+                addResults(page, std::vector<Snippets::Hit>(matches.begin() + options.offset, matches.begin() + pageEnd), options.deadline);
+            if ((matches.size() > pageEnd || page.truncated) && pageEnd > options.offset) {
+                const auto& last = matches[pageEnd - 1];
+                page.nextCursor = std::to_string(last.fileID) + ":" + std::to_string(last.byteOffset);
+            }
+            return page;
+        });
+}
+
+// Files are visited in fileID order, so when a scan stops early the total is extrapolated
+// from how much of the fileID range it covered.
+static size_t estimateTotal(size_t found, uint32_t firstFile, uint32_t lastScanned, uint32_t maxFile)
+{
+    if (lastScanned <= firstFile || maxFile <= firstFile)
+        return found;
+    double covered = static_cast<double>(lastScanned - firstFile + 1) / (maxFile - firstFile + 1);
+    return std::max(found, static_cast<size_t>(found / covered));
+}
 
-    for (auto& [file, positions] : map2)
-        std::sort(positions.begin(), positions.end());
+void Searcher::addResults(SearchPage& page, const std::vector<Snippets::Hit>& hits, const Deadline& deadline)
+{
+    Metrics::ScopedTimer timer(snippetStage);
+    auto snippets = Snippets::extract(hits, PART_SIZE, deadline);
+    for (size_t i = 0; i < hits.size(); ++i) {
+        if (!snippets[i].cut)
+            page.truncated = true; // the hit is still returned, without its text
+        page.results.emplace_back(SearchResult(hits[i].fileID, FileManager::getFileName(hits[i].fileID), snippets[i].text));
+        page.results.back().highlights = std::move(snippets[i].highlights);
+    }
+}
 
-    WordLocations results;
+Searcher::SearchPage Searcher::collectPhraseMatches(PhraseIterator& phrase, const ScoringContext& ctx, const SearchOptions& options)
+{
+    SearchPage page;
 
-    //      
-    for (auto& [file, positions1] : map1) {
-        auto it2 = map2.find(file);
-        if (it2 == map2.end()) continue;
-        auto& positions2 = it2->second;
+    // stop as soon as the page plus one extra match (to know whether a next page exists) is filled
+    const size_t needed = options.offset + options.limit + 1;
+    const uint32_t startFile = options.hasAfter ? options.afterFileID : 0;
 
-        size_t i = 0, j = 0;
-        while (i < positions1.size() && j < positions2.size()) {
-            if (positions1[i]->wordPosition + 1 == positions2[j]) {
-                results.push_back(WordLocation(file, positions1[i]->byteOffset, positions2[j]));
-                ++i; ++j;
+    std::vector<PhraseIterator::Match> matches;
+    bool stoppedEarly = false;
+    uint32_t lastFile = startFile;
+    {
+        Metrics::ScopedTimer timer(intersectStage);
+        for (uint32_t file = phrase.advance(startFile); file != DocIterator::NO_MORE_DOCS; file = phrase.next()) {
+            if (options.deadline.expired()) {
+                page.truncated = true;
+                break;
             }
-            else if (positions1[i]->wordPosition + 1 < positions2[j]) {
-                ++i;
+            lastFile = file;
+            for (const auto& match : phrase.matches()) {
+                if (options.hasAfter && file == options.afterFileID && match.wordPosition <= options.afterWordPosition)
+                    continue;
+                matches.push_back(match);
             }
-            else {
-                ++j;
+            if (matches.size() >= needed) {
+                stoppedEarly = true;
+                break;
             }
         }
     }
 
-    return results;
+    page.totalExact = !stoppedEarly && !page.truncated && !options.hasAfter;
+    page.totalHits = stoppedEarly || page.truncated ? estimateTotal(matches.size(), startFile, lastFile, ctx.stats.maxFileID())
+        : matches.size();
+
+    size_t pageEnd = std::min(matches.size(), options.offset + options.limit);
+    std::vector<Snippets::Hit> hits;
+    for (size_t i = options.offset; i < pageEnd; ++i)
+        hits.push_back({ matches[i].fileID, matches[i].byteOffset, 0, phrase.wordCount() });
+    ctx.stats.release();
+    addResults(page, hits, options.deadline);
+    if ((matches.size() > pageEnd || page.truncated) && pageEnd > options.offset) {
+        const auto& last = matches[pageEnd - 1];
+        page.nextCursor = std::to_string(last.fileID) + ":" + std::to_string(last.wordPosition);
+    }
 
+    return page;
 }
 
-std::vector<Searcher::SearchResult> Searcher::SearchPhrase(const std::string& phrase)
+Searcher::SearchPage Searcher::collectFiles(DocIterator& matcher, const ScoringContext& ctx, const SearchOptions& options)
 {
-    std::vector<SearchResult> results;
-
-    auto words = splitString(phrase);
-	for(auto& word : words) {
-        word.first = CleanWordForIndexing(word.first);
-	}
-    if (words.empty())
-        return results;
+    SearchPage page;
 
-    auto currentMatches = hashTable.find(words[0].first.c_str());
+    // only the files of the requested page are materialized; the iterator is never run further
+    const size_t needed = options.offset + options.limit + 1;
+    const uint32_t startFile = options.hasAfter ? options.afterFileID + 1 : 0;
 
-    for (size_t i = 1; i < words.size(); ++i)
+    std::vector<std::pair<uint32_t, uint32_t>> files; // fileID, first byte offset
+    uint32_t lastFile = startFile;
     {
-        if (currentMatches.empty()) break;
+        Metrics::ScopedTimer timer(intersectStage);
+        for (uint32_t file = matcher.advance(startFile); file != DocIterator::NO_MORE_DOCS; file = matcher.next()) {
+            if (options.deadline.expired()) {
+                page.truncated = true;
+                break;
+            }
+            lastFile = file;
+            files.emplace_back(file, files.size() >= options.offset ? matcher.firstByteOffset() : 0);
+            if (files.size() >= needed)
+                break;
+        }
+    }
 
-        auto nextWordResults = hashTable.find(words[i].first.c_str());
+    bool stoppedEarly = files.size() >= needed;
+    page.totalExact = !stoppedEarly && !page.truncated && !options.hasAfter;
+    page.totalHits = stoppedEarly || page.truncated ? estimateTotal(files.size(), startFile, lastFile, ctx.stats.maxFileID())
+        : files.size();
 
-        currentMatches = intersectDocIndices(currentMatches, nextWordResults);
+    size_t pageEnd = std::min(files.size(), options.offset + options.limit);
+    std::vector<Snippets::Hit> hits;
+    for (size_t i = options.offset; i < pageEnd; ++i)
+        hits.push_back({ files[i].first, files[i].second });
+    ctx.stats.release();
+    addResults(page, hits, options.deadline);
+    if ((files.size() > pageEnd || page.truncated) && pageEnd > options.offset)
+        page.nextCursor = std::to_string(files[pageEnd - 1].first);
+
+    return page;
+}
+
+// Walks every matching file once; only the iterator's hit counts are used, so neither
+// snippets nor file names are read.
+Searcher::SearchPage Searcher::countMatches(DocIterator& matcher, const SearchOptions& options)
+{
+    SearchPage page;
+    const bool listFiles = options.mode == SearchOptions::Mode::Files;
+    const uint32_t startFile = options.hasAfter ? options.afterFileID + 1 : 0;
+
+    Metrics::ScopedTimer timer(intersectStage);
+    for (uint32_t file = matcher.advance(startFile); file != DocIterator::NO_MORE_DOCS; file = matcher.next()) {
+        if (options.deadline.expired()) {
+            page.truncated = true;
+            if (listFiles && page.nextCursor.empty() && !page.fileHits.empty())
+                page.nextCursor = std::to_string(page.fileHits.back().first);
+            break;
+        }
+        uint32_t hits = matcher.hits();
+        page.totalHits += hits;
+        if (listFiles && page.totalFiles >= options.offset && page.fileHits.size() < options.limit)
+            page.fileHits.emplace_back(file, hits);
+        else if (listFiles && page.fileHits.size() == options.limit && page.nextCursor.empty() && options.limit > 0)
+            page.nextCursor = std::to_string(page.fileHits.back().first);
+        ++page.totalFiles;
     }
+    page.totalExact = !page.truncated && !options.hasAfter;
+    return page;
+}
+
+struct RankedFile {
+    double score;
+    uint32_t fileID;
+    uint32_t hits;
+    uint32_t firstByteOffset;
+};
+
+// true when a ranks above b: higher score first, lower fileID breaks ties
+static bool ranksAbove(double scoreA, uint32_t fileA, double scoreB, uint32_t fileB)
+{
+    return scoreA != scoreB ? scoreA > scoreB : fileA < fileB;
+}
+
+Searcher::SearchPage Searcher::rankFiles(DocIterator& matcher, const ScoringContext& ctx, const SearchOptions& options, uint32_t highlightWords)
+{
+    SearchPage page;
+
+    // bounded min-heap: the worst of the best K files sits on top and is evicted first
+    const size_t k = options.offset + options.limit + 1;
+    auto worseFirst = [](const RankedFile& a, const RankedFile& b) {
+        return ranksAbove(a.score, a.fileID, b.score, b.fileID);
+    };
+    std::priority_queue<RankedFile, std::vector<RankedFile>, decltype(worseFirst)> topFiles(worseFirst);
 
-    for (const auto& phrasePosition : currentMatches)
     {
-        uint64_t fileID = phrasePosition.fileID;
-        const std::string& fileName = FileManager::getFileName(fileID);
-        
-        std::string textPart = FileManager::GetFilePart(fileID, phrasePosition.byteOffset, PART_SIZE);
-        results.emplace_back(SearchResult(fileID, fileName, textPart));
+        Metrics::ScopedTimer timer(intersectStage);
+        for (uint32_t file = matcher.doc(); file != DocIterator::NO_MORE_DOCS; file = matcher.next()) {
+            if (options.deadline.expired()) {
+                // ranked among the files scanned so far
+                page.truncated = true;
+                break;
+            }
+            double score = matcher.score(ctx);
+            if (options.hasAfter && !ranksAbove(options.afterScore, options.afterFileID, score, file))
+                continue;
+
+            ++page.totalHits;
+            if (topFiles.size() == k && !ranksAbove(score, file, topFiles.top().score, topFiles.top().fileID))
+                continue;
+            if (topFiles.size() == k)
+                topFiles.pop();
+            topFiles.push({ score, file, matcher.hits(), matcher.firstByteOffset() });
+        }
+    }
+    page.totalExact = !page.truncated && !options.hasAfter;
+
+    std::vector<RankedFile> ranking;
+    ranking.reserve(topFiles.size());
+    while (!topFiles.empty()) {
+        ranking.push_back(topFiles.top());
+        topFiles.pop();
+    }
+    std::reverse(ranking.begin(), ranking.end());
+
+    size_t pageEnd = std::min(ranking.size(), options.offset + options.limit);
+    std::vector<Snippets::Hit> hits;
+    for (size_t i = options.offset; i < pageEnd; ++i)
+        hits.push_back({ ranking[i].fileID, ranking[i].firstByteOffset, 0, highlightWords });
+    ctx.stats.release();
+    addResults(page, hits, options.deadline);
+    for (size_t i = options.offset; i < pageEnd; ++i) {
+        SearchResult& result = page.results[i - options.offset];
+        result.ranked = true;
+        result.score = ranking[i].score;
+        result.hits = ranking[i].hits;
+    }
+    if ((ranking.size() > pageEnd || page.truncated) && pageEnd > options.offset) {
+        const RankedFile& last = ranking[pageEnd - 1];
+        std::ostringstream cursor;
+        cursor.precision(17);
+        cursor << "r:" << last.score << ":" << last.fileID;
+        page.nextCursor = cursor.str();
     }
 
-    return results;
+    return page;
 }
 
-void Searcher::batchUpdate()
+void Searcher::dispatchIngest()
 {
-	while (!stopFlag)
-	{
-        fileAddMutex.lock();
-		for (const auto& fileID : filesToAdd)
-		{
-            threadPool->enqueue(
-                [this, fileID]() {
-                    this->loadFileContent(fileID);
+    for (auto batch = ingestQueue.nextBatch(); !batch.empty(); batch = ingestQueue.nextBatch()) {
+        try {
+            threadPool->enqueue([this, batch]() {
+                for (uint64_t fileID : batch) {
+                    // a file that cannot be read must not hold back the watermark or the batch
+                    try {
+                        this->loadFileContent(fileID);
+                    }
+                    catch (const std::exception& ex) {
+                        std::cerr << "Cannot index file " << fileID << ": " << ex.what() << std::endl;
+                        // a replacement that cannot be indexed leaves the old file in place
+                        std::lock_guard<std::mutex> lock(documentTailsMutex);
+                        auto it = pendingReplacements.find(fileID);
+                        if (it != pendingReplacements.end()) {
+                            replacing.erase(it->second);
+                            pendingReplacements.erase(it);
+                        }
+                    }
+                    ingestQueue.indexed(fileID);
                 }
-            );
-		}
-		filesToAdd.clear();
-        fileAddMutex.unlock();
-		std::this_thread::sleep_for(std::chrono::milliseconds(BATCH_UPDATE_INTERVAL_MS));
-	}
+                ingestQueue.finishBatch();
+                this->maybeChooseFrequentTerms();
+            });
+        }
+        catch (const std::runtime_error&) {
+            return; // the pool is shutting down
+        }
+    }
 }
 
-Searcher::WordTokens Searcher::splitString(const std::string& str)
+std::shared_ptr<const Searcher::TermSet> Searcher::readyFrequentTerms() const
 {
-    const std::string_view str_view(str);
-    WordTokens result;
+    return std::atomic_load(&readyTerms);
+}
 
-    result.reserve(str.length() / 5);
+void Searcher::maybeChooseFrequentTerms()
+{
+    auto frequent = std::atomic_load(&frequentTerms);
+    if (!frequent) {
+        size_t documents = documentStats.documentCount();
+        if (documents == 0 || (documents < FREQUENT_PAIR_FIRST_DOCUMENTS && !ingestQueue.idle()))
+            return;
+    }
+    else if (frequent->size() >= FREQUENT_PAIR_MAX_TERMS || indexedWordCount.load() < 2 * frequentTermsChosenAt.load()) {
+        return;
+    }
+    chooseFrequentTerms();
+}
 
-    size_t start = 0;
+void Searcher::chooseFrequentTerms()
+{
+    if (choosingFrequentTerms.exchange(true))
+        return;
+    frequentTermsChosenAt.store(indexedWordCount.load());
+    auto current = std::atomic_load(&frequentTerms);
+    auto frequent = current ? std::make_shared<TermSet>(*current) : std::make_shared<TermSet>();
+    for (const auto& [term, postings] : hashTable.largestKeys(FREQUENT_PAIR_TERMS)) {
+        if (!term.empty() && frequent->size() < FREQUENT_PAIR_MAX_TERMS)
+            frequent->insert(term);
+    }
+    if (current && frequent->size() == current->size()) {
+        choosingFrequentTerms.store(false);
+        return;
+    }
 
-    while (start < str.length())
+    // files indexed from now on use the new set; those that already have a tail are
+    // collected after it is published, so none is missed
+    std::shared_ptr<const TermSet> chosen = frequent;
+    std::atomic_store(&frequentTerms, chosen);
+    std::vector<std::pair<uint64_t, std::shared_ptr<DocumentTail>>> tails;
     {
-        size_t end = str_view.find_first_of(delimiters.data(), start);
+        std::lock_guard<std::mutex> lock(documentTailsMutex);
+        tails.assign(documentTails.begin(), documentTails.end());
+    }
+    choosingFrequentTerms.store(false);
+    if (tails.empty()) {
+        publishFrequentTerms(chosen);
+        return;
+    }
+    auto remaining = std::make_shared<std::atomic<size_t>>(tails.size());
+    for (auto& [fileID, tail] : tails) {
+        threadPool->enqueue([this, fileID = fileID, tail = tail, chosen, remaining]() {
+            try {
+                std::lock_guard<std::mutex> lock(tail->mtx);
+                if (!deletedDocuments.contains(static_cast<uint32_t>(fileID)))
+                    this->backfillFrequentPairs(fileID, *tail, chosen);
+            }
+            catch (const std::exception& ex) {
+                std::cerr << "Cannot backfill frequent pairs of file " << fileID << ": " << ex.what() << std::endl;
+            }
+            if (remaining->fetch_sub(1) == 1)
+                this->publishFrequentTerms(chosen);
+        });
+    }
+}
 
-        if (end == std::string_view::npos)
-        {
-            end = str.length();
-        }
-        if (end > start)
-        {
-            std::string_view word_view = str_view.substr(start, end - start);
-            std::string word(word_view);
-            result.push_back({ std::move(word), start });
-        }
+void Searcher::publishFrequentTerms(const std::shared_ptr<const TermSet>& frequent)
+{
+    // a backfill that finishes late must not hand the planner a smaller set back
+    std::lock_guard<std::mutex> lock(frequentTermsMutex);
+    auto ready = std::atomic_load(&readyTerms);
+    if (!ready || ready->size() < frequent->size())
+        std::atomic_store(&readyTerms, frequent);
+}
 
-        start = end + 1;
+// Posts the pairs the file lacks for a larger frequent set; the caller holds tail.mtx.
+void Searcher::backfillFrequentPairs(uint64_t fileID, DocumentTail& tail, const std::shared_ptr<const TermSet>& frequent)
+{
+    const TermSet* posted = tail.pairTerms.get();
+    if (!frequent || (posted && posted->size() >= frequent->size()))
+        return;
+    auto reader = FileManager::OpenText(fileID);
+    uint64_t textSize = std::min<uint64_t>(reader.size(), tail.cursor.begin);
+    std::vector<FileChunk> wave(INDEX_CHUNKS_IN_FLIGHT);
+    ChunkCursor cursor;
+    while (cursor.begin < textSize) {
+        uint64_t base;
+        std::string_view text = reader.read(cursor.begin, cursor.begin + INDEX_WINDOW_BYTES, &base);
+        text = text.substr(0, static_cast<size_t>(std::min<uint64_t>(text.size(), textSize - base)));
+        size_t chunks = nextChunkWave(text, base, textSize, cursor, wave, false);
+        if (chunks == 0)
+            throw std::runtime_error("File " + std::to_string(fileID) + " cannot be read");
+        threadPool->parallelFor(chunks, chunks - 1, [&](size_t i) {
+            FileChunk& chunk = wave[i];
+            const auto& words = chunk.tokenizer.tokens();
+            chunk.wordsByShard.assign(hashTable.shardCount(), {});
+            chunk.pairsByShard.assign(pairTable.shardCount(), {});
+            std::string word, previousWord = chunk.wordBefore;
+            bool hasPrevious = chunk.hasWordBefore;
+            for (size_t j = 0; j < words.size(); ++j) {
+                word.assign(words[j].word);
+                if (hasPrevious && isFrequentPair(*frequent, previousWord, word)
+                    && !(posted && isFrequentPair(*posted, previousWord, word)))
+                    chunk.pairsByShard[pairTable.shardOf(previousWord + ' ' + word)].push_back(static_cast<uint32_t>(j));
+                previousWord.swap(word);
+                hasPrevious = true;
+            }
+        });
+        insertWave(fileID, wave, chunks);
     }
-    return result;
+    tail.pairTerms = frequent;
 }
-std::string Searcher::CleanWordForIndexing(const std::string& word) {
-    std::string cleanWord;
-    cleanWord.reserve(word.size());
-    for (unsigned char c : word) {
-        if (std::isalnum(c) || c == '-' || c == '\'') {
-            cleanWord.push_back(std::tolower(c));
+
+size_t Searcher::nextChunkWave(std::string_view text, uint64_t base, uint64_t textSize, ChunkCursor& cursor,
+    std::vector<FileChunk>& wave, bool withTrigrams)
+{
+    // a chunk cut at the end of a window that does not reach the end of the text could end
+    // inside a word, and its last trigrams need the two bytes after it: it waits for the
+    // next window, unless it is the first of the wave
+    bool whole = base + text.size() >= textSize;
+    size_t chunks = 0;
+    for (; chunks < wave.size() && cursor.begin < base + text.size(); ++chunks) {
+        size_t end = Tokenizer::boundaryAfter(text, std::min(text.size(), cursor.begin - base + INDEX_CHUNK_BYTES));
+        if (!whole && chunks > 0 && end + 2 > text.size())
+            break;
+        FileChunk& chunk = wave[chunks];
+        chunk.begin = cursor.begin;
+        chunk.end = base + end;
+        cursor.begin = chunk.end;
+    }
+    threadPool->parallelFor(chunks, chunks - 1, [&](size_t i) {
+        FileChunk& chunk = wave[i];
+        chunk.tokenizer.tokenize(text.substr(chunk.begin - base, chunk.end - chunk.begin));
+        chunk.trigrams.clear();
+        if (withTrigrams)
+            chunk.trigrams = TrigramIndex::trigramsOf(text, chunk.begin - base, chunk.end - base);
+    });
+
+    // positions run on across chunks: each starts where the words before it ended
+    for (size_t i = 0; i < chunks; ++i) {
+        FileChunk& chunk = wave[i];
+        chunk.firstPosition = cursor.position;
+        chunk.hasWordBefore = cursor.hasWord;
+        chunk.wordBefore = cursor.word;
+        chunk.wordBeforeOffset = cursor.wordOffset;
+        const auto& words = chunk.tokenizer.tokens();
+        cursor.position += words.size();
+        if (words.size() >= 2) {
+            const auto& previous = words[words.size() - 2];
+            cursor.hasPreviousWord = true;
+            cursor.previousWord.assign(previous.word);
+            cursor.previousWordOffset = chunk.begin + previous.byteOffset;
+        }
+        else if (!words.empty()) {
+            cursor.hasPreviousWord = cursor.hasWord;
+            cursor.previousWord.swap(cursor.word);
+            cursor.previousWordOffset = cursor.wordOffset;
+        }
+        if (!words.empty()) {
+            cursor.hasWord = true;
+            cursor.word.assign(words.back().word);
+            cursor.wordOffset = chunk.begin + words.back().byteOffset;
         }
     }
-    std::transform(cleanWord.begin(), cleanWord.end(), cleanWord.begin(),
-        [](unsigned char c) { return std::tolower(c); });
-    return cleanWord;
+    return chunks;
+}
+
+void Searcher::indexChunk(uint64_t fileID, FileChunk& chunk, const TermSet* frequent)
+{
+    const auto& words = chunk.tokenizer.tokens();
+    chunk.uniqueWords.clear();
+    chunk.wordsByShard.assign(hashTable.shardCount(), {});
+    chunk.pairsByShard.assign(pairTable.shardCount(), {});
+    // reused across words, so short words never allocate
+    std::string word, previousWord = chunk.wordBefore;
+    bool hasPrevious = chunk.hasWordBefore;
+    bool previousStopword = hasPrevious && isStopword(previousWord);
+	for (size_t i = 0; i < words.size(); ++i)
+	{
+        word.assign(words[i].word);
+        bool stopword = isStopword(word);
+        if (hasPrevious && (stopword || previousStopword || (frequent && isFrequentPair(*frequent, previousWord, word))))
+            chunk.pairsByShard[pairTable.shardOf(previousWord + ' ' + word)].push_back(static_cast<uint32_t>(i));
+        if (!stopword) {
+            chunk.wordsByShard[hashTable.shardOf(word)].push_back(static_cast<uint32_t>(i));
+            chunk.uniqueWords.insert(words[i].word);
+        }
+        previousWord.swap(word);
+        previousStopword = stopword;
+        hasPrevious = true;
+	}
 }
-Searcher::WordTokens Searcher::tokenizeWord(const WordTokens& tokens)
+
+void Searcher::insertWave(uint64_t fileID, std::vector<FileChunk>& wave, size_t chunks)
 {
-    WordTokens filtered_tokens = tokens;
+    size_t wordShards = hashTable.shardCount();
+    threadPool->parallelFor(wordShards + pairTable.shardCount(), chunks - 1, [&](size_t task) {
+        bool pairs = task >= wordShards;
+        size_t shard = pairs ? task - wordShards : task;
+        std::string key;
+        for (size_t c = 0; c < chunks; ++c) {
+            const FileChunk& chunk = wave[c];
+            const auto& indices = pairs ? chunk.pairsByShard[shard] : chunk.wordsByShard[shard];
+            if (indices.empty())
+                continue;
+            const auto& words = chunk.tokenizer.tokens();
+            (pairs ? pairTable : hashTable).insertInto(shard, [&](const auto& add) {
+                for (uint32_t i : indices) {
+                    size_t pos = chunk.firstPosition + i;
+                    if (!pairs) {
+                        key.assign(words[i].word);
+                        add(key, WordLocation(fileID, chunk.begin + words[i].byteOffset, pos));
+                        continue;
+                    }
+                    // the bigram sits at the first word's position, so phrase offsets stay word-based
+                    if (i == 0)
+                        key = chunk.wordBefore;
+                    else
+                        key.assign(words[i - 1].word);
+                    size_t offset = i == 0 ? chunk.wordBeforeOffset : chunk.begin + words[i - 1].byteOffset;
+                    key += ' ';
+                    key.append(words[i].word);
+                    add(key, WordLocation(fileID, offset, pos - 1));
+                }
+            });
+        }
+    });
+}
 
-    auto new_end = std::remove_if(
-        filtered_tokens.begin(),
-        filtered_tokens.end(),
-        [this](const WordToken& token) {
-            return ignore_set.count(token.first);
+void Searcher::indexContent(uint64_t fileID, FileManager::TextReader& reader, ChunkCursor& cursor, const TermSet* frequent,
+    std::unordered_set<std::string>& uniqueWords, std::vector<uint32_t>& trigrams, ContentHash* hash)
+{
+    auto merge = [&trigrams](std::vector<uint32_t>& more) {
+        if (trigrams.empty()) {
+            trigrams.swap(more);
+            return;
         }
-    );
-    filtered_tokens.erase(new_end, filtered_tokens.end());
+        std::vector<uint32_t> merged;
+        merged.reserve(trigrams.size() + more.size());
+        std::set_union(trigrams.begin(), trigrams.end(), more.begin(), more.end(), std::back_inserter(merged));
+        trigrams.swap(merged);
+    };
 
-    return filtered_tokens;
+    std::vector<FileChunk> wave(INDEX_CHUNKS_IN_FLIGHT);
+    // after an append, the first trigrams start in the text before it
+    uint64_t from = cursor.begin >= 2 ? cursor.begin - 2 : 0;
+    while (cursor.begin < reader.size()) {
+        uint64_t base;
+        std::string_view text = reader.read(from, cursor.begin + INDEX_WINDOW_BYTES, &base);
+        if (base + text.size() <= cursor.begin)
+            throw std::runtime_error("File " + std::to_string(fileID) + " cannot be read");
+        if (from < cursor.begin) {
+            std::vector<uint32_t> across = TrigramIndex::trigramsOf(text, from - base, cursor.begin - base);
+            merge(across);
+        }
+        uint64_t waveBegin = cursor.begin;
+        size_t chunks = nextChunkWave(text, base, reader.size(), cursor, wave, true);
+        if (hash)
+            hash->update(text.substr(waveBegin - base, cursor.begin - waveBegin));
+        threadPool->parallelFor(chunks, chunks - 1, [&](size_t i) { this->indexChunk(fileID, wave[i], frequent); });
+        insertWave(fileID, wave, chunks);
+        for (size_t i = 0; i < chunks; ++i) {
+            for (std::string_view term : wave[i].uniqueWords)
+                uniqueWords.emplace(term);
+            merge(wave[i].trigrams);
+        }
+        from = cursor.begin;
+    }
 }
 
 void Searcher::loadFileContent(const uint64_t fileID)
 {
-	std::string content = FileManager::getFileText(fileID);
-	auto words = splitString(content);
-	for (size_t pos = 0; pos < words.size(); ++pos)
-	{
-        auto cleanWord = CleanWordForIndexing(words[pos].first);
-        hashTable.insert(cleanWord, WordLocation(fileID, words[pos].second, pos));
-	}
+    auto reader = FileManager::OpenText(fileID);
+    auto frequent = std::atomic_load(&frequentTerms);
+
+    ChunkCursor cursor;
+    std::unordered_set<std::string> uniqueWords;
+    std::vector<uint32_t> trigrams;
+    // hashed while it is read anyway, when the upload path did not hash it
+    ContentHash hash;
+    bool needsHash = FileManager::NeedsContentHash(fileID);
+    indexContent(fileID, reader, cursor, frequent.get(), uniqueWords, trigrams, needsHash ? &hash : nullptr);
+    if (needsHash)
+        FileManager::RememberContent(fileID, hash.digest());
+    trigramIndex.addDocument(static_cast<uint32_t>(fileID), trigrams);
+    documentStats.setDocument(static_cast<uint32_t>(fileID), static_cast<uint32_t>(cursor.position));
+    termDictionary.addDocumentTerms(std::vector<std::string>(uniqueWords.begin(), uniqueWords.end()));
+
+    auto tail = std::make_shared<DocumentTail>();
+    tail->cursor = std::move(cursor);
+    uint64_t base;
+    std::string_view last = reader.size() ? reader.read(reader.size() - 1, reader.size(), &base) : std::string_view();
+    tail->endsWithSpace = last.empty() || Tokenizer::isSpace(last.back());
+    tail->pairTerms = frequent;
+    size_t words = tail->cursor.position;
+    uint64_t replaced = 0;
+    bool deleted = false;
+    {
+        // RemoveDocument takes the same lock: a file deleted while it was indexed is seen here
+        std::lock_guard<std::mutex> lock(documentTailsMutex);
+        deleted = deletedDocuments.contains(static_cast<uint32_t>(fileID));
+        if (!deleted)
+            documentTails[fileID] = tail;
+        auto it = pendingReplacements.find(fileID);
+        if (it != pendingReplacements.end()) {
+            replaced = it->second;
+            replacing.erase(replaced);
+            pendingReplacements.erase(it);
+        }
+    }
+    if (deleted) {
+        documentStats.removeDocument(static_cast<uint32_t>(fileID));
+        queueForCompaction(static_cast<uint32_t>(fileID));
+    }
+    if (replaced != 0)
+        RemoveDocument(replaced);
+
+    if (!deleted) {
+        // the set may have grown while this file was indexed
+        std::lock_guard<std::mutex> lock(tail->mtx);
+        backfillFrequentPairs(fileID, *tail, std::atomic_load(&frequentTerms));
+    }
+    indexedWordCount.fetch_add(words);
     //std::cout << fileCount.load() << ": " << fileID << std::endl;
     fileCount.fetch_add(1);
+    Metrics::instance().add(filesIndexed);
+    Metrics::instance().add(wordsIndexed, words);
+}
+
+uint64_t Searcher::AppendFile(uint64_t fileID, const std::string& data)
+{
+    std::shared_ptr<DocumentTail> tail;
+    {
+        std::lock_guard<std::mutex> lock(documentTailsMutex);
+        auto it = documentTails.find(fileID);
+        if (it != documentTails.end())
+            tail = it->second;
+    }
+    if (!tail)
+        throw std::invalid_argument("File " + std::to_string(fileID) + " is deleted or not indexed yet");
+    if (data.empty())
+        return fileID;
+
+    std::lock_guard<std::mutex> lock(tail->mtx);
+    if (deletedDocuments.contains(static_cast<uint32_t>(fileID)))
+        throw std::invalid_argument("File " + std::to_string(fileID) + " is deleted or not indexed yet");
+    ChunkCursor& cursor = tail->cursor;
+    if (FileManager::IsShared(fileID)) {
+        // other uploads of the same content keep it: this one gets a copy with the append
+        return ReplaceDocument(fileID, FileManager::getFileText(fileID) + data);
+    }
+    if (!FileManager::AppendFile(fileID, data))
+        return 0;
+    // with no whitespace in between, the old last word may run on into the appended text:
+    // it is indexed again from its start, together with what follows
+    std::string oldLastWord;
+    size_t wordsBefore = cursor.position;
+    if (!tail->endsWithSpace && !Tokenizer::isSpace(data.front()) && cursor.hasWord) {
+        oldLastWord = cursor.word;
+        unindexLastWord(fileID, cursor);
+    }
+    tail->endsWithSpace = Tokenizer::isSpace(data.back());
+
+    size_t oldPosition = cursor.position;
+    // the set the earlier text is posted for; a later one backfills the whole file
+    auto frequent = tail->pairTerms;
+    auto reader = FileManager::OpenText(fileID);
+    std::unordered_set<std::string> uniqueWords;
+    std::vector<uint32_t> trigrams;
+    indexContent(fileID, reader, cursor, frequent.get(), uniqueWords, trigrams);
+    trigramIndex.addDocument(static_cast<uint32_t>(fileID), trigrams);
+    documentStats.setDocument(static_cast<uint32_t>(fileID), static_cast<uint32_t>(cursor.position));
+
+    // document frequency counts the file once per term; the old last word was counted
+    // already, and no longer is if running on into the append was its only occurrence
+    std::vector<std::string> newTerms;
+    for (const auto& word : uniqueWords) {
+        if (word != oldLastWord
+            && !hashTable.containsBefore(word, static_cast<uint32_t>(fileID), static_cast<uint32_t>(oldPosition)))
+            newTerms.push_back(word);
+    }
+    termDictionary.addDocumentTerms(newTerms);
+    if (!oldLastWord.empty() && !isStopword(oldLastWord) && !uniqueWords.count(oldLastWord)
+        && !hashTable.containsBefore(oldLastWord, static_cast<uint32_t>(fileID), static_cast<uint32_t>(oldPosition)))
+        termDictionary.removeDocuments(oldLastWord, 1);
+
+    Metrics::instance().add(appendsIndexed);
+    Metrics::instance().add(wordsIndexed, cursor.position - wordsBefore);
+    indexedWordCount.fetch_add(cursor.position - wordsBefore);
+    return fileID;
+}
+
+void Searcher::unindexLastWord(uint64_t fileID, ChunkCursor& cursor)
+{
+    uint32_t last = static_cast<uint32_t>(cursor.position - 1);
+    hashTable.remove(cursor.word, static_cast<uint32_t>(fileID), last); // a stopword has none
+    if (cursor.hasPreviousWord)
+        pairTable.remove(cursor.previousWord + ' ' + cursor.word, static_cast<uint32_t>(fileID), last - 1);
+    cursor.begin = cursor.wordOffset;
+    cursor.position = last;
+    cursor.hasWord = cursor.hasPreviousWord;
+    cursor.word.swap(cursor.previousWord);
+    cursor.wordOffset = cursor.previousWordOffset;
+    // indexing from here on finds at least the word again, which sets these
+    cursor.hasPreviousWord = false;
+    cursor.previousWord.clear();
+}
+
+bool Searcher::RemoveDocument(uint64_t fileID)
+{
+    if (FileManager::ReleaseShared(fileID))
+        return true; // other uploads of the same content still hold the file
+    if (!FileManager::RemoveDocument(fileID))
+        return false; // unknown, or deleted already
+    std::shared_ptr<DocumentTail> tail;
+    {
+        std::lock_guard<std::mutex> lock(documentTailsMutex);
+        deletedDocuments.add(static_cast<uint32_t>(fileID));
+        auto it = documentTails.find(fileID);
+        if (it != documentTails.end()) {
+            tail = std::move(it->second);
+            documentTails.erase(it);
+        }
+    }
+    Metrics::instance().add(filesDeleted);
+    if (!tail)
+        return true; // still being indexed: loadFileContent queues it for compaction when done
+
+    {
+        // an append in progress finishes first, so compaction finds all of its postings
+        std::lock_guard<std::mutex> lock(tail->mtx);
+    }
+    documentStats.removeDocument(static_cast<uint32_t>(fileID));
+    queueForCompaction(static_cast<uint32_t>(fileID));
+    return true;
+}
+
+uint64_t Searcher::ReplaceDocument(uint64_t fileID, const std::string& data)
+{
+    if (FileManager::getFileName(fileID).empty())
+        throw std::invalid_argument("File " + std::to_string(fileID) + " does not exist");
+    {
+        std::lock_guard<std::mutex> lock(documentTailsMutex);
+        if (!replacing.insert(fileID).second)
+            throw std::invalid_argument("File " + std::to_string(fileID) + " is being replaced already");
+    }
+    uint64_t newFileID = FileManager::ReplaceDocument(fileID, data);
+    {
+        std::lock_guard<std::mutex> lock(documentTailsMutex);
+        if (newFileID == 0) {
+            replacing.erase(fileID);
+            return 0;
+        }
+        pendingReplacements[newFileID] = fileID;
+    }
+    AddFile(newFileID);
+    return newFileID;
+}
+
+void Searcher::queueForCompaction(uint32_t fileID)
+{
+    {
+        std::lock_guard<std::mutex> lock(compactionMutex);
+        if (awaitingCompaction.empty())
+            firstAwaiting = std::chrono::steady_clock::now();
+        awaitingCompaction.push_back(fileID);
+    }
+    compactionWake.notify_one();
+}
+
+void Searcher::runCompaction()
+{
+    std::unique_lock<std::mutex> lock(compactionMutex);
+    while (!stopCompaction) {
+        if (awaitingCompaction.empty()) {
+            compactionWake.wait(lock);
+            continue;
+        }
+        auto due = firstAwaiting + std::chrono::milliseconds(COMPACTION_INTERVAL_MS);
+        if (awaitingCompaction.size() < COMPACTION_MIN_DELETED && std::chrono::steady_clock::now() < due) {
+            compactionWake.wait_until(lock, due);
+            continue;
+        }
+        std::vector<uint32_t> fileIDs;
+        fileIDs.swap(awaitingCompaction);
+        lock.unlock();
+        compactDeleted(fileIDs);
+        lock.lock();
+    }
+}
+
+void Searcher::compactDeleted(const std::vector<uint32_t>& fileIDs)
+{
+    // Word postings of exactly these files go, so each term loses one document per file
+    // it was in; files still being indexed are left for a later run.
+    std::unordered_set<uint32_t> compacted(fileIDs.begin(), fileIDs.end());
+    std::unordered_map<std::string, uint32_t> lostDocuments;
+    std::unordered_set<uint32_t> files;
+    size_t purged = hashTable.removeIf(
+        [&compacted](const WordLocation& location) { return compacted.count(location.fileID) > 0; },
+        [&](const std::string& word, const ConcurrentHashMap::mappedType& dropped) {
+            files.clear();
+            for (const auto& location : dropped)
+                files.insert(location.fileID);
+            lostDocuments[word] += static_cast<uint32_t>(files.size());
+        });
+    for (const auto& [word, documents] : lostDocuments)
+        termDictionary.removeDocuments(word, documents);
+
+    // bigrams and trigrams carry no counts: whatever belongs to a deleted file goes
+    auto deleted = [this](uint32_t fileID) { return deletedDocuments.contains(fileID); };
+    purged += pairTable.removeIf([&deleted](const WordLocation& location) { return deleted(location.fileID); },
+        [](const std::string&, const ConcurrentHashMap::mappedType&) {});
+    trigramIndex.removeFiles(deleted);
+    FileManager::PurgeRemovedFiles();
+
+    Metrics::instance().add(compactionRuns);
+    Metrics::instance().add(postingsPurged, purged);
 }
@@ -2,6 +2,17 @@
 #include "ConcurrentHashMap.h"
 #include "ThreadPool.h"
 #include "FileManager.h"
+#include "SingleFlight.h"
+#include "DocumentStats.h"
+#include "QueryEngine.h"
+#include "TermDictionary.h"
+#include "Metrics.h"
+#include "TrigramIndex.h"
+#include "Snippets.h"
+#include "Deadline.h"
+#include "Tokenizer.h"
+#include "IngestQueue.h"
+#include "DeletedDocuments.h"
 #include <string>
 #include <vector>
 #include <map>
@@ -9,8 +20,44 @@
 #include <mutex>
 #include <algorithm>
 #include <unordered_set>
-#define BATCH_UPDATE_INTERVAL_MS 10000
+#include <unordered_map>
+#include <thread>
+#include <condition_variable>
 #define PART_SIZE 100
+#define DEFAULT_PAGE_SIZE 20
+#define MAX_PAGE_SIZE 1000
+#define PREFIX_EXPANSION_LIMIT 64
+// Grep runs the regex over blocks of GREP_SCAN_BLOCK bytes and checks the deadline between
+// them. Each search sees GREP_SCAN_OVERLAP bytes past its block, so only a match longer than
+// that which crosses a block edge can be missed.
+#define GREP_SCAN_BLOCK (256 * 1024)
+#define GREP_SCAN_OVERLAP 4096
+// Words of ignore_set get no postings of their own; each pair of adjacent words with a
+// stopword in it is indexed as a bigram instead, and positions keep counting the
+// stopwords, so phrases containing them still match exactly. A lone stopword finds nothing.
+#define DROP_STOPWORDS 1
+// Adjacent pairs of two of the FREQUENT_PAIR_TERMS most frequent words are posted as
+// bigrams as well, so a phrase of common words intersects one short list instead of two
+// long ones. The set is chosen once FREQUENT_PAIR_FIRST_DOCUMENTS files are indexed, or
+// sooner if the queue runs dry, and re-evaluated each time the indexed words double: terms
+// that became frequent join it, up to FREQUENT_PAIR_MAX_TERMS, and only their pairs are
+// backfilled into the files indexed before.
+#define FREQUENT_PAIR_TERMS 64
+#define FREQUENT_PAIR_FIRST_DOCUMENTS 1000
+#define FREQUENT_PAIR_MAX_TERMS 256
+// Files are indexed in chunks of about INDEX_CHUNK_BYTES cut at whitespace. The chunks of
+// a large file are tokenized and indexed by up to INDEX_CHUNKS_IN_FLIGHT threads at once,
+// one wave at a time, so memory stays bounded whatever the file size. A compressed file is
+// decoded INDEX_WINDOW_BYTES at a time: a wave and one chunk more, so that the last chunk
+// of a wave finds its whitespace.
+#define INDEX_CHUNK_BYTES (4 << 20)
+#define INDEX_CHUNKS_IN_FLIGHT 8
+#define INDEX_WINDOW_BYTES ((INDEX_CHUNKS_IN_FLIGHT + 1) * INDEX_CHUNK_BYTES)
+// Deleted files are hidden from queries at once and their postings dropped by a background
+// compaction, run once COMPACTION_MIN_DELETED files wait for it or COMPACTION_INTERVAL_MS
+// after the first of fewer.
+#define COMPACTION_MIN_DELETED 64
+#define COMPACTION_INTERVAL_MS 10000
 
 class Searcher
 {
@@ -19,11 +66,19 @@ public:
 		uint64_t fileID;
 		std::string fileName;
 		std::string textPart;
+		bool ranked = false;
+		double score = 0.0;
+		uint32_t hits = 1;
+		std::vector<std::pair<uint32_t, uint32_t>> highlights; // (offset, length) in textPart
 
 		SearchResult(uint64_t id, const std::string& name, const std::string& part)
 			: fileID(id), fileName(name), textPart(clearTextPart(part)) {
 		}
 
+		SearchResult(uint64_t id, const std::string& name, const std::string& part, double score, uint32_t hits)
+			: fileID(id), fileName(name), textPart(clearTextPart(part)), ranked(true), score(score), hits(hits) {
+		}
+
 		std::string clearTextPart(const std::string& textPart) const {
 			std::string cleaned;
 			cleaned.reserve(textPart.size());
@@ -57,35 +112,137 @@ public:
 			std::string safeTextPart = escapeJsonString(textPart);
 			std::string safeFileName = escapeJsonString(fileName);
 
-			return "{\"fileid\": " + std::to_string(fileID) +
+			std::string json = "{\"fileid\": " + std::to_string(fileID) +
 				", \"filename\": \"" + safeFileName +
-				"\", \"textpart\": \"" + safeTextPart + "\"}";
+				"\", \"textpart\": \"" + safeTextPart + "\"";
+			if (ranked) {
+				json += ", \"score\": " + std::to_string(score) +
+					", \"hits\": " + std::to_string(hits);
+			}
+			if (!highlights.empty()) {
+				json += ", \"highlights\": [";
+				for (size_t i = 0; i < highlights.size(); ++i) {
+					json += (i ? ", [" : "[") + std::to_string(highlights[i].first) + ", " +
+						std::to_string(highlights[i].second) + "]";
+				}
+				json += "]";
+			}
+			return json + "}";
 		}
 	};
+	using SearchResults = std::vector<SearchResult>;
+
+	struct SearchOptions {
+		// Relevance returns one BM25-ranked result per file, Position every match in file order
+		enum class Order { Relevance, Position };
+		Order order = Order::Relevance;
+		// Count: totals only, Files: per-file hit counts in file order; neither reads any file
+		enum class Mode { Results, Count, Files };
+		Mode mode = Mode::Results;
+		size_t limit = DEFAULT_PAGE_SIZE;
+		size_t offset = 0;
+		// cursor: only results that come strictly after it in the chosen order are returned
+		bool hasAfter = false;
+		uint32_t afterFileID = 0;
+		uint32_t afterWordPosition = 0;
+		double afterScore = 0.0;
+		// checked while scanning; not part of key(), identical searches share one run
+		Deadline deadline;
+
+		bool parseCursor(const std::string& cursor);
+		std::string key() const;
+	};
+
+	struct SearchPage {
+		SearchResults results;
+		size_t totalHits = 0;
+		bool totalExact = true;   // false when the scan stopped early and totalHits is extrapolated
+		std::string nextCursor;   // empty when there are no more matches
+		// the deadline passed: only what was scanned by then is counted and returned, and
+		// next (when set) continues after the last result
+		bool truncated = false;
+		// Count / Files modes
+		size_t totalFiles = 0;
+		std::vector<std::pair<uint32_t, uint32_t>> fileHits; // (fileID, hits), Files mode only
+	};
+	using SearchPagePtr = std::shared_ptr<const SearchPage>;
+
 	Searcher(std::shared_ptr<ThreadPool> threadPool);
 	~Searcher();
 	void AddFile(const uint64_t fileID);
-	void stopUpdate() { stopFlag = true; }
-	std::vector<SearchResult> SearchPhrase(const std::string& phrase);
+	// A file whose ID was taken but which was never stored: the watermark moves past it,
+	// and the ID is reported as failed.
+	void AbandonFile(const uint64_t fileID);
+	void stopUpdate();
+	// Waits at most timeout for fileID, and every file added before it, to be searchable.
+	// False when it is not yet, or never will be (see FileFailed).
+	bool WaitIndexed(uint64_t fileID, std::chrono::milliseconds timeout);
+	// Whether fileID was abandoned: its file could not be stored.
+	bool FileFailed(uint64_t fileID) const { return ingestQueue.abandoned(fileID); }
+	uint64_t IndexedUpTo() const { return ingestQueue.indexedUpTo(); }
+	// Appends data to an indexed file and indexes only what was added: positions, byte
+	// offsets and bigrams run on from where the file ended, so phrases match across the
+	// append. The bytes are stored as received: when neither side has whitespace there, the
+	// old last word runs on into the appended text and is indexed again as the longer word.
+	// Returns the ID holding the appended text: fileID, or
+	// when deduplication shared fileID with other uploads, a copy stored as by
+	// ReplaceDocument, so theirs stays as it was. Throws std::invalid_argument while the file
+	// is not indexed yet; 0 when it cannot be written.
+	uint64_t AppendFile(uint64_t fileID, const std::string& data);
+	// Hides the file from every query at once; its postings go at the next compaction. A
+	// file deduplication shared between uploads only loses one of them, and stays until the
+	// last is deleted. False when the file is unknown or deleted already.
+	bool RemoveDocument(uint64_t fileID);
+	// Stores data as a new file and returns its ID; once that is indexed, fileID is deleted,
+	// so searches see the old version until the new one is searchable. Throws
+	// std::invalid_argument when fileID is unknown or an earlier replace of it is not
+	// indexed yet, so one file never gets two successors; 0 when data cannot be written.
+	uint64_t ReplaceDocument(uint64_t fileID, const std::string& data);
+	SearchPagePtr SearchPhrase(const std::string& phrase, const SearchOptions& options);
+	// Boolean query (see QueryNode); results are whole files. Throws std::invalid_argument.
+	SearchPagePtr SearchQuery(const std::string& query, const SearchOptions& options);
+	// ECMAScript regex over raw file text, one result per match in file order. Candidate files
+	// come from the trigram index; only those are read and matched. The cursor's word position
+	// is a byte offset here. Throws std::invalid_argument for malformed patterns.
+	SearchPagePtr Grep(const std::string& pattern, bool ignoreCase, const SearchOptions& options);
+	std::vector<TermDictionary::Entry> Suggest(const std::string& prefix, size_t limit);
 
 private:
 	ConcurrentHashMap hashTable;
+	ConcurrentHashMap pairTable{ 32, 10000, "bigrams" }; // "w1 w2" at the position of w1
+
+	// The frequent set only grows. New files are indexed with the latest one, and the files
+	// indexed before get the missing pairs backfilled; the planner uses a set only once
+	// every file has its pairs (readyTerms).
+	using TermSet = std::unordered_set<std::string>;
+	std::shared_ptr<const TermSet> frequentTerms; // std::atomic_load / std::atomic_store
+	std::shared_ptr<const TermSet> readyTerms;    // likewise; set under frequentTermsMutex
+	std::mutex frequentTermsMutex;
+	std::atomic<uint64_t> indexedWordCount{ 0 };
+	std::atomic<uint64_t> frequentTermsChosenAt{ 0 }; // indexedWordCount then
+	std::atomic<bool> choosingFrequentTerms{ false };
+	DocumentStats documentStats;
+	TermDictionary termDictionary;
+	TrigramIndex trigramIndex;
+	SingleFlight<SearchPage> inFlightSearches; // normalized phrase + page -> running search
 	std::shared_ptr<ThreadPool> threadPool;
 
+	IngestQueue ingestQueue;
+	std::thread ingestThread; // hands queued files to the pool in batches
 	std::atomic<int> fileCount{ 0 };
-	bool stopFlag = false;
-	std::mutex fileAddMutex;
-	std::vector<uint64_t> filesToAdd;
-	
-	const std::vector<char> delimiters = {
-		' ', '\n', '\t', '\r', '\f', '\v', '\0',
-		',', '.', '!', '?', ';', ':',
-		'"', '\'', '(', ')', '[', ']', '{', '}', '<', '>',
-		'-', '_',
-		'/', '\\', '*', '+', '=', '%', '^', '~',
-		'#', '@', '&', '|', '$'
-	};
 
+	Metrics::Id lookupStage;
+	Metrics::Id intersectStage;
+	Metrics::Id snippetStage;
+	Metrics::Id verifyStage;
+	Metrics::Id truncatedSearches;
+	Metrics::Id filesIndexed;
+	Metrics::Id wordsIndexed;
+	Metrics::Id appendsIndexed;
+	Metrics::Id filesDeleted;
+	Metrics::Id compactionRuns;
+	Metrics::Id postingsPurged;
+	
 	const std::unordered_set<std::string> ignore_set = {
 		"the", "a", "an", "and", "or", "but", "if", "then", "else",
 		"i", "you", "he", "she", "it", "we", "they",
@@ -96,13 +253,103 @@ private:
 		"not", "so", "no", "yes" };
 
 private:
-	void batchUpdate();
+	void registerMetrics();
+	// Single-flight run of compute; a page the leader's deadline cut short is recomputed
+	// for callers whose own deadline has not passed, once, and they share that run as well.
+	SearchPagePtr runShared(const std::string& key, const SearchOptions& options, const std::function<SearchPage()>& compute);
+	void dispatchIngest();
 	void loadFileContent(const uint64_t fileID);
 
-	using WordToken = std::pair<std::string, uint64_t>;
-	using WordTokens = std::vector<WordToken>;
-	WordTokens splitString(const std::string& str);
-	WordTokens tokenizeWord(const WordTokens& tokens);
-	std::string CleanWordForIndexing(const std::string& word);
+	struct FileChunk {
+		size_t begin = 0;           // byte range in the file
+		size_t end = 0;
+		size_t firstPosition = 0;   // word position of its first word
+		bool hasWordBefore = false; // the last word of the chunks before it, for bigrams
+		std::string wordBefore;
+		size_t wordBeforeOffset = 0;
+		Tokenizer tokenizer;
+		std::vector<uint32_t> trigrams;
+		std::unordered_set<std::string_view> uniqueWords;
+		// tokens to insert into hashTable and pairTable, by shard: a token's index, and for a
+		// bigram that of its second word. Inserted by insertWave, not by the chunk's thread.
+		std::vector<std::vector<uint32_t>> wordsByShard;
+		std::vector<std::vector<uint32_t>> pairsByShard;
+	};
+	struct ChunkCursor {
+		size_t begin = 0;    // of the next chunk
+		size_t position = 0; // words so far
+		bool hasWord = false;
+		std::string word;    // the last of them
+		size_t wordOffset = 0;
+		bool hasPreviousWord = false;
+		std::string previousWord; // the one before it, for the bigram an append may replace
+		size_t previousWordOffset = 0;
+	};
+	// Where indexing of a file stopped, kept for appends; its mutex serializes them.
+	struct DocumentTail {
+		std::mutex mtx;
+		ChunkCursor cursor;
+		bool endsWithSpace = true;
+		std::shared_ptr<const TermSet> pairTerms; // the frequent set its pairs are posted for
+	};
+	std::mutex documentTailsMutex;
+	std::unordered_map<uint64_t, std::shared_ptr<DocumentTail>> documentTails;
+	std::unordered_map<uint64_t, uint64_t> pendingReplacements; // new fileID -> the one it replaces; documentTailsMutex
+	std::unordered_set<uint64_t> replacing; // the old fileIDs of those, and of replaces being stored; documentTailsMutex
+
+	DeletedDocuments deletedDocuments;
+	// Deleted files whose indexing had finished, so all their postings are there to drop
+	// and their terms were counted in the dictionary; a file deleted while it is being
+	// indexed joins once it is done.
+	std::mutex compactionMutex;
+	std::condition_variable compactionWake;
+	std::vector<uint32_t> awaitingCompaction;
+	std::chrono::steady_clock::time_point firstAwaiting;
+	bool stopCompaction = false;
+	std::thread compactionThread;
+	std::vector<Metrics::Gauge> gauges; // last: unregistered before what they read is destroyed
+	void queueForCompaction(uint32_t fileID);
+	void runCompaction();
+	void compactDeleted(const std::vector<uint32_t>& fileIDs);
+	PostingsPtr withoutDeleted(PostingsPtr postings, const Deadline& deadline) const;
+
+	// Cuts the next wave of chunks out of text, which holds the file's bytes from offset base
+	// on, and tokenizes it on the pool; returns how many, 0 at the end of text. Unless text
+	// reaches textSize, only chunks that end inside it are cut.
+	size_t nextChunkWave(std::string_view text, uint64_t base, uint64_t textSize, ChunkCursor& cursor,
+		std::vector<FileChunk>& wave, bool withTrigrams);
+	// Drops the postings of the cursor's last word and moves the cursor back to its start.
+	void unindexLastWord(uint64_t fileID, ChunkCursor& cursor);
+	void indexChunk(uint64_t fileID, FileChunk& chunk, const TermSet* frequent);
+	// Inserts what the first chunks of wave collected, shard by shard, each chunk's under
+	// one lock and in position order. Chunks indexed in parallel would otherwise insert the
+	// start of a file in front of the rest of it, moving every value after it.
+	void insertWave(uint64_t fileID, std::vector<FileChunk>& wave, size_t chunks);
+	// Indexes the text from cursor.begin to its end, a window at a time, and collects its
+	// distinct words and trigrams; hash, if given, is fed the text. Throws std::runtime_error
+	// when the text cannot be read.
+	void indexContent(uint64_t fileID, FileManager::TextReader& reader, ChunkCursor& cursor, const TermSet* frequent,
+		std::unordered_set<std::string>& uniqueWords, std::vector<uint32_t>& trigrams, ContentHash* hash = nullptr);
+	std::vector<std::string> analyze(const std::string& text);
+	// Both stop early once the deadline passes and then return what they have; the caller
+	// finds the deadline expired and reports its page as truncated.
+	PostingsPtr sortedPostings(const std::string& word, const Deadline& deadline);
+	std::vector<PhrasePart> planPhrase(const std::vector<std::string>& words, const Deadline& deadline);
+	PostingsPtr sortedPairPostings(const std::string& first, const std::string& second, const Deadline& deadline);
+	bool isStopword(const std::string& word) const { return DROP_STOPWORDS && ignore_set.count(word) > 0; }
+	bool isFrequentPair(const TermSet& frequent, const std::string& first, const std::string& second) const {
+		return !isStopword(first) && !isStopword(second) && frequent.count(first) && frequent.count(second);
+	}
+	std::shared_ptr<const TermSet> readyFrequentTerms() const;
+	void maybeChooseFrequentTerms();
+	void chooseFrequentTerms();
+	void publishFrequentTerms(const std::shared_ptr<const TermSet>& frequent);
+	void backfillFrequentPairs(uint64_t fileID, DocumentTail& tail, const std::shared_ptr<const TermSet>& frequent);
+	SearchPage collectPhraseMatches(PhraseIterator& phrase, const ScoringContext& ctx, const SearchOptions& options);
+	SearchPage collectFiles(DocIterator& matcher, const ScoringContext& ctx, const SearchOptions& options);
+	SearchPage rankFiles(DocIterator& matcher, const ScoringContext& ctx, const SearchOptions& options, uint32_t highlightWords);
+	SearchPage countMatches(DocIterator& matcher, const SearchOptions& options);
+	// Appends one result per hit; snippets for the whole batch are cut in one pass per file.
+	void addResults(SearchPage& page, const std::vector<Snippets::Hit>& hits, const Deadline& deadline);
 };
 
@@ -0,0 +1,55 @@
+#pragma once
+#include <string>
+#include <unordered_map>
+#include <mutex>
+#include <future>
+#include <memory>
+#include <functional>
+
+// Collapses concurrent calls that share a key into a single computation.
+// The first caller for a key runs the function; every caller that arrives
+// while it is still running waits on the same future and gets the same result.
+// Nothing is cached: once the leader finishes the key is forgotten.
+template<typename T>
+class SingleFlight
+{
+public:
+    using ResultPtr = std::shared_ptr<const T>;
+
+    ResultPtr run(const std::string& key, const std::function<T()>& compute) {
+        std::promise<ResultPtr> promise;
+        std::shared_future<ResultPtr> pending;
+        bool leader = false;
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            auto it = inFlight.find(key);
+            if (it != inFlight.end()) {
+                pending = it->second;
+            }
+            else {
+                pending = promise.get_future().share();
+                inFlight.emplace(key, pending);
+                leader = true;
+            }
+        }
+
+        if (!leader)
+            return pending.get();
+
+        try {
+            promise.set_value(std::make_shared<const T>(compute()));
+        }
+        catch (...) {
+            promise.set_exception(std::current_exception());
+        }
+        {
+            std::lock_guard<std::mutex> lock(mtx);
+            inFlight.erase(key);
+        }
+        return pending.get();
+    }
+
+private:
+    std::mutex mtx;
+    std::unordered_map<std::string, std::shared_future<ResultPtr>> inFlight;
+};
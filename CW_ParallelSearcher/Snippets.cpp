@@ -0,0 +1,132 @@
+#include "Snippets.h"
+#include "FileManager.h"
+#include <algorithm>
+#include <numeric>
+#include <cctype>
+
+namespace
+{
+    struct Window {
+        size_t begin, end;           // snippet
+        size_t matchBegin, matchEnd; // its own hit
+    };
+
+    bool isSpace(char c) { return c == ' ' || c == '\n' || c == '\t' || c == '\r' || c == '\f' || c == '\v'; }
+    bool endsSentence(char c) { return c == '.' || c == '!' || c == '?' || c == '\n'; }
+    // UTF-8 continuation byte: never cut right before one
+    bool isContinuation(char c) { return (static_cast<unsigned char>(c) & 0xC0) == 0x80; }
+
+    size_t measureMatch(const char* text, size_t size, size_t offset, const Snippets::Hit& hit)
+    {
+        if (hit.highlightBytes)
+            return std::min(size, offset + hit.highlightBytes);
+        size_t end = offset;
+        for (uint32_t word = 0; word < hit.highlightWords && end < size; ++word) {
+            while (end < size && isSpace(text[end]))
+                ++end;
+            while (end < size && !isSpace(text[end]))
+                ++end;
+        }
+        // trailing punctuation is not part of the indexed word
+        while (end > offset && std::ispunct(static_cast<unsigned char>(text[end - 1])))
+            --end;
+        return end;
+    }
+
+    Window cut(const char* text, size_t size, size_t offset, size_t matchEnd, size_t maxSize)
+    {
+        Window window{ 0, 0, offset, matchEnd };
+
+        // start: the sentence the hit is in, else the first word boundary within the context
+        size_t lo = offset > SNIPPET_CONTEXT ? offset - SNIPPET_CONTEXT : 0;
+        size_t begin = offset;
+        while (begin > lo && !endsSentence(text[begin - 1]))
+            --begin;
+        if (begin == lo && lo > 0) {
+            while (begin < offset && !isSpace(text[begin]))
+                ++begin;
+            if (begin == offset)
+                begin = lo; // one long token: cut inside it
+        }
+        while (begin < offset && (isSpace(text[begin]) || isContinuation(text[begin])))
+            ++begin;
+
+        // end: the last sentence end, else the last word boundary, that fits
+        size_t hi = std::min(size, std::max(begin + maxSize, matchEnd));
+        size_t end = hi;
+        if (hi < size) {
+            while (end > matchEnd && !endsSentence(text[end - 1]))
+                --end;
+            if (end == matchEnd) {
+                end = hi;
+                while (end > matchEnd && !isSpace(text[end]))
+                    --end;
+                if (end == matchEnd)
+                    end = hi;
+            }
+            while (end > matchEnd && isContinuation(text[end]))
+                --end;
+        }
+        while (end > matchEnd && isSpace(text[end - 1]))
+            --end;
+
+        window.begin = begin;
+        window.end = end;
+        return window;
+    }
+}
+
+std::vector<Snippets::Snippet> Snippets::extract(const std::vector<Hit>& hits, size_t maxSize, const Deadline& deadline)
+{
+    std::vector<Snippet> snippets(hits.size());
+    std::vector<size_t> order(hits.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&hits](size_t a, size_t b) {
+        return hits[a].fileID != hits[b].fileID ? hits[a].fileID < hits[b].fileID : hits[a].byteOffset < hits[b].byteOffset;
+    });
+
+    for (size_t first = 0; first < order.size() && !deadline.expired();) {
+        uint32_t fileID = hits[order[first]].fileID;
+        size_t last = first;
+        while (last < order.size() && hits[order[last]].fileID == fileID)
+            ++last;
+
+        // of a compressed file, only the blocks around its hits are decoded
+        uint64_t lowest = hits[order[first]].byteOffset;
+        uint64_t base;
+        auto mapped = FileManager::MapRange(fileID, lowest > SNIPPET_CONTEXT ? lowest - SNIPPET_CONTEXT : 0,
+            uint64_t(hits[order[last - 1]].byteOffset) + maxSize + SNIPPET_RANGE_SLACK, &base);
+        const char* text = mapped->data();
+        size_t size = mapped->size();
+
+        // the file's hits in offset order, so windows come out sorted by their own match
+        std::vector<Window> windows;
+        windows.reserve(last - first);
+        for (size_t i = first; i < last; ++i) {
+            const Hit& hit = hits[order[i]];
+            size_t offset = std::min<size_t>(hit.byteOffset - base, size);
+            windows.push_back(cut(text, size, offset, measureMatch(text, size, offset, hit), maxSize));
+        }
+
+        for (size_t i = 0; i < windows.size(); ++i) {
+            const Window& window = windows[i];
+            Snippet& snippet = snippets[order[first + i]];
+            snippet.text.assign(text + window.begin, window.end - window.begin);
+            snippet.cut = true;
+
+            // every hit of the page that lies inside this snippet is highlighted
+            auto inside = std::lower_bound(windows.begin(), windows.end(), window.begin,
+                [](const Window& w, size_t begin) { return w.matchBegin < begin; });
+            for (; inside != windows.end() && inside->matchBegin < window.end; ++inside) {
+                uint32_t start = static_cast<uint32_t>(inside->matchBegin - window.begin);
+                uint32_t length = static_cast<uint32_t>(inside->matchEnd - inside->matchBegin);
+                if (inside->matchEnd > window.end || length == 0 ||
+                    (!snippet.highlights.empty() && snippet.highlights.back().first == start))
+                    continue;
+                snippet.highlights.emplace_back(start, length);
+            }
+        }
+        first = last;
+    }
+    return snippets;
+}
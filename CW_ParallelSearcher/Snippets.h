@@ -0,0 +1,34 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+#include <cstdint>
+#include "Deadline.h"
+#define SNIPPET_CONTEXT 40 // bytes of text shown before a hit, at most
+#define SNIPPET_RANGE_SLACK 256 // read past maxSize after the last hit, for its own length
+
+// Snippet extraction for a page of results. Hits are grouped by file, each file is
+// mapped once and its hits are cut in offset order, so a page with many hits in few
+// files does not reopen anything.
+namespace Snippets
+{
+    struct Hit {
+        uint32_t fileID;
+        uint32_t byteOffset;
+        uint32_t highlightBytes = 0; // length of the match; 0 to measure highlightWords words instead
+        uint32_t highlightWords = 1;
+    };
+
+    struct Snippet {
+        std::string text;
+        // (offset, length) in text of every hit of the page that falls inside it
+        std::vector<std::pair<uint32_t, uint32_t>> highlights;
+        bool cut = false; // false when the deadline passed before its file was read
+    };
+
+    // One snippet per hit, in the order given. Snippets start at a sentence boundary when
+    // one lies within SNIPPET_CONTEXT bytes before the hit, otherwise at a word boundary,
+    // and end at the last sentence or word boundary that keeps them within maxSize bytes.
+    // The deadline is checked before each file; the snippets of files left over stay empty.
+    std::vector<Snippet> extract(const std::vector<Hit>& hits, size_t maxSize, const Deadline& deadline = Deadline());
+}
@@ -0,0 +1,119 @@
+#include "StorageIO.h"
+#include <fstream>
+#include <filesystem>
+
+StorageIO& StorageIO::instance()
+{
+    static StorageIO io;
+    return io;
+}
+
+StorageIO::StorageIO()
+{
+    auto& metrics = Metrics::instance();
+    writesTotal = metrics.counter("storage_io_writes_total", "Files written by the storage I/O layer");
+    bytesTotal = metrics.counter("storage_io_bytes_total", "Bytes written by the storage I/O layer");
+    failedTotal = metrics.counter("storage_io_failed_writes_total", "Files the storage I/O layer could not write");
+    throttledTotal = metrics.counter("storage_io_throttled_writes_total",
+        "Writes that waited because STORAGE_IO_MAX_PENDING_BYTES were queued");
+    gauges.push_back(metrics.gauge("storage_io_pending_writes", "Files queued or being written",
+        [this] { std::lock_guard<std::mutex> lock(mtx); return static_cast<double>(submitted - finished); }));
+    gauges.push_back(metrics.gauge("storage_io_pending_bytes", "Bytes queued or being written",
+        [this] { std::lock_guard<std::mutex> lock(mtx); return static_cast<double>(pendingBytes); }));
+
+    for (int i = 0; i < STORAGE_IO_THREADS; ++i)
+        threads.emplace_back(&StorageIO::runThreads, this);
+}
+
+StorageIO::~StorageIO()
+{
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    queued.notify_all();
+    for (auto& thread : threads)
+        thread.join();
+}
+
+void StorageIO::writeFile(const std::string& path, std::shared_ptr<const std::string> data, Completion done)
+{
+    auto write = std::make_unique<Write>();
+    write->path = path;
+    write->temporary = path + "." + std::to_string(++temporaryCount) + STORAGE_TEMP_EXTENSION;
+    write->data = std::move(data);
+    write->done = std::move(done);
+    size_t size = write->data->size();
+    {
+        std::unique_lock<std::mutex> lock(mtx);
+        auto room = [&] { return pendingBytes == 0 || pendingBytes + size <= STORAGE_IO_MAX_PENDING_BYTES; };
+        if (!room()) {
+            Metrics::instance().add(throttledTotal);
+            drained.wait(lock, room);
+        }
+        pendingBytes += size;
+        incoming.push_back(std::move(write));
+        ++submitted;
+    }
+    queued.notify_one();
+}
+
+void StorageIO::flush()
+{
+    std::unique_lock<std::mutex> lock(mtx);
+    drained.wait(lock, [this] { return finished == submitted; });
+}
+
+void StorageIO::finish(std::unique_ptr<Write> write)
+{
+    auto& metrics = Metrics::instance();
+    std::error_code ec;
+    if (!write->failed) {
+        std::filesystem::rename(write->temporary, write->path, ec);
+        write->failed = static_cast<bool>(ec);
+    }
+    if (write->failed) {
+        std::filesystem::remove(write->temporary, ec);
+        metrics.add(failedTotal);
+    }
+    else {
+        metrics.add(writesTotal);
+        metrics.add(bytesTotal, write->data->size());
+    }
+
+    if (write->done)
+        write->done(!write->failed);
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        pendingBytes -= write->data->size();
+        ++finished;
+    }
+    drained.notify_all();
+}
+
+void StorageIO::writeNow(Write& write)
+{
+    std::ofstream out(write.temporary, std::ios::binary | std::ios::trunc);
+    if (out) {
+        out.write(write.data->data(), write.data->size());
+        out.close();
+    }
+    write.failed = !out;
+}
+
+void StorageIO::runThreads()
+{
+    while (true) {
+        std::unique_ptr<Write> write;
+        {
+            std::unique_lock<std::mutex> lock(mtx);
+            queued.wait(lock, [this] { return stopping || !incoming.empty(); });
+            if (incoming.empty())
+                return;
+            write = std::move(incoming.front());
+            incoming.pop_front();
+        }
+        writeNow(*write);
+        finish(std::move(write));
+    }
+}
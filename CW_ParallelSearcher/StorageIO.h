@@ -0,0 +1,77 @@
+#pragma once
+#include <string>
+#include <memory>
+#include <functional>
+#include <deque>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include "Metrics.h"
+#define STORAGE_IO_THREADS 2                       // writer threads
+#define STORAGE_IO_MAX_PENDING_BYTES (256 << 20) // writeFile waits while this much is queued
+#define STORAGE_TEMP_EXTENSION ".cwps-tmp"         // files being written; left over ones are removed at startup
+
+// Writes whole files off the calling thread, so an upload's worker never waits for the
+// disk. Each file goes to a temporary file beside its path and is renamed over the path
+// once written, so readers see the old file or the new one, never part of one.
+//
+// STORAGE_IO_THREADS writer threads take queued files in order and write each with
+// ordinary blocking I/O. A write that fails is reported to its completion; the upload was
+// answered already, so callers must record the failure. Queued data is bounded: once
+// STORAGE_IO_MAX_PENDING_BYTES wait to be written, writeFile blocks until enough of it is,
+// so uploads faster than the disk slow down instead of filling memory.
+class StorageIO
+{
+public:
+    // Runs on the I/O thread with whether the file is in place; it should be short.
+    using Completion = std::function<void(bool)>;
+
+    static StorageIO& instance();
+    ~StorageIO();
+    StorageIO(const StorageIO&) = delete;
+    StorageIO& operator=(const StorageIO&) = delete;
+
+    // Queues data to be written to path, first waiting while too much is queued (a file
+    // larger than the bound waits until nothing is); done is never called before this
+    // returns. Not to be called from a completion, or with a lock one takes.
+    void writeFile(const std::string& path, std::shared_ptr<const std::string> data, Completion done);
+    // Returns once everything queued before the call is written and its completion ran.
+    void flush();
+
+private:
+    struct Write {
+        std::string path;
+        std::string temporary;
+        std::shared_ptr<const std::string> data;
+        Completion done;
+        bool failed = false;
+    };
+
+    StorageIO();
+
+    void runThreads();
+    void writeNow(Write& write);
+    void finish(std::unique_ptr<Write> write);
+
+    std::vector<std::thread> threads;
+
+    std::mutex mtx;
+    std::condition_variable queued;  // writer threads wait for writes
+    std::condition_variable drained; // flush and writeFile wait for writes to finish
+    std::deque<std::unique_ptr<Write>> incoming;
+    uint64_t submitted = 0; // writes queued so far
+    uint64_t finished = 0;  // writes whose completion ran
+    size_t pendingBytes = 0; // of the writes not finished
+    bool stopping = false;
+    std::atomic<uint64_t> temporaryCount{ 0 };
+
+    Metrics::Id writesTotal;
+    Metrics::Id bytesTotal;
+    Metrics::Id failedTotal;
+    Metrics::Id throttledTotal;
+    std::vector<Metrics::Gauge> gauges; // last: unregistered before what they read is destroyed
+};
@@ -0,0 +1,210 @@
+#include "TermDictionary.h"
+#include <algorithm>
+
+static void writeVarint(std::vector<uint8_t>& out, uint32_t value)
+{
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value | 0x80));
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static uint32_t readVarint(const uint8_t*& in)
+{
+    uint32_t value = 0;
+    for (int shift = 0;; shift += 7) {
+        uint8_t byte = *in++;
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if (!(byte & 0x80))
+            return value;
+    }
+}
+
+TermDictionary::TermDictionary()
+    : rebuilder(&TermDictionary::runRebuilds, this)
+{
+}
+
+TermDictionary::~TermDictionary()
+{
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        stopping = true;
+    }
+    changed.notify_all();
+    rebuilder.join();
+}
+
+void TermDictionary::addDocumentTerms(const std::vector<std::string>& terms)
+{
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        for (const auto& term : terms) {
+            if (!term.empty())
+                ++pending[term];
+        }
+    }
+    changed.notify_one();
+}
+
+void TermDictionary::removeDocuments(const std::string& term, uint32_t documents)
+{
+    {
+        std::lock_guard<std::mutex> lock(pendingMutex);
+        pending[term] -= static_cast<int32_t>(documents);
+    }
+    changed.notify_one();
+}
+
+void TermDictionary::runRebuilds()
+{
+    std::unique_lock<std::mutex> lock(pendingMutex);
+    while (true) {
+        changed.wait(lock, [this] { return stopping || !pending.empty(); });
+        if (stopping)
+            return;
+        std::unordered_map<std::string, int32_t> changes;
+        changes.swap(pending);
+        lock.unlock();
+        std::atomic_store(&snapshot, build(*current(), changes));
+        lock.lock();
+        // changes arriving meanwhile are merged together in the next round
+        changed.wait_for(lock, std::chrono::milliseconds(TERM_DICTIONARY_REFRESH_MS), [this] { return stopping; });
+    }
+}
+
+template<typename Visit>
+void TermDictionary::scanBlocks(const Snapshot& snapshot, size_t block, size_t end, Visit visit)
+{
+    std::string term;
+    for (end = std::min(end, snapshot.blockOffsets.size()); block < end; ++block) {
+        const uint8_t* in = snapshot.bytes.data() + snapshot.blockOffsets[block];
+        size_t first = block * TERM_BLOCK_SIZE;
+        size_t last = std::min(first + TERM_BLOCK_SIZE, snapshot.frequencies.size());
+        for (size_t ordinal = first; ordinal < last; ++ordinal) {
+            uint32_t shared = ordinal == first ? 0 : readVarint(in);
+            uint32_t suffix = readVarint(in);
+            term.resize(shared);
+            term.append(reinterpret_cast<const char*>(in), suffix);
+            in += suffix;
+            if (!visit(term, snapshot.frequencies[ordinal]))
+                return;
+        }
+    }
+}
+
+std::vector<TermDictionary::Entry> TermDictionary::decodeAll(const Snapshot& snapshot)
+{
+    std::vector<Entry> entries;
+    entries.reserve(snapshot.frequencies.size());
+    scanBlocks(snapshot, 0, snapshot.blockOffsets.size(), [&](const std::string& term, uint32_t frequency) {
+        entries.push_back({ term, frequency });
+        return true;
+    });
+    return entries;
+}
+
+TermDictionary::SnapshotPtr TermDictionary::build(const Snapshot& previous, const std::unordered_map<std::string, int32_t>& changes)
+{
+    std::vector<Entry> existing = decodeAll(previous);
+    std::vector<std::pair<std::string, int32_t>> added(changes.begin(), changes.end());
+    std::sort(added.begin(), added.end());
+
+    // merge the two sorted runs, applying changes to terms present in both; terms left
+    // in no document are dropped
+    std::vector<Entry> merged;
+    merged.reserve(existing.size() + added.size());
+    size_t i = 0, j = 0;
+    while (i < existing.size() || j < added.size()) {
+        if (j == added.size() || (i < existing.size() && existing[i].term < added[j].first)) {
+            merged.push_back(std::move(existing[i++]));
+        }
+        else if (i == existing.size() || added[j].first < existing[i].term) {
+            if (added[j].second > 0)
+                merged.push_back({ std::move(added[j].first), static_cast<uint32_t>(added[j].second) });
+            ++j;
+        }
+        else {
+            int64_t frequency = static_cast<int64_t>(existing[i].documentFrequency) + added[j++].second;
+            if (frequency > 0) {
+                existing[i].documentFrequency = static_cast<uint32_t>(frequency);
+                merged.push_back(std::move(existing[i]));
+            }
+            ++i;
+        }
+    }
+
+    auto snapshot = std::make_shared<Snapshot>();
+    snapshot->frequencies.reserve(merged.size());
+    const std::string* previousTerm = nullptr;
+    for (size_t ordinal = 0; ordinal < merged.size(); ++ordinal) {
+        const std::string& term = merged[ordinal].term;
+        if (ordinal % TERM_BLOCK_SIZE == 0) {
+            snapshot->blockOffsets.push_back(static_cast<uint32_t>(snapshot->bytes.size()));
+            snapshot->blockHeads.push_back(term);
+            writeVarint(snapshot->bytes, static_cast<uint32_t>(term.size()));
+            snapshot->bytes.insert(snapshot->bytes.end(), term.begin(), term.end());
+        }
+        else {
+            size_t shared = 0;
+            size_t maxShared = std::min(term.size(), previousTerm->size());
+            while (shared < maxShared && term[shared] == (*previousTerm)[shared])
+                ++shared;
+            writeVarint(snapshot->bytes, static_cast<uint32_t>(shared));
+            writeVarint(snapshot->bytes, static_cast<uint32_t>(term.size() - shared));
+            snapshot->bytes.insert(snapshot->bytes.end(), term.begin() + shared, term.end());
+        }
+        snapshot->frequencies.push_back(merged[ordinal].documentFrequency);
+        if (ordinal % TERM_BLOCK_SIZE == 0)
+            snapshot->blockMaxFrequency.push_back(0);
+        snapshot->blockMaxFrequency.back() = std::max(snapshot->blockMaxFrequency.back(), merged[ordinal].documentFrequency);
+        previousTerm = &term;
+    }
+    snapshot->bytes.shrink_to_fit();
+    return snapshot;
+}
+
+std::vector<TermDictionary::Entry> TermDictionary::withPrefix(const std::string& prefix, size_t limit)
+{
+    std::vector<Entry> found;
+    auto snap = current();
+    if (snap->blockHeads.empty() || limit == 0)
+        return found;
+
+    // the first match may sit inside the block before the first head >= prefix
+    size_t block = std::upper_bound(snap->blockHeads.begin(), snap->blockHeads.end(), prefix) - snap->blockHeads.begin();
+    block = block == 0 ? 0 : block - 1;
+
+    auto moreFrequent = [](const Entry& a, const Entry& b) {
+        return a.documentFrequency != b.documentFrequency ? a.documentFrequency > b.documentFrequency : a.term < b.term;
+    };
+    auto offer = [&](const std::string& term, uint32_t frequency) {
+        // min-heap on frequency keeps the 'limit' most frequent terms
+        if (found.size() < limit) {
+            found.push_back({ term, frequency });
+            std::push_heap(found.begin(), found.end(), moreFrequent);
+        }
+        else if (moreFrequent(Entry{ term, frequency }, found.front())) {
+            std::pop_heap(found.begin(), found.end(), moreFrequent);
+            found.back() = { term, frequency };
+            std::push_heap(found.begin(), found.end(), moreFrequent);
+        }
+    };
+    for (bool pastRange = false; block < snap->blockHeads.size() && !pastRange; ++block) {
+        if (snap->blockHeads[block].compare(0, prefix.size(), prefix) > 0)
+            break; // this block and every later one sort past the prefix range
+        // later blocks' terms sort after every term kept so far, so a tie loses as well
+        if (found.size() == limit && snap->blockMaxFrequency[block] <= found.front().documentFrequency)
+            continue;
+        scanBlocks(*snap, block, block + 1, [&](const std::string& term, uint32_t frequency) {
+            int order = term.compare(0, prefix.size(), prefix);
+            if (order == 0)
+                offer(term, frequency);
+            pastRange = order > 0;
+            return !pastRange;
+        });
+    }
+    std::sort(found.begin(), found.end(), moreFrequent);
+    return found;
+}
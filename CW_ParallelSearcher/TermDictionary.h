@@ -0,0 +1,72 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <cstdint>
+#define TERM_BLOCK_SIZE 16
+#define TERM_DICTIONARY_REFRESH_MS 1000
+
+// Ordered dictionary of every indexed word with its document frequency, kept next to
+// the hash index so prefix lookups (typeahead, "term*" expansion) do not need a full scan.
+//
+// Terms live in an immutable, front-coded snapshot: sorted terms are grouped in blocks
+// of TERM_BLOCK_SIZE, the first term of a block is stored whole and the others only as
+// (shared prefix length, suffix). New terms and frequency changes collect in a small
+// pending map; a background thread merges them into a fresh snapshot as soon as some
+// arrive, then at most every TERM_DICTIONARY_REFRESH_MS, so lookups never rebuild.
+// Deleted documents are taken off again once compaction has dropped their postings.
+class TermDictionary
+{
+public:
+    struct Entry {
+        std::string term;
+        uint32_t documentFrequency;
+    };
+
+    TermDictionary();
+    ~TermDictionary();
+    TermDictionary(const TermDictionary&) = delete;
+    TermDictionary& operator=(const TermDictionary&) = delete;
+
+    // Counts one more document for each of the given (distinct) terms.
+    void addDocumentTerms(const std::vector<std::string>& terms);
+    // Counts 'documents' fewer for term; a term left in no document is dropped.
+    void removeDocuments(const std::string& term, uint32_t documents);
+
+    // The 'limit' most frequent terms starting with prefix, most frequent first. Blocks
+    // whose most frequent term cannot make the list are skipped without being decoded,
+    // which keeps very short prefixes cheap.
+    std::vector<Entry> withPrefix(const std::string& prefix, size_t limit);
+
+private:
+    struct Snapshot {
+        std::vector<uint8_t> bytes;          // front-coded blocks
+        std::vector<uint32_t> blockOffsets;  // start of each block in bytes
+        std::vector<std::string> blockHeads; // first term of each block, for binary search
+        std::vector<uint32_t> frequencies;   // by term ordinal
+        std::vector<uint32_t> blockMaxFrequency;
+    };
+    using SnapshotPtr = std::shared_ptr<const Snapshot>;
+
+    SnapshotPtr current() const { return std::atomic_load(&snapshot); }
+    void runRebuilds();
+    static SnapshotPtr build(const Snapshot& previous, const std::unordered_map<std::string, int32_t>& pending);
+    static std::vector<Entry> decodeAll(const Snapshot& snapshot);
+
+    // Decodes blocks [block, end) in order while visit(term, frequency) returns true.
+    template<typename Visit>
+    static void scanBlocks(const Snapshot& snapshot, size_t block, size_t end, Visit visit);
+
+    SnapshotPtr snapshot = std::make_shared<const Snapshot>();
+
+    std::mutex pendingMutex;
+    std::condition_variable changed; // pending got a change, or stopping
+    std::unordered_map<std::string, int32_t> pending; // df changes since the last rebuild
+    bool stopping = false;
+    std::thread rebuilder; // last member: started once the others exist
+};
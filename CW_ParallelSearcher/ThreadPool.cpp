@@ -2,6 +2,14 @@
 
 ThreadPool::ThreadPool(size_t threads)
 {
+	auto& metrics = Metrics::instance();
+	waitHistogram = metrics.histogram("threadpool_task_wait_seconds",
+		"Time a task waits in the queue before a worker starts it");
+	gauges.push_back(metrics.gauge("threadpool_queue_depth", "Tasks waiting for a worker",
+		[this]() { return static_cast<double>(queueDepth.load(std::memory_order_relaxed)); }));
+	gauges.push_back(metrics.gauge("threadpool_workers", "Worker threads in the pool",
+		[threads]() { return static_cast<double>(threads); }));
+
 	for (size_t i = 0; i < threads; ++i)
 		workers.emplace_back(&ThreadPool::workerLoop, this);
 }
@@ -22,11 +30,64 @@ void ThreadPool::stopPool()
 	}
 }
 
+void ThreadPool::parallelFor(size_t count, size_t maxHelpers, const std::function<void(size_t)>& body)
+{
+    if (count == 0)
+        return;
+
+    // a helper that starts after the last index was claimed finds nothing to do; one
+    // that claims an index runs before the caller can return, so 'body' is still alive
+    struct State {
+        const std::function<void(size_t)>* body;
+        size_t count;
+        std::atomic<size_t> next{ 0 };
+        std::mutex mtx;
+        std::condition_variable allDone;
+        size_t finished = 0;
+        std::exception_ptr error;
+    };
+    auto state = std::make_shared<State>();
+    state->body = &body;
+    state->count = count;
+
+    auto work = [state]() {
+        for (size_t i = state->next++; i < state->count; i = state->next++) {
+            std::exception_ptr error;
+            try {
+                (*state->body)(i);
+            }
+            catch (...) {
+                error = std::current_exception();
+            }
+            std::lock_guard<std::mutex> lock(state->mtx);
+            if (error && !state->error)
+                state->error = error;
+            if (++state->finished == state->count)
+                state->allDone.notify_all();
+        }
+    };
+
+    for (size_t i = 0; i < std::min(maxHelpers, count - 1); ++i) {
+        try {
+            enqueue(work);
+        }
+        catch (const std::runtime_error&) {
+            break; // stopping: the caller does the rest
+        }
+    }
+    work();
+
+    std::unique_lock<std::mutex> lock(state->mtx);
+    state->allDone.wait(lock, [&state]() { return state->finished == state->count; });
+    if (state->error)
+        std::rethrow_exception(state->error);
+}
+
 void ThreadPool::workerLoop()
 {
     
     while (true) {
-        std::function<void()> task;
+        QueuedTask task;
 
         //std::cout << "Iteration started" << std::endl;
         {
@@ -43,7 +104,9 @@ void ThreadPool::workerLoop()
 
             task = std::move(tasks.front());
             tasks.pop();
+            queueDepth.store(tasks.size(), std::memory_order_relaxed);
         }
-        task();
+        Metrics::instance().observe(waitHistogram, Metrics::microsSince(task.queuedAt));
+        task.run();
     }
 }
\ No newline at end of file
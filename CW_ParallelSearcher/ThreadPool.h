@@ -8,6 +8,8 @@
 #include <functional>
 #include <atomic>
 #include <iostream>
+#include <chrono>
+#include "Metrics.h"
 
 class ThreadPool {
 public:
@@ -19,15 +21,30 @@ public:
         -> std::future<std::_Invoke_result_t<F, Args...>>;
 
     void stopPool();
+    size_t size() const { return workers.size(); }
+
+    // Runs body(0) .. body(count - 1) on the calling thread and up to maxHelpers workers,
+    // and returns once every call has finished; the first exception thrown is rethrown.
+    // The caller claims indices too and never waits for a helper to start, so a pool task
+    // may call this even when every other worker is busy.
+    void parallelFor(size_t count, size_t maxHelpers, const std::function<void(size_t)>& body);
 
 private:
+    struct QueuedTask {
+        std::function<void()> run;
+        std::chrono::steady_clock::time_point queuedAt;
+    };
+
     std::vector<std::thread> workers;
-    std::queue<std::function<void()>> tasks;
+    std::queue<QueuedTask> tasks;
+    std::atomic<size_t> queueDepth{ 0 }; // mirrors tasks.size() for lock-free sampling
+    Metrics::Id waitHistogram;
 
     std::mutex queueMutex;
     std::condition_variable condition;
 
     std::atomic<bool> stop{ false };
+    std::vector<Metrics::Gauge> gauges; // last: unregistered before what they read is destroyed
 
 private:
     void workerLoop();
@@ -51,7 +68,8 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
         if (stop.load())
             throw std::runtime_error("enqueue on stopped ThreadPool");
 
-        tasks.emplace([taskPtr]() { (*taskPtr)(); });
+        tasks.push({ [taskPtr]() { (*taskPtr)(); }, std::chrono::steady_clock::now() });
+        queueDepth.store(tasks.size(), std::memory_order_relaxed);
         if (tasks.size() == 0) {
 			std::cout << "Task queue is empty after enqueue!" << std::endl;
         }
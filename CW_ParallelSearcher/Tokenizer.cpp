@@ -0,0 +1,372 @@
+#include "Tokenizer.h"
+#include <array>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define TOKENIZER_SSE2 1
+#include <emmintrin.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+namespace
+{
+    enum CharClass : uint8_t { Space, Plain, Upper, Drop, High };
+
+    constexpr std::array<uint8_t, 256> makeClasses()
+    {
+        std::array<uint8_t, 256> classes{};
+        for (int c = 0; c < 256; ++c) {
+            if (c == ' ' || (c >= '\t' && c <= '\r'))
+                classes[c] = Space;
+            else if ((c >= 'a' && c <= 'z') || (c >= '0' && c <= '9') || c == '-' || c == '\'')
+                classes[c] = Plain;
+            else if (c >= 'A' && c <= 'Z')
+                classes[c] = Upper;
+            else if (c >= 0x80)
+                classes[c] = High;
+            else
+                classes[c] = Drop;
+        }
+        return classes;
+    }
+    constexpr std::array<uint8_t, 256> charClasses = makeClasses();
+
+    inline uint8_t classOf(char c) { return charClasses[static_cast<unsigned char>(c)]; }
+
+    // appends the cleaned bytes of the ASCII word [begin, end) to out
+    inline void cleanAsciiInto(const char* begin, const char* end, std::string& out)
+    {
+        for (; begin != end; ++begin) {
+            switch (classOf(*begin)) {
+            case Plain: out.push_back(*begin); break;
+            case Upper: out.push_back(static_cast<char>(*begin | 0x20)); break;
+            default: break;
+            }
+        }
+    }
+
+    // --- non-ASCII words ----------------------------------------------------------------
+
+    // Decodes the code point at p; returns its length, 0 for an invalid or truncated sequence.
+    size_t decodeUtf8(const unsigned char* p, const unsigned char* end, uint32_t& codePoint)
+    {
+        size_t length;
+        uint32_t min;
+        if (p[0] < 0x80) {
+            codePoint = p[0];
+            return 1;
+        }
+        else if ((p[0] & 0xE0) == 0xC0) { length = 2; min = 0x80; codePoint = p[0] & 0x1F; }
+        else if ((p[0] & 0xF0) == 0xE0) { length = 3; min = 0x800; codePoint = p[0] & 0x0F; }
+        else if ((p[0] & 0xF8) == 0xF0) { length = 4; min = 0x10000; codePoint = p[0] & 0x07; }
+        else return 0;
+        if (static_cast<size_t>(end - p) < length)
+            return 0;
+        for (size_t i = 1; i < length; ++i) {
+            if ((p[i] & 0xC0) != 0x80)
+                return 0;
+            codePoint = codePoint << 6 | (p[i] & 0x3F);
+        }
+        // overlong forms and surrogates are as invalid as stray bytes
+        if (codePoint < min || codePoint > 0x10FFFF || (codePoint >= 0xD800 && codePoint <= 0xDFFF))
+            return 0;
+        return length;
+    }
+
+    void encodeUtf8(uint32_t codePoint, std::string& out)
+    {
+        if (codePoint < 0x80) {
+            out.push_back(static_cast<char>(codePoint));
+        }
+        else if (codePoint < 0x800) {
+            out.push_back(static_cast<char>(0xC0 | codePoint >> 6));
+            out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else if (codePoint < 0x10000) {
+            out.push_back(static_cast<char>(0xE0 | codePoint >> 12));
+            out.push_back(static_cast<char>(0x80 | (codePoint >> 6 & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+        else {
+            out.push_back(static_cast<char>(0xF0 | codePoint >> 18));
+            out.push_back(static_cast<char>(0x80 | (codePoint >> 12 & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (codePoint >> 6 & 0x3F)));
+            out.push_back(static_cast<char>(0x80 | (codePoint & 0x3F)));
+        }
+    }
+
+    bool isUnicodeSpace(uint32_t c)
+    {
+        return c == 0x85 || c == 0xA0 || c == 0x1680 || (c >= 0x2000 && c <= 0x200A) ||
+            c == 0x2028 || c == 0x2029 || c == 0x202F || c == 0x205F || c == 0x3000;
+    }
+
+    // Punctuation, symbol, private-use and emoji blocks are dropped like ASCII punctuation;
+    // everything else (letters, digits and combining marks of any script) is kept.
+    bool isWordCodePoint(uint32_t c)
+    {
+        if (c < 0x80)
+            return charClasses[c] == Plain || charClasses[c] == Upper;
+        if (c < 0xC0)
+            return c == 0xAA || c == 0xB5 || c == 0xBA;
+        return c != 0xD7 && c != 0xF7 &&
+            !(c >= 0x2000 && c <= 0x2BFF) &&   // general punctuation ... miscellaneous symbols and arrows
+            !(c >= 0x2E00 && c <= 0x2E7F) &&   // supplemental punctuation
+            !(c >= 0x3000 && c <= 0x303F) &&   // CJK symbols and punctuation
+            !(c >= 0xE000 && c <= 0xF8FF) &&   // private use
+            !(c >= 0xFE30 && c <= 0xFE4F) &&   // CJK compatibility forms
+            !(c >= 0xFFF0 && c <= 0xFFFF) &&   // specials
+            !(c >= 0x1F000 && c <= 0x1FAFF);   // emoji and pictographs
+    }
+
+    // Simple case folding (one code point to one, never to a longer encoding) for Latin,
+    // Greek, Cyrillic, Armenian and fullwidth Latin; other scripts are left as they are.
+    // Typographic apostrophes and hyphens fold to their ASCII forms, which words keep.
+    uint32_t foldCase(uint32_t c)
+    {
+        if (c < 0x80)
+            return c >= 'A' && c <= 'Z' ? c + 0x20 : c;
+        if (c < 0x100) {
+            if (c == 0xB5)
+                return 0x3BC; // micro sign -> mu
+            return c >= 0xC0 && c <= 0xDE && c != 0xD7 ? c + 0x20 : c;
+        }
+        if (c < 0x180) {
+            if (c == 0x130 || c == 0x138 || c == 0x149)
+                return c;
+            if (c == 0x178)
+                return 0xFF;
+            if (c == 0x17F)
+                return 's';
+            if ((c >= 0x139 && c <= 0x148) || (c >= 0x179 && c <= 0x17E))
+                return c & 1 ? c + 1 : c;
+            return c & 1 ? c : c + 1;
+        }
+        if (c == 0x2BC || c == 0x2019)
+            return '\'';
+        if (c == 0x2010 || c == 0x2011)
+            return '-';
+        if (c >= 0x370 && c < 0x400) {
+            if (c >= 0x391 && c <= 0x3AB && c != 0x3A2)
+                return c + 0x20;
+            if (c == 0x386)
+                return 0x3AC;
+            if (c >= 0x388 && c <= 0x38A)
+                return c + 0x25;
+            if (c == 0x38C)
+                return 0x3CC;
+            if (c == 0x38E || c == 0x38F)
+                return c + 0x3F;
+            if (c == 0x3C2)
+                return 0x3C3; // final sigma
+            return c;
+        }
+        if (c >= 0x400 && c < 0x530) {
+            if (c < 0x410)
+                return c + 0x50;
+            if (c < 0x430)
+                return c + 0x20;
+            if (c < 0x460)
+                return c;
+            if (c == 0x4C0)
+                return 0x4CF;
+            if (c >= 0x4C1 && c <= 0x4CE)
+                return c & 1 ? c + 1 : c;
+            if ((c >= 0x460 && c <= 0x481) || c >= 0x48A)
+                return c & 1 ? c : c + 1;
+            return c;
+        }
+        if (c >= 0x531 && c <= 0x556)
+            return c + 0x30;
+        if (c >= 0x1E00 && c <= 0x1EFF) {
+            if (c == 0x1E9E)
+                return 0xDF; // capital sharp s
+            if (c >= 0x1E96 && c <= 0x1E9F)
+                return c;
+            return c & 1 ? c : c + 1;
+        }
+        if (c >= 0xFF21 && c <= 0xFF3A)
+            return c + 0x20;
+        return c;
+    }
+
+    // Cleans the code point at p into out and returns the bytes it took; an invalid
+    // byte is dropped on its own. space is set for a Unicode space, which adds nothing.
+    size_t cleanCodePoint(const unsigned char* p, const unsigned char* end, std::string& out, bool& space)
+    {
+        uint32_t codePoint;
+        size_t length = decodeUtf8(p, end, codePoint);
+        space = false;
+        if (length == 0)
+            return 1;
+        if (isUnicodeSpace(codePoint)) {
+            space = true;
+            return length;
+        }
+        codePoint = foldCase(codePoint);
+        if (isWordCodePoint(codePoint))
+            encodeUtf8(codePoint, out);
+        return length;
+    }
+
+#ifdef TOKENIZER_SSE2
+    inline unsigned lowestBit(uint32_t mask)
+    {
+#ifdef _MSC_VER
+        unsigned long index;
+        _BitScanForward(&index, mask);
+        return static_cast<unsigned>(index);
+#else
+        return static_cast<unsigned>(__builtin_ctz(mask));
+#endif
+    }
+
+    // unsigned lo <= v <= hi per byte, as 0xFF / 0x00
+    inline __m128i inRange(__m128i v, char lo, char hi)
+    {
+        __m128i shifted = _mm_sub_epi8(v, _mm_set1_epi8(lo));
+        return _mm_cmpeq_epi8(_mm_min_epu8(shifted, _mm_set1_epi8(static_cast<char>(hi - lo))), shifted);
+    }
+
+    inline uint32_t spaceMask(__m128i v)
+    {
+        __m128i spaces = _mm_or_si128(inRange(v, '\t', '\r'), _mm_cmpeq_epi8(v, _mm_set1_epi8(' ')));
+        return static_cast<uint32_t>(_mm_movemask_epi8(spaces));
+    }
+
+    inline uint32_t plainMask(__m128i v)
+    {
+        __m128i plain = _mm_or_si128(inRange(v, 'a', 'z'), inRange(v, '0', '9'));
+        plain = _mm_or_si128(plain, _mm_cmpeq_epi8(v, _mm_set1_epi8('-')));
+        plain = _mm_or_si128(plain, _mm_cmpeq_epi8(v, _mm_set1_epi8('\'')));
+        return static_cast<uint32_t>(_mm_movemask_epi8(plain));
+    }
+
+    inline __m128i load16(const char* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+#endif
+
+    size_t skipSpaces(const char* data, size_t size, size_t pos)
+    {
+#ifdef TOKENIZER_SSE2
+        for (; pos + 16 <= size; pos += 16) {
+            uint32_t words = ~spaceMask(load16(data + pos)) & 0xFFFF;
+            if (words)
+                return pos + lowestBit(words);
+        }
+#endif
+        while (pos < size && classOf(data[pos]) == Space)
+            ++pos;
+        return pos;
+    }
+
+    // Returns the end of the word starting at pos (at ASCII whitespace); plain is cleared
+    // if any byte of it would change when cleaned, ascii if any byte is not ASCII.
+    size_t scanWord(const char* data, size_t size, size_t pos, bool& plain, bool& ascii)
+    {
+#ifdef TOKENIZER_SSE2
+        for (; pos + 16 <= size; pos += 16) {
+            __m128i block = load16(data + pos);
+            uint32_t spaces = spaceMask(block);
+            uint32_t word = spaces ? (1u << lowestBit(spaces)) - 1 : 0xFFFF;
+            if ((plainMask(block) & word) != word)
+                plain = false;
+            if (static_cast<uint32_t>(_mm_movemask_epi8(block)) & word)
+                ascii = false;
+            if (spaces)
+                return pos + lowestBit(spaces);
+        }
+#endif
+        for (; pos < size; ++pos) {
+            uint8_t charClass = classOf(data[pos]);
+            if (charClass == Space)
+                break;
+            if (charClass != Plain)
+                plain = false;
+            if (charClass == High)
+                ascii = false;
+        }
+        return pos;
+    }
+}
+
+const std::vector<Tokenizer::Token>& Tokenizer::tokenize(std::string_view text)
+{
+    _tokens.clear();
+    _tokens.reserve(text.size() / 6 + 1);
+    // cleaned words never add up to more than the text (folding never lengthens a code
+    // point), so the arena never reallocates and views into it stay put
+    _arena.clear();
+    _arena.reserve(text.size());
+
+    const char* data = text.data();
+    const size_t size = text.size();
+    for (size_t pos = skipSpaces(data, size, 0); pos < size; pos = skipSpaces(data, size, pos)) {
+        size_t start = pos;
+        bool plain = true;
+        bool ascii = true;
+        pos = scanWord(data, size, pos, plain, ascii);
+        if (!ascii) {
+            addUnicodeWords(data, start, pos);
+            continue;
+        }
+
+        std::string_view word(data + start, pos - start);
+        if (!plain) {
+            size_t begin = _arena.size();
+            cleanAsciiInto(data + start, data + pos, _arena);
+            word = std::string_view(_arena.data() + begin, _arena.size() - begin);
+        }
+        _tokens.push_back({ static_cast<uint32_t>(start), static_cast<uint32_t>(pos - start), word });
+    }
+    return _tokens;
+}
+
+// [begin, end) holds no ASCII whitespace but may hold Unicode spaces, which split it further.
+void Tokenizer::addUnicodeWords(const char* data, size_t begin, size_t end)
+{
+    auto text = reinterpret_cast<const unsigned char*>(data);
+    size_t wordStart = begin;
+    size_t cleanedStart = _arena.size();
+    for (size_t pos = begin; pos < end;) {
+        bool space;
+        size_t length = cleanCodePoint(text + pos, text + end, _arena, space);
+        if (space) {
+            if (pos > wordStart) {
+                _tokens.push_back({ static_cast<uint32_t>(wordStart), static_cast<uint32_t>(pos - wordStart),
+                    std::string_view(_arena.data() + cleanedStart, _arena.size() - cleanedStart) });
+            }
+            wordStart = pos + length;
+            cleanedStart = _arena.size();
+        }
+        pos += length;
+    }
+    if (end > wordStart) {
+        _tokens.push_back({ static_cast<uint32_t>(wordStart), static_cast<uint32_t>(end - wordStart),
+            std::string_view(_arena.data() + cleanedStart, _arena.size() - cleanedStart) });
+    }
+}
+
+size_t Tokenizer::boundaryAfter(std::string_view text, size_t pos)
+{
+    while (pos < text.size() && classOf(text[pos]) != Space)
+        ++pos;
+    return std::min(pos, text.size());
+}
+
+bool Tokenizer::isSpace(char c)
+{
+    return classOf(c) == Space;
+}
+
+std::string Tokenizer::clean(std::string_view word)
+{
+    std::string cleaned;
+    cleaned.reserve(word.size());
+    auto p = reinterpret_cast<const unsigned char*>(word.data());
+    auto end = p + word.size();
+    while (p < end) {
+        bool space;
+        p += cleanCodePoint(p, end, cleaned, space);
+    }
+    return cleaned;
+}
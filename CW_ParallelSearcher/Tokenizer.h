@@ -0,0 +1,40 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstdint>
+
+// Splits UTF-8 text into words at whitespace and cleans each word in the same pass:
+// letters and digits of any script are kept and case-folded, '-' and '\'' kept, any other
+// punctuation or symbol dropped, and so are invalid bytes. All-ASCII words never get
+// decoded: A-Z are lowercased and the rest classified by table. A word that needs no
+// cleaning is a view into the text itself; the others are written once into an arena
+// sized for the whole text, so tokenizing a file allocates twice at most.
+// A word that cleans to nothing keeps its position, so phrase positions match the text.
+class Tokenizer
+{
+public:
+    struct Token {
+        uint32_t byteOffset;  // of the raw word in the text
+        uint32_t rawLength;
+        std::string_view word; // cleaned
+    };
+
+    // Views returned stay valid until the next tokenize() and as long as the text lives.
+    const std::vector<Token>& tokenize(std::string_view text);
+    const std::vector<Token>& tokens() const { return _tokens; }
+
+    // one word, cleaned the same way
+    static std::string clean(std::string_view word);
+    // First ASCII whitespace at or after pos (text.size() if none): text split there
+    // tokenizes exactly as the whole, chunk by chunk.
+    static size_t boundaryAfter(std::string_view text, size_t pos);
+    // the ASCII whitespace boundaryAfter stops at
+    static bool isSpace(char c);
+
+private:
+    void addUnicodeWords(const char* data, size_t begin, size_t end);
+
+    std::vector<Token> _tokens;
+    std::string _arena;
+};
@@ -0,0 +1,279 @@
+#include "TrigramIndex.h"
+#include <algorithm>
+#include <iterator>
+#include <cctype>
+
+static inline uint8_t asciiLower(uint8_t c)
+{
+    return c >= 'A' && c <= 'Z' ? static_cast<uint8_t>(c + ('a' - 'A')) : c;
+}
+
+static inline uint32_t trigramAt(std::string_view text, size_t i)
+{
+    return static_cast<uint32_t>(asciiLower(text[i])) << 16 |
+        static_cast<uint32_t>(asciiLower(text[i + 1])) << 8 |
+        asciiLower(text[i + 2]);
+}
+
+TrigramIndex::TrigramIndex(size_t numShards)
+{
+    _shards.reserve(numShards);
+    for (size_t i = 0; i < numShards; ++i)
+        _shards.push_back(std::make_unique<Shard>());
+}
+
+std::vector<uint32_t> TrigramIndex::trigramsOf(std::string_view text, size_t begin, size_t end)
+{
+    std::vector<uint32_t> trigrams;
+    end = text.size() < 2 ? 0 : std::min(end, text.size() - 2);
+    if (begin >= end)
+        return trigrams;
+    trigrams.reserve(end - begin);
+    for (size_t i = begin; i < end; ++i)
+        trigrams.push_back(trigramAt(text, i));
+    std::sort(trigrams.begin(), trigrams.end());
+    trigrams.erase(std::unique(trigrams.begin(), trigrams.end()), trigrams.end());
+    return trigrams;
+}
+
+void TrigramIndex::addDocument(uint32_t fileID, const std::vector<uint32_t>& trigrams)
+{
+    // one lock acquisition per shard rather than per trigram
+    std::vector<std::vector<uint32_t>> byShard(_shards.size());
+    for (uint32_t trigram : trigrams)
+        byShard[shardOf(trigram)].push_back(trigram);
+
+    size_t added = 0;
+    for (size_t s = 0; s < byShard.size(); ++s) {
+        if (byShard[s].empty())
+            continue;
+        Shard& shard = *_shards[s];
+        std::unique_lock<std::shared_mutex> lock(shard.mtx);
+        for (uint32_t trigram : byShard[s]) {
+            FileIDs& files = shard.map[trigram];
+            if (files.empty())
+                ++added;
+            // kept ascending and distinct: files finish indexing about in ID order, and one
+            // that grew comes again with the trigrams of what was appended
+            if (files.empty() || files.back() < fileID) {
+                files.push_back(fileID);
+                continue;
+            }
+            auto at = std::lower_bound(files.begin(), files.end(), fileID);
+            if (*at != fileID)
+                files.insert(at, fileID);
+        }
+    }
+    _trigrams.fetch_add(added, std::memory_order_relaxed);
+}
+
+TrigramIndex::FileIDs TrigramIndex::lookup(uint32_t trigram) const
+{
+    FileIDs files;
+    {
+        const Shard& shard = *_shards[shardOf(trigram)];
+        std::shared_lock<std::shared_mutex> lock(shard.mtx);
+        auto it = shard.map.find(trigram);
+        if (it != shard.map.end())
+            files = it->second;
+    }
+    return files;
+}
+
+static void intersectInto(TrigramIndex::FileIDs& files, const TrigramIndex::FileIDs& other)
+{
+    TrigramIndex::FileIDs both;
+    std::set_intersection(files.begin(), files.end(), other.begin(), other.end(), std::back_inserter(both));
+    files.swap(both);
+}
+
+bool TrigramIndex::evaluate(const Query& query, FileIDs& files) const
+{
+    if (query.type == Query::Type::All)
+        return false;
+
+    if (query.type == Query::Type::Or) {
+        files.clear();
+        for (const auto& child : query.children) {
+            FileIDs childFiles;
+            if (!evaluate(child, childFiles))
+                return false;
+            FileIDs merged;
+            std::set_union(files.begin(), files.end(), childFiles.begin(), childFiles.end(), std::back_inserter(merged));
+            files.swap(merged);
+        }
+        return true;
+    }
+
+    // And: intersect the rarest lists first so the running set shrinks quickly
+    std::vector<FileIDs> lists;
+    for (uint32_t trigram : query.trigrams)
+        lists.push_back(lookup(trigram));
+    for (const auto& child : query.children) {
+        FileIDs childFiles;
+        if (evaluate(child, childFiles))
+            lists.push_back(std::move(childFiles));
+    }
+    if (lists.empty())
+        return false;
+    std::sort(lists.begin(), lists.end(), [](const FileIDs& a, const FileIDs& b) { return a.size() < b.size(); });
+    files = std::move(lists.front());
+    for (size_t i = 1; i < lists.size() && !files.empty(); ++i)
+        intersectInto(files, lists[i]);
+    return true;
+}
+
+bool TrigramIndex::candidates(const Query& query, FileIDs& files) const
+{
+    files.clear();
+    return evaluate(query, files);
+}
+
+// --- regex analysis -------------------------------------------------------------------
+
+static TrigramIndex::Query parseAlternation(const std::string& p, size_t& i);
+
+static void flushRun(std::string& run, TrigramIndex::Query& query)
+{
+    for (size_t j = 0; j + 2 < run.size(); ++j)
+        query.trigrams.push_back(trigramAt(run, j));
+    run.clear();
+}
+
+// Skips a quantifier at p[i], if any, and returns its minimum repeat count (1 without one).
+static size_t skipQuantifier(const std::string& p, size_t& i)
+{
+    size_t min = 1;
+    if (i >= p.size())
+        return min;
+    if (p[i] == '*' || p[i] == '?') {
+        min = 0;
+        ++i;
+    }
+    else if (p[i] == '+') {
+        ++i;
+    }
+    else if (p[i] == '{' && i + 1 < p.size() && std::isdigit(static_cast<unsigned char>(p[i + 1]))) {
+        min = 0;
+        for (++i; i < p.size() && std::isdigit(static_cast<unsigned char>(p[i])); ++i)
+            min = std::min<size_t>(min * 10 + (p[i] - '0'), 1000);
+        while (i < p.size() && p[i] != '}')
+            ++i;
+        ++i;
+    }
+    else {
+        return min;
+    }
+    if (i < p.size() && p[i] == '?') // lazy
+        ++i;
+    return min;
+}
+
+static TrigramIndex::Query parseSequence(const std::string& p, size_t& i)
+{
+    TrigramIndex::Query query;
+    query.type = TrigramIndex::Query::Type::And;
+    std::string run;
+
+    while (i < p.size() && p[i] != '|' && p[i] != ')') {
+        char c = p[i];
+        bool literal = false;
+        bool group = false;
+        TrigramIndex::Query sub;
+
+        if (c == '(') {
+            ++i;
+            bool lookaround = false;
+            if (i + 1 < p.size() && p[i] == '?') {
+                lookaround = p[i + 1] == '=' || p[i + 1] == '!';
+                i += 2;
+            }
+            sub = parseAlternation(p, i);
+            if (i < p.size() && p[i] == ')')
+                ++i;
+            if (lookaround)
+                sub = TrigramIndex::Query();
+            group = true;
+        }
+        else if (c == '[') {
+            ++i;
+            if (i < p.size() && p[i] == '^')
+                ++i;
+            if (i < p.size() && p[i] == ']')
+                ++i;
+            for (; i < p.size() && p[i] != ']'; ++i) {
+                if (p[i] == '\\')
+                    ++i;
+            }
+            ++i;
+        }
+        else if (c == '\\' && i + 1 < p.size()) {
+            char e = p[i + 1];
+            i += 2;
+            switch (e) {
+            case 'n': c = '\n'; literal = true; break;
+            case 't': c = '\t'; literal = true; break;
+            case 'r': c = '\r'; literal = true; break;
+            case 'f': c = '\f'; literal = true; break;
+            case 'v': c = '\v'; literal = true; break;
+            case 'x': i += 2; break;
+            case 'u': i += 4; break;
+            case 'c': i += 1; break;
+            default:
+                // \d \w \s \b, back-references and \0 are not literal bytes
+                literal = !std::isalnum(static_cast<unsigned char>(e));
+                c = e;
+                break;
+            }
+        }
+        else {
+            ++i;
+            literal = c != '.' && c != '^' && c != '$';
+        }
+
+        size_t atomEnd = i;
+        size_t min = skipQuantifier(p, i);
+        bool quantified = i != atomEnd;
+        if (literal && min > 0) {
+            run += c;
+            if (quantified)
+                flushRun(run, query); // repeated: what follows is not necessarily adjacent
+            continue;
+        }
+        flushRun(run, query);
+        if (group && min > 0 && sub.type != TrigramIndex::Query::Type::All)
+            query.children.push_back(std::move(sub));
+    }
+    flushRun(run, query);
+
+    if (query.trigrams.empty() && query.children.empty())
+        query.type = TrigramIndex::Query::Type::All;
+    return query;
+}
+
+static TrigramIndex::Query parseAlternation(const std::string& p, size_t& i)
+{
+    TrigramIndex::Query query;
+    query.type = TrigramIndex::Query::Type::Or;
+    query.children.push_back(parseSequence(p, i));
+    while (i < p.size() && p[i] == '|') {
+        ++i;
+        query.children.push_back(parseSequence(p, i));
+    }
+    // one unrestricted branch makes the whole alternation unrestricted
+    for (const auto& branch : query.children) {
+        if (branch.type == TrigramIndex::Query::Type::All)
+            return TrigramIndex::Query();
+    }
+    if (query.children.size() == 1) {
+        TrigramIndex::Query only = std::move(query.children.front());
+        return only;
+    }
+    return query;
+}
+
+TrigramIndex::Query TrigramIndex::compile(const std::string& pattern)
+{
+    size_t i = 0;
+    return parseAlternation(pattern, i);
+}
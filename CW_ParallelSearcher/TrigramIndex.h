@@ -0,0 +1,92 @@
+#pragma once
+#include <string>
+#include <string_view>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <shared_mutex>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <algorithm>
+#define TRIGRAM_SHARDS 64
+
+// Secondary index from every 3-byte sequence of the raw file text to the files containing
+// it, for substring and regex search over text the word tokenizer splits up or drops.
+// Bytes are ASCII-lowercased on both sides, so candidates are a superset of the files a
+// case-sensitive or case-insensitive pattern can match; the caller verifies each candidate.
+class TrigramIndex
+{
+public:
+    using FileIDs = std::vector<uint32_t>; // ascending
+
+    // Trigram requirement derived from a regex: files must contain every trigram of
+    // 'trigrams' and satisfy every child; an Or node needs any one child. All places
+    // no restriction (the pattern has no literal run of three or more bytes).
+    struct Query {
+        enum class Type { All, And, Or };
+        Type type = Type::All;
+        std::vector<uint32_t> trigrams;
+        std::vector<Query> children;
+    };
+
+    explicit TrigramIndex(size_t numShards = TRIGRAM_SHARDS);
+    TrigramIndex(const TrigramIndex&) = delete;
+    TrigramIndex& operator=(const TrigramIndex&) = delete;
+
+    // Sorted, distinct trigrams starting at [begin, end) of text; the last two may reach
+    // past end. Chunks of one file can be collected in parallel and merged.
+    static std::vector<uint32_t> trigramsOf(std::string_view text, size_t begin, size_t end);
+    // May be called again for a file that grew, with the trigrams of what was appended.
+    void addDocument(uint32_t fileID, const std::vector<uint32_t>& trigrams);
+    // Drops the files dead(fileID) selects from every trigram, one shard at a time.
+    template<typename Dead>
+    size_t removeFiles(Dead dead);
+
+    // Builds the trigram query for an ECMAScript regex. Only literal runs the pattern
+    // cannot match without are used; everything else (classes, '.', optional atoms)
+    // breaks a run. Never rejects a pattern: when in doubt the result is less selective.
+    static Query compile(const std::string& pattern);
+
+    // Files that may match; false when the query does not restrict the candidates.
+    bool candidates(const Query& query, FileIDs& files) const;
+
+    size_t size() const { return _trigrams.load(std::memory_order_relaxed); }
+
+private:
+    struct Shard {
+        mutable std::shared_mutex mtx;
+        std::unordered_map<uint32_t, FileIDs> map; // each list ascending and distinct
+    };
+
+    FileIDs lookup(uint32_t trigram) const;
+    bool evaluate(const Query& query, FileIDs& files) const;
+    size_t shardOf(uint32_t trigram) const { return (trigram * 2654435761u >> 8) % _shards.size(); }
+
+    std::vector<std::unique_ptr<Shard>> _shards;
+    std::atomic<size_t> _trigrams{ 0 };
+};
+
+template<typename Dead>
+size_t TrigramIndex::removeFiles(Dead dead)
+{
+    size_t removed = 0, emptied = 0;
+    for (auto& shard : _shards) {
+        std::unique_lock<std::shared_mutex> lock(shard->mtx);
+        for (auto it = shard->map.begin(); it != shard->map.end();) {
+            FileIDs& files = it->second;
+            size_t before = files.size();
+            files.erase(std::remove_if(files.begin(), files.end(), dead), files.end());
+            removed += before - files.size();
+            if (files.empty()) {
+                it = shard->map.erase(it);
+                ++emptied;
+            }
+            else {
+                ++it;
+            }
+        }
+    }
+    _trigrams.fetch_sub(emptied, std::memory_order_relaxed);
+    return removed;
+}
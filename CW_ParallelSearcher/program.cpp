@@ -1,22 +1,46 @@
 #include "Listener.h"
+#include "FileManager.h"
 #include <iostream>
 #include <csignal>
+#include <string>
+#define IMPORT_REPORT_INTERVAL_MS 1000
 bool stopFlag = false;
 
 class Server {
 private:
 	std::unique_ptr<Listener> listener;
+	std::string importRoot;
 
 public:
-	Server() : listener(std::make_unique<Listener>()) {}
+	Server(const std::string& importRoot, const std::string& allowedImportRoot)
+		: listener(std::make_unique<Listener>()), importRoot(importRoot) {
+		if (!allowedImportRoot.empty())
+			listener->allowImportsUnder(allowedImportRoot);
+	}
 
 	void run() {
 		std::signal(SIGINT, Server::handleSignal);
 
 		listener->startListening();
+		bool importing = false;
+		if (!importRoot.empty()) {
+			auto error = listener->startImport(importRoot);
+			if (!error.empty())
+				std::cerr << "Import failed: " << error << std::endl;
+			importing = error.empty();
+		}
 
+		auto nextReport = std::chrono::steady_clock::now();
 		while (!stopFlag) {
 			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+			if (importing && std::chrono::steady_clock::now() >= nextReport) {
+				// the importer prints the final line itself
+				auto progress = listener->importProgress();
+				importing = progress.running;
+				if (importing)
+					std::cout << progress.toString() << std::endl;
+				nextReport += std::chrono::milliseconds(IMPORT_REPORT_INTERVAL_MS);
+			}
 		}
 
 		std::cout << "Shutting down server..." << std::endl;
@@ -30,11 +54,34 @@ public:
 	}
 };
 
-int main()
+// CW_ParallelSearcher [--import <directory>] [--import-root <directory>] [--compress]
+//   --import      copies and indexes every file below directory while serving, printing progress
+//   --import-root enables POST /admin/import for local clients, for directories below this one
+//   --compress    stores new files as LZ4 blocks (BlockStore); files stored before stay readable
+int main(int argc, char* argv[])
 {
+	std::string importRoot;
+	std::string allowedImportRoot;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--import" && i + 1 < argc) {
+			importRoot = argv[++i];
+		}
+		else if (arg == "--import-root" && i + 1 < argc) {
+			allowedImportRoot = argv[++i];
+		}
+		else if (arg == "--compress") {
+			FileManager::SetCompression(true);
+		}
+		else {
+			std::cerr << "Usage: " << argv[0] << " [--import <directory>] [--import-root <directory>] [--compress]" << std::endl;
+			return EXIT_FAILURE;
+		}
+	}
+
 	try
 	{
-		Server server;
+		Server server(importRoot, allowedImportRoot);
 		server.run();
 	}
 	catch (const std::exception& ex)